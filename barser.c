@@ -33,11 +33,42 @@
  *
  */
 
+/* bsParseFile() maps files where POSIX mmap() is available, unless BS_NO_MMAP */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(BS_NO_MMAP)
+#define BS_MMAP
+#define _POSIX_C_SOURCE 200112L /* because posix_madvise */
+#endif /* BS_MMAP */
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <stdbool.h>
+#ifdef BS_MMAP
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* BS_MMAP */
+#ifdef BS_THREADS
+#include <pthread.h>
+#endif /* BS_THREADS */
+
+/* vectorised scanning: AVX2 if the compiler targets it, SSE2 otherwise, unless BS_NO_SIMD */
+#if defined(__AVX2__) && !defined(BS_NO_SIMD)
+#define BS_AVX2
+#define BS_AVX2_FUNC inline
+#include <immintrin.h>
+#elif defined(__SSE2__) && !defined(BS_NO_SIMD)
+#define BS_SSE2
+#include <emmintrin.h>
+/* ...and AVX2 all the same if the CPU turns out to have it, see bsCharSetInit() */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BS_AVX2_DISPATCH
+#define BS_AVX2_FUNC __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
 
 #include "rbt/st_inline.h"
 
@@ -61,15 +92,47 @@
 
 #endif /* (BS_BUILD_MAX_TOKENS < BS_MAX_TOKENS) */
 
+/* parallel parsing: inputs smaller than this are parsed on one thread */
+#define BS_PARALLEL_MINSIZE 262144
+/* parallel parsing: most brackets around the whole input we will cut out */
+#define BS_PARALLEL_MAXHOLES 16
+/* parallel parsing: most threads we will use, whatever we are asked for */
+#define BS_PARALLEL_MAXTHREADS 256
+/* streaming: most of the current line we keep before the unparsed data, to show it on error */
+#define BS_STREAM_KEEPLINE 1024
 /* stdin block size */
 #define BS_STDIN_BLKSIZE 2048
 /* stdin block growth */
 #define BS_STDIN_BLKEXTENT 10
+/* node store: initial slab size in nodes - slabs double in size until they reach max */
+#define BS_SLAB_MINSIZE 64
+#define BS_SLAB_MAXSIZE 65536
 /* root node hash - a large 32-bit prime with a healthy bit mix */
 #define BS_ROOT_HASH 0xace6cabd
 
 /* hash mixing function */
-#define BS_MIX_HASH(a, b, len) ((a ^ rol32(b, 31)))
+#define BS_MIX_HASH(a, b, len) ((a) ^ rol32((b), 31))
+
+/* child list operations - plain linked_list.h for pointer nodes, own implementation for handles */
+#ifdef BS_COMPACT_NODES
+#define BS_CLEAR_LINKS(node) \
+    (node)->_parent = 0; \
+    (node)->_firstChild = 0; \
+    (node)->_lastChild = 0; \
+    (node)->_next = 0; \
+    (node)->_prev = 0; \
+    (node)->_indexNext = 0;
+#define BS_APPEND_CHILD(parent, node) bsAppendChild(parent, node);
+#define BS_REMOVE_CHILD(parent, node) bsRemoveChild(parent, node);
+#else
+#define BS_CLEAR_LINKS(node) \
+    (node)->parent = NULL; \
+    (node)->_indexNext = NULL; \
+    LL_CLEAR_HOLDER(node); \
+    LL_CLEAR_MEMBER(node);
+#define BS_APPEND_CHILD(parent, node) LL_APPEND_DYNAMIC(parent, node)
+#define BS_REMOVE_CHILD(parent, node) LL_REMOVE_DYNAMIC(parent, node)
+#endif /* BS_COMPACT_NODES */
 /* an alternative */
 /* #define BS_MIX_HASH(a, b, len) (rol32(a, 1) + rol32(b, 7)) */
 
@@ -113,20 +176,38 @@ memset(name, 0, name ## _len);
 			state.tokenCache[i].data = NULL;\
 		    }\
 		}\
+		free(state.scratch);\
+		state.scratch = NULL;\
+		state.scratchSize = 0;\
+		state.scratchBase = 0;\
 		state.tokenCount = 0;\
 		state.tokenOffset = 0;
 
 /* shorthant to reset token cache */
 #define tokenreset() \
-		state.tokenCount = 0;\
-		state.tokenOffset = 0;\
-		state.flags = 0;
+		state->tokenCount = 0;\
+		state->tokenOffset = 0;\
+		state->scratchBase = 0;\
+		state->flags = 0;
+
+/* shorthand to discard the token cache without using it */
+#define tokendrop() \
+		for(int i = 0; i < state->tokenCount; i++) {\
+		    if(state->tokenCache[i].quoted && state->tokenCache[i].data != NULL) {\
+			free(state->tokenCache[i].data);\
+			state->tokenCache[i].data = NULL;\
+		    }\
+		}\
+		tokenreset();
 
 /* shorthand to get token data and quoted check flags */
-#define td(n) getTokenData(&state.tokenCache[n + state.tokenOffset])
-#define ts(n) state.tokenCache[n + state.tokenOffset].data
-#define tq(n) state.tokenCache[n + state.tokenOffset].quoted
-#define tl(n) state.tokenCache[n + state.tokenOffset].len
+#define td(n) getTokenData(dict, &state->tokenCache[n + state->tokenOffset])
+#define ts(n) state->tokenCache[n + state->tokenOffset].data
+#define tq(n) state->tokenCache[n + state->tokenOffset].quoted
+#define tl(n) state->tokenCache[n + state->tokenOffset].len
+/* finish storing token #n as node's name / value once the node exists - only valid after td(n) was called */
+#define tname(node, n) bsAdoptToken(dict, node, &state->tokenCache[n + state->tokenOffset], false)
+#define tvalue(node, n) bsAdoptToken(dict, node, &state->tokenCache[n + state->tokenOffset], true)
 
 /* get the existing child of node 'parent' named as token #n in cache */
 #define gch(parent, n) _bsGetChild(dict, parent, state.tokenCache[n].data, state.tokenCache[n].len)
@@ -155,32 +236,367 @@ enum {
     BS_ERROR		/* parse error */
 };
 
+/* what the JSON parser expects next */
+enum {
+    BS_JSON_KEY_OR_END = 0,	/* first member name or '}' */
+    BS_JSON_KEY,		/* member name */
+    BS_JSON_COLON,		/* ':' after member name */
+    BS_JSON_VALUE_OR_END,	/* first array element or ']' */
+    BS_JSON_VALUE,		/* any value */
+    BS_JSON_COMMA_OR_END	/* ',' or end of current object / array */
+};
+
+#ifdef BS_THREADS
+/*
+ * parallel parsing: a piece of the input, parsed on its own into a private dictionary
+ * which is then spliced into the target dictionary, see bsParseParallel()
+ */
+typedef struct {
+    BsDict *dict;		/* private dictionary */
+    char *start;		/* piece start */
+    char *end;			/* piece end */
+    char **holes;		/* characters within the piece to leave out - brackets around the whole input */
+    size_t holecount;		/* number of holes */
+    BsState state;		/* parser state after the piece was parsed */
+} BsParseJob;
+#endif /* BS_THREADS */
+
+/*
+ * where bsStatement() sends what the statements it reads amount to: nodes created by bsParse(),
+ * or callbacks made by bsParseEvents(). Nodes are opened inside the last one opened by the same
+ * statement, or inside the current node if it has opened none yet; a bracket makes them the
+ * current node until it is closed, otherwise they are closed when the statement ends.
+ */
+typedef struct {
+    /* is the current node an array */
+    bool (*inArray)(void *ctx);
+    /* are we at the top, with no node or bracket open */
+    bool (*atTop)(void *ctx);
+    /* open a @type node named after token #n, unnamed if n < 0 */
+    void (*open)(void *ctx, BsState *state, const int type, const int n, const uint32_t flags);
+    /* a bracket: the nodes this statement opened (if any) become the current node */
+    void (*enter)(void *ctx);
+    /* end of statement: close the nodes it opened */
+    void (*shut)(void *ctx);
+    /* end of bracket: close the nodes it opened, false if there is none open */
+    bool (*leave)(void *ctx);
+    /* a leaf named after token #n, with the value of token #v, no value if v < 0 */
+    void (*leaf)(void *ctx, BsState *state, const int n, const int v, const uint32_t flags);
+    /* an array member with the value of token #n */
+    void (*item)(void *ctx, BsState *state, const int n, const uint32_t flags);
+    /* selective parsing, may be NULL: true if the statement was left out */
+    bool (*skip)(void *ctx, BsState *state);
+} BsSink;
+
+/* bsParse() sink: build nodes */
+typedef struct {
+    BsParser *parser;		/* dictionary, current node and node stack */
+    BsNode *node;		/* last node opened by the statement being parsed */
+} BsNodeSink;
+
+/* bsParseEvents() sink: report nodes to callbacks */
+typedef struct {
+    const BsEventHandlers *handlers;
+    void *user;
+    int *open;			/* types of open nodes */
+    size_t openCount;
+    size_t openSize;
+    int *levels;		/* number of nodes each open bracket opened */
+    size_t levelCount;
+    size_t levelSize;
+    int opened;			/* nodes opened by the statement being parsed */
+    bool stop;			/* a handler asked us to stop */
+} BsEventSink;
+
+/*
+ * private lookup structures of a node with many children, kept in the dictionary's
+ * registry, keyed by node, rather than in every node. Nodes holding any are flagged,
+ * so other nodes never look there.
+ */
+struct BsNodeAux {
+    BsNode *node;		/* node whose children these are, NULL for a free registry slot */
+    /*
+     * BS_CHILDMAP, unindexed dictionaries only: children by hash, chained via _indexNext,
+     * which only an index would otherwise use
+     */
+    BsNode **buckets;
+    uint32_t mask;		/* bucket count - 1 */
+    uint32_t count;		/* children held */
+    /* BS_MEMBERS, arrays only: members in list order */
+    BsNode **members;
+    size_t memberCount;		/* members held */
+    size_t memberSize;		/* member vector capacity */
+    bool dense;			/* every member's ordinal is its position */
+};
+
+typedef struct BsNodeAux BsNodeAux;
+
+/* a query split into path segments, see bsCompileQuery() */
+struct BsQuery {
+    BsPathSeg *segs;		/* path segments */
+    size_t count;		/* number of segments */
+    char *names;		/* unescaped segment names, segments point in here */
+    uint32_t hash;		/* path hash from the root */
+};
+
+/* how a pattern segment is matched, see bsCompilePattern() */
+enum {
+    BS_PSEG_NAME = 0,		/* a name: looked up, a run of them in one go */
+    BS_PSEG_SLICE,		/* an array slice, or a name anywhere else */
+    BS_PSEG_GLOB,		/* a name with wildcards: matched against each child */
+    BS_PSEG_ANY,		/* a lone BS_PATTERN_ANY: any child */
+    BS_PSEG_DEEP		/* two of them: any number of levels down, none included */
+};
+
+/* one segment of a pattern */
+typedef struct {
+    int type;			/* BS_PSEG_* */
+    size_t run;			/* BS_PSEG_NAME: names in a row from this one on */
+    BsToken raw;		/* the segment as written, escapes and all */
+} BsPatternPart;
+
+/* a pattern query split into path segments, see bsCompilePattern() */
+struct BsPattern {
+    BsPathSeg *segs;		/* path segments, names unescaped */
+    BsPatternPart *parts;	/* how each segment is matched */
+    size_t count;		/* number of segments */
+    char *names;		/* unescaped segment names, segments point in here */
+    char *text;			/* copy of the pattern, raw segments point in here */
+};
+
+/* one lookup of a batch, see bsQueryGetMany() */
+typedef struct {
+    uint32_t hash;		/* path hash */
+    size_t id;			/* position in the batch */
+} BsProbe;
+
+/* a query compiled on the stack for a single lookup, or on the heap if it is long */
+#define BS_QUERY_DECL(var) char var##_names[BS_QUERY_STACKSIZE];\
+			    BsPathSeg var##_segs[BS_QUERY_STACKSIZE / 2 + 1];\
+			    BsQuery var = { .segs = var##_segs, .names = var##_names }
+#define BS_QUERY_SPLIT(var, qry) {\
+			    size_t var##_segmax;\
+			    const size_t var##_len = bsQuerySize(qry, &var##_segmax);\
+			    if(var##_len >= BS_QUERY_STACKSIZE) {\
+				xmalloc(var.names, var##_len);\
+				xmalloc(var.segs, var##_segmax * sizeof(BsPathSeg));\
+			    }\
+			    bsQuerySplit(&var, qry);\
+			    }
+#define BS_QUERY_FREE(var) if(var.names != var##_names) {\
+			    free(var.names);\
+			    free(var.segs);\
+			    }
+
+/* a file parsed in place by bsParseFile(), kept for as long as the dictionary */
+struct BsSource {
+    char *data;			/* file contents, NUL-terminated */
+    size_t size;		/* mapping size or allocation size */
+    bool mapped;		/* mapped, not read into memory */
+    struct BsSource *next;
+};
+
+/* selective parsing: one name of a requested path */
+typedef struct {
+    char *data;
+    size_t len;
+    bool isnum;			/* name is an ordinal... */
+    uint32_t ordinal;		/* ...and this is it */
+} BsSelectName;
+
+/* selective parsing: the paths to keep, and how to skip the rest, see bsParseSelect() */
+struct BsSelect {
+    BsSelectName *names;	/* names of all paths, one path after another */
+    size_t *lengths;		/* number of names in each path */
+    size_t count;		/* number of paths */
+    size_t keepFrom;		/* node stack height at which the subtree being kept whole starts, 0 if none */
+    BsCharSet plain;		/* characters that do not change how a skipped block is read */
+    BsCharSet quoted;		/* characters that do not end a quoted string */
+    BsCharSet comment;		/* characters that do not end a comment */
+};
+
+/* selective parsing decisions */
+enum {
+    BS_SELECT_SKIP = 0,		/* not asked for */
+    BS_SELECT_PATH,		/* leads to something asked for */
+    BS_SELECT_KEEP		/* asked for */
+};
+
 /* 'c' class check shorthand, assumes the presence of 'c' int variable */
 #define cclass(cl) (chflags[(unsigned char)c] & (cl))
 
 /* save state when we encounter a section that can have unmatched or unterminated bounds */
-#define savestate(st) 		st->slinestart = st->linestart;\
-				st->slineno = st->lineno;\
-				st->slinepos = st->linepos;
+#define savestate(st) 		st->mark = st->current;
 /* restore state, say when printing an error */
-#define restorestate(st) 	st->linestart = st->slinestart;\
-				st->lineno = st->slineno;\
-				st->linepos = st->slinepos;
+#define restorestate(st) 	bsLocate(st, st->mark);
 
 
 /* ========= static function declarations ========= */
 
 /* initialise parser state */
 static void bsInitState(BsState *state, char* buf, const size_t bufsize);
-/* return a pointer to token data / name, duplicating / copying if necessary */
-static inline char* getTokenData(BsToken *token);
+/* return a pointer to token data / name, duplicating / copying / pooling if necessary */
+static inline char* getTokenData(BsDict *dict, BsToken *token);
+/* return a dictionary-owned copy of @len bytes of @src */
+static inline char* bsStoreStr(BsDict *dict, const char *src, const size_t len);
+/* release a dictionary-owned string */
+static inline void bsDropStr(BsDict *dict, char *str, const bool shared, const bool borrowed, const bool inlined);
+static inline char* bsInlineSlot(BsNode *node, const bool isvalue, const size_t len);
+static inline void bsAdoptStr(BsDict *dict, BsNode *node, const bool isvalue, char *str, const size_t len, const bool owned);
+static inline void bsAdoptToken(BsDict *dict, BsNode *node, BsToken *token, const bool isvalue);
+static inline void bsAccountStr(BsDict *dict, const BsNode *node, const bool isvalue, const bool add);
+static inline BsNode* bsCreateNodeCopy(BsDict *dict, BsNode *parent, const unsigned int type, const char* name, const size_t namelen, const char* value, const size_t valuelen);
+/* replace node name with a dictionary-owned copy of @name */
+static inline void bsSetNodeName(BsDict *dict, BsNode *node, const char *name, const size_t len);
+/* hash of a node's name - cached if the name is pooled */
+static inline uint32_t bsNameHash(BsNode *node);
+/* integer hash of an array member ordinal */
+static inline uint32_t bsOrdinalHash(uint32_t n);
+/* check if string is a canonical decimal u32 and parse it into @out if so */
+static inline bool bsParseOrdinal(const char *str, const size_t len, uint32_t *out);
+/* number of decimal digits in an ordinal */
+static inline size_t bsOrdinalLen(uint32_t n);
+/* hash a node name string - decimal names hash as ordinals */
+static inline uint32_t bsHashName(const char *name, const size_t len);
+/* get node name without materialising it: ordinal names are formatted into @buf */
+static inline char* bsNameOf(BsNode *node, char *buf);
+/* check if node is called @name - @isnum and @ord are the result of bsParseOrdinal() on @name */
+static inline bool bsNameMatch(BsNode *node, const char *name, const size_t len, const bool isnum, const uint32_t ord);
+/* strstr() for a haystack of known length which need not be NUL-terminated */
+static inline bool bsStrnStr(const char *hay, const size_t haylen, const char *needle);
 /* fetch next character from buffer and advance, return it as int or EOF if end reached */
 static inline int bsForward(BsState *state);
+static inline char* bsQuotedEnd(BsState *state, char *p, const int qchar);
+static void bsCharSetInit(BsCharSet *set);
+static inline char* bsRunEnd(const BsCharSet *set, char *p, const char *end);
+#if defined(BS_AVX2) || defined(BS_AVX2_DISPATCH)
+/* skip 32-byte blocks of @set members starting at @p */
+static BS_AVX2_FUNC char* bsRunEndAvx2(const BsCharSet *set, char *p, const char *end);
+#endif
+static inline int bsForwardRun(BsState *state, const BsCharSet *set);
+static void bsLocate(BsState *state, const char *pos);
+static inline void bsScratchReserve(BsState *state, const size_t size);
+/* read four hex digits, as in a JSON \u escape */
+static inline bool bsJsonHex4(const char *p, const char *end, uint32_t *out);
+/* write a code point as UTF-8 */
+static inline size_t bsUtf8Put(char *out, const uint32_t cp);
+/* get a JSON string starting at opening quote @p into @tok, return pointer past the closing quote */
+static inline char* bsJsonString(BsState *state, const BsCharSet *set, BsToken *tok, char *p);
+/* check if @p to @end is a valid JSON number */
+static inline bool bsJsonNumber(const char *p, const char *end);
+#ifdef BS_THREADS
+/* find up to @count - 1 places to split @buf at for a parallel parse */
+static size_t bsFindCuts(char *buf, const size_t len, char **cuts, const size_t count, char **holes, size_t *holecount, char **dataend);
+/* parallel parse worker: parse one piece of the input */
+static void* bsParseJobRun(void *arg);
+/* move the contents of a privately parsed dictionary under the root of @dict */
+static void bsAdoptDict(BsDict *dict, BsDict *from);
+#endif /* BS_THREADS */
+/* unmap or free a file parsed in place */
+static void bsReleaseSource(struct BsSource *src);
+/* release input files parsed in place */
+static void bsFreeSources(BsDict *dict);
+/* index all unindexed nodes in slabs from @first onwards in one go */
+static void bsIndexBulk(BsDict *dict, const size_t first);
+/* sort index entries by hash, return whichever of the two buffers holds the result */
+static BsIndexEntry* bsSortEntries(BsIndexEntry *entries, BsIndexEntry *tmp, const size_t count);
+/* BS_BULKINDEX: hold off indexing while parsing */
+static inline bool bsDeferIndex(BsDict *dict);
+/* registry slot @node's lookup structures would ideally take */
+static inline size_t bsAuxHome(const BsNode *node, const size_t mask);
+/* registry slot holding @node's lookup structures, or the free slot where they would go */
+static inline BsNodeAux* bsAuxSlot(BsDict *dict, const BsNode *node);
+/* get @node's registry entry, adding an empty one if it has none */
+static BsNodeAux* bsAuxGet(BsDict *dict, BsNode *node);
+/* remove @node's registry entry once it holds nothing */
+static void bsAuxRelease(BsDict *dict, BsNode *node);
+/* drop all lookup structures */
+static void bsAuxFree(BsDict *dict);
+/* move the children in a child map to @size new buckets */
+static void bsChildMapResize(BsDict *dict, BsNodeAux *map, const uint32_t size);
+/* build @node's child map, unless it has one */
+static BsNodeAux* bsChildMapBuild(BsDict *dict, BsNode *node);
+/* add a node to its parent's child map, if the parent has one */
+static void bsChildMapPut(BsDict *dict, BsNode *node);
+/* remove a node from its parent's child map, if the parent has one */
+static void bsChildMapDelete(BsDict *dict, BsNode *node);
+/* drop @node's child map */
+static void bsChildMapDrop(BsDict *dict, BsNode *node);
+/* drop all child maps */
+static void bsChildMapsFree(BsDict *dict);
+/* build array @node's member vector, unless it has one */
+static BsNodeAux* bsMembersBuild(BsDict *dict, BsNode *node);
+/* append a new member to its array's member vector, if the array has one */
+static inline void bsMembersPut(BsDict *dict, BsNode *node);
+/* remove a member from its array's member vector, if the array has one */
+static void bsMembersDelete(BsDict *dict, BsNode *node);
+/* build the lookup structures @node is due and does not have yet */
+static inline void bsAuxBuild(BsDict *dict, BsNode *node);
+/* drop @node's member vector */
+static void bsMembersDrop(BsDict *dict, BsNode *node);
+/* look up an array member by name via the member vector, return false if the vector cannot tell */
+static inline bool bsMemberGet(BsDict *dict, BsNode *array, const char *name, const size_t len,
+			const bool isnum, const uint32_t ord, BsNode **out);
+/* append members of @array at positions @from to @to - 1 to @out */
+static void bsMemberSlice(LList *out, BsDict *dict, BsNode *array, size_t from, size_t to);
+/* check if path segment @tok is an array slice, get its bounds if so */
+static inline bool bsParseSlice(const BsPathSeg *seg, size_t *from, size_t *to);
+/* append all children of @parent matching a path segment to @out */
+static inline void bsSegChildren(LList *out, BsDict *dict, BsNode *parent, const BsPathSeg *seg);
+/* append nodes matching path segments under @node to @out, array slices allowed */
+static LList* bsPathWalk(LList *out, BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count);
+/* statement grammar shared by bsParse() and bsParseEvents(): act on the last parser event */
+static inline bool bsStatement(BsState *state, const BsSink *sink, void *ctx);
+/* bsParse() sink callbacks, see BsSink */
+static bool bsNodeInArray(void *ctx);
+static bool bsNodeAtTop(void *ctx);
+static void bsNodeOpen(void *ctx, BsState *state, const int type, const int n, const uint32_t flags);
+static void bsNodeEnter(void *ctx);
+static void bsNodeShut(void *ctx);
+static bool bsNodeLeave(void *ctx);
+static void bsNodeLeaf(void *ctx, BsState *state, const int n, const int v, const uint32_t flags);
+static void bsNodeItem(void *ctx, BsState *state, const int n, const uint32_t flags);
+static bool bsNodeSkip(void *ctx, BsState *state);
+/* parse loop shared by bsParse() and the streaming parser */
+static void bsParseRun(BsParser *parser, const bool final);
+/* push @val onto a growing stack of ints */
+static inline void bsIntPush(int **stack, size_t *count, size_t *size, const int val);
+/* bsParseEvents() sink callbacks, see BsSink */
+static bool bsEventInArray(void *ctx);
+static bool bsEventAtTop(void *ctx);
+static void bsEventOpen(void *ctx, BsState *state, const int type, const int n, const uint32_t flags);
+static void bsEventEnter(void *ctx);
+static void bsEventShut(void *ctx);
+static bool bsEventLeave(void *ctx);
+static void bsEventLeaf(void *ctx, BsState *state, const int n, const int v, const uint32_t flags);
+static void bsEventItem(void *ctx, BsState *state, const int n, const uint32_t flags);
+/* point the streaming parser's state at its buffer */
+static void bsParserRebase(BsParser *parser);
+/* selective parsing: decide on a statement naming @count nodes below @head */
+static int bsSelectCheck(struct BsSelect *sel, BsNode *root, BsNode *head, BsToken *names, const int count, const size_t height);
+/* selective parsing: decide on a leaf statement with @count tokens */
+static inline bool bsSelectLeaf(struct BsSelect *sel, BsNode *root, BsNode *head, BsToken *tokens, const int count, const size_t height);
+/* selective parsing: move past the end of the block or array just opened, without parsing it */
+static bool bsSkipBlock(BsState *state, const struct BsSelect *sel);
 /* peek at the next character without moving forward */
 static inline int bsPeek(BsState *state);
 
+#ifdef BS_COMPACT_NODES
+/* append node to parent's child list */
+static inline void bsAppendChild(BsNode *parent, BsNode *node);
+/* remove node from parent's child list */
+static inline void bsRemoveChild(BsNode *parent, BsNode *node);
+#endif /* BS_COMPACT_NODES */
+/* get a node from the dictionary's node store */
+static inline BsNode* bsAllocNode(BsDict *dict);
+/* free node contents and return node to the dictionary's node store */
+static inline void bsReleaseNode(BsDict *dict, BsNode *node);
+/* free node contents, dropping pooled string references */
+static inline void bsClearNode(BsDict *dict, BsNode *node);
+/* free all nodes in the node store, optionally retaining the root node */
+static void bsReleaseNodes(BsDict *dict, bool keeproot);
 /* dump a quoted string (if quoted) and escape characters where needed */
-static inline int bsDumpQuoted(FILE* fl, char *src, bool quoted);
+static inline int bsDumpQuoted(FILE* fl, char *src, const size_t len, bool quoted);
 /* Dump node contents recursively to a file pointer. */
 static int _bsDumpNode(FILE* fl, BsNode *node, int level);
 /* Create a node in dict at given parent with given name and (optionally) value */
@@ -193,6 +609,14 @@ static inline BsNode* _bsGetChild(BsDict* dict, BsNode *parent,
 /* get a list of children of node with specified name. Returns a dynamic LList* that needs freed */
 static inline LList* _bsGetChildren(LList* out, BsDict* dict, BsNode *parent,
 			const char* name, const size_t namelen);
+/* bsIndexNone lookups: find a child, all children with a name, or a node by path, walking the tree */
+static BsNode* bsScanChild(BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+static void bsScanChildren(LList *out, BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+static BsNode* bsScanPath(BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count, const uint32_t hash);
+/* check if @n is reached from @node through path segments @segs */
+static inline bool bsPathMatch(BsNode *n, const BsNode *node, const BsPathSeg *segs, size_t count);
 /* walk through string @in, and write to + return next token between the 'sep' character */
 static inline BsToken* unescapeToken(BsToken* out, char** in, const char sep);
 /* recursive node rehash callback */
@@ -201,16 +625,24 @@ static void* bsRehashCallback(BsDict *dict, BsNode *node, void* user, void* feed
 static void bsErrorHint(BsState *state);
 /* main buffer scanner / lexer state machine */
 static inline void bsScan(BsState *state);
-/* node indexing callback - used when indexing a previously unindexed dictionary */
-static void* bsIndexCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop);
 /* node reindexing callback - used when forcing a reindex */
 static void* bsReindexCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop);
-/* expand escape sequences and produce a clean query trimmed on both ends, matching the bsGetPath output */
-static inline size_t cleanupQuery(char* query);
-/* return a new string containing cleaned up query */
-static inline char* getCleanQuery(const char* query);
-/* compute the compound hash of a query path rooted ad node @root */
-static inline uint32_t bsGetPathHash(BsNode* root, const char* query);
+/* length of a query, and the most segments it can split into in @segmax */
+static inline size_t bsQuerySize(const char *qry, size_t *segmax);
+/* unescape the next path segment of a query, return false if there are none left */
+static inline bool bsQuerySegment(const char **in, char **out, BsPathSeg *seg, BsToken *raw, bool *wild);
+/* split a query into unescaped path segments, held in buffers @query provides */
+static inline void bsQuerySplit(BsQuery *query, const char *qry);
+/* path hash of @query run from @node */
+static inline uint32_t bsQueryHash(const BsQuery *query, const BsNode *node);
+/* sort lookups by the top 16 bits of their hash */
+static BsProbe* bsSortProbes(BsProbe *probes, BsProbe *tmp, const size_t count);
+/* match name @str against the pattern segment @pat as written, escapes and all */
+static inline bool bsGlobMatch(const char *pat, const size_t plen, const char *str, const size_t slen);
+/* match pattern segments from @i on below @node, appending matching nodes to @out */
+static void bsPatternWalk(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern, const size_t i);
+/* look up the run of names starting at pattern segment @i below @node, matching the rest of the pattern below each */
+static void bsPatternNames(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern, const size_t i, const size_t run);
 /* dictionary / node duplication callback */
 static void *bsDupCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop);
 
@@ -221,19 +653,52 @@ static void bsInitState(BsState *state, char* buf, const size_t bufsize) {
 
     state->current = buf;
     state->prev = '\0';
-    state->c = buf[0];
+    state->c = (bufsize > 0) ? buf[0] : EOF;
     state->end = buf + bufsize;
-
-    state->linestart = buf;
-    state->slinestart = buf;
+    state->start = buf;
+    state->mark = buf;
 
     memset(&state->tokenCache, 0, BS_MAX_TOKENS * sizeof(BsToken));
 
+    state->scratch = NULL;
+    state->scratchSize = 0;
+    state->scratchBase = 0;
+    state->inPlace = false;
+
+    /* character sets for the vectorised scanner, straight from the class table */
+    for(int i = 0; i < 256; i++) {
+	uint16_t fl = chflags[i];
+	state->tokenChars.member[i] = (fl & (BF_TOK | BF_EXT)) && !(fl & (BF_NLN | BF_CTL));
+	state->spaceChars.member[i] = (fl & BF_SPC) && !(fl & (BF_NLN | BF_CTL));
+	state->quotedChars[0].member[i] = (i != BS_ESCAPE_CHAR) && (i != '\0') && !(fl & BF_NLN);
+    }
+
+    /* a quoted string ends at its own quote character only, the others are just characters in it */
+#ifdef BS_QUOTE1_CHAR
+    state->quotedChars[1] = state->quotedChars[0];
+    state->quotedChars[1].member[(unsigned char)BS_QUOTE1_CHAR] = false;
+    bsCharSetInit(&state->quotedChars[1]);
+#endif
+#ifdef BS_QUOTE2_CHAR
+    state->quotedChars[2] = state->quotedChars[0];
+    state->quotedChars[2].member[(unsigned char)BS_QUOTE2_CHAR] = false;
+    bsCharSetInit(&state->quotedChars[2]);
+#endif
+#ifdef BS_QUOTE3_CHAR
+    state->quotedChars[3] = state->quotedChars[0];
+    state->quotedChars[3].member[(unsigned char)BS_QUOTE3_CHAR] = false;
+    bsCharSetInit(&state->quotedChars[3]);
+#endif
+    state->quotedChars[0].member[(unsigned char)BS_QUOTE_CHAR] = false;
+
+    bsCharSetInit(&state->tokenChars);
+    bsCharSetInit(&state->spaceChars);
+    bsCharSetInit(&state->quotedChars[0]);
+
+    state->linestart = buf;
     state->linepos = 0;
     state->lineno = 1;
-
-    state->slinepos = 0;
-    state->slineno = 1;
+    state->lineBase = 0;
 
     state->scanState = BS_SKIP_WHITESPACE;
 
@@ -247,22 +712,61 @@ static void bsInitState(BsState *state, char* buf, const size_t bufsize) {
 }
 
 
-/* return a pointer to token data / name, duplicating / copying if necessary */
-static inline char* getTokenData(BsToken *token) {
+/* return a pointer to token data / name, duplicating / copying / pooling / borrowing as necessary */
+static inline char* getTokenData(BsDict *dict, BsToken *token) {
 
     char* out;
 
+    token->borrowed = 0;
+    token->inlined = 0;
+
+    /* a pooled copy is all we need, quoted strings are not needed after that */
+    if(dict->flags & BS_INTERN) {
+
+	out = spIntern(dict->strings, token->data, token->len);
+
+	if(token->quoted) {
+	    free(token->data);
+	    token->data = NULL;
+	}
+
+	return out;
+
+    }
+
+    /*
+     * short strings will be copied into the node once it exists (see bsAdoptToken()),
+     * so hand out the token data as is - unless zero-copy can simply borrow it.
+     * The interning case above never gets here, so neither does anything pooled.
+     */
+    if(token->len < BS_INLINE_SIZE && (token->quoted || !(dict->flags & BS_ZEROCOPY))) {
+
+	if(token->quoted) {
+	    token->data[token->len] = '\0';
+	}
+
+	token->inlined = ~0;
+	return token->data;
+
+    }
+
     /*
-     * a quoted string is always dynamically allocated to we can take it as is,
-     * we only need to trim it, because they are resized by 2 when parsing,
-     * so get rid of extra memory by cutting it to the required size only.
+     * a quoted string is always dynamically allocated, and at its final size -
+     * the scanner copies it out of the input or the scratch buffer once it knows
+     * the length - so we can take it as is.
      */
     if(token->quoted) {
 
-	xrealloc(out, token->data, token->len + 1);
+	out = token->data;
 	/* this way we know this has been used, so we will not attempt to free it */
 	token->data = NULL;
 
+    /* token->data is in the caller's buffer which outlives us, so we just point at it */
+    } else if(dict->flags & BS_ZEROCOPY) {
+
+	token->borrowed = ~0;
+	return token->data;
+
     /* otherwise token->data is in an existing buffer, so we duplicate */
     } else {
 
@@ -278,2377 +782,6630 @@ static inline char* getTokenData(BsToken *token) {
 
 }
 
-/* fetch next character from buffer and advance, return it as int or EOF if end reached */
-static inline int bsForward(BsState *state) {
+/* return a dictionary-owned copy of @len bytes of @src: pooled if the dictionary interns strings, duplicated otherwise */
+static inline char* bsStoreStr(BsDict *dict, const char *src, const size_t len) {
 
-    int c;
+    char *out;
 
-    if(state->current >= state->end) {
-        return EOF;
+    if(dict->flags & BS_INTERN) {
+	return spIntern(dict->strings, src, len);
     }
 
-    state->prev = state->c;
+    xmalloc(out, len + 1);
+    memcpy(out, src, len);
+    out[len] = '\0';
 
-    state->current++;
-    c = *state->current;
+    return out;
 
-    if(c == '\0') {
-        state->c = EOF;
-        return EOF;
+}
+
+/* release a dictionary-owned string - borrowed and inline strings are not ours to release */
+static inline void bsDropStr(BsDict *dict, char *str, const bool shared, const bool borrowed, const bool inlined) {
+
+    if(str == NULL || borrowed || inlined) {
+	return;
     }
 
-    /* we have a newline */
-    if(cclass(BF_NLN)) {
+    if(shared) {
+	spRelease(dict->strings, str);
+    } else {
+	free(str);
+    }
 
-	/*
-	 * If we came across two different newline characters, advance line number only once.
-	 * This is a cheap trick to handle Windows' CR-LF. Let me know if this even lands on Window.
-	 */
-	if(!(chflags[state->prev] & BF_NLN) || c == state->prev) {
-	    state->linestart = state->current + 1;
-	    state->lineno++;
-	    state->linepos = 0;
+}
+
+/* where in node's inline buffer a name / value of @len would go, NULL if it does not fit */
+static inline char* bsInlineSlot(BsNode *node, const bool isvalue, const size_t len) {
+
+    size_t offset = 0;
+
+    if(!isvalue) {
+	/* the value sits right behind the name, so the name cannot change under it */
+	if(node->flags & BS_INLINE_VALUE) {
+	    return NULL;
 	}
+    } else if(node->flags & BS_INLINE_NAME) {
+	offset = node->nameLen + 1;
+    }
 
-    } else {
-	state->linepos++;
+    if(offset + len >= BS_INLINE_SIZE) {
+	return NULL;
     }
 
-    return (state->c = c);
+    return node->_inline + offset;
 
 }
 
-/* peek at the next character without moving forward */
-static inline int bsPeek(BsState *state) {
+/* add / remove heap bytes held by node's name or value to / from dictionary memory stats */
+static inline void bsAccountStr(BsDict *dict, const BsNode *node, const bool isvalue, const bool add) {
 
-    if(state->current >= state->end) {
-	return EOF;
+    const char *str = isvalue ? node->value : node->name;
+    size_t *counter = isvalue ? &dict->mem.values : &dict->mem.names;
+    size_t bytes;
+
+    /* pooled strings are counted by the pool, borrowed and inline ones cost nothing */
+    if(str == NULL || (node->flags & (isvalue ? (BS_SHARED_VALUE | BS_BORROWED_VALUE | BS_INLINE_VALUE) :
+					    (BS_SHARED_NAME | BS_BORROWED_NAME | BS_INLINE_NAME)))) {
+	return;
     }
 
-    return (int)*(state->current + 1);
+    bytes = (isvalue ? node->valueLen : node->nameLen) + 1;
+
+    if(add) {
+	*counter += bytes;
+    } else {
+	*counter -= bytes;
+    }
 
 }
 
-/* allocate buffer. put file in buffer. return size. file can be '-' */
-size_t getFileBuf(char **out, const char *fileName) {
+/*
+ * store @len bytes of @str as node's name or value: inline if it fits, otherwise
+ * taking over @str if it is @owned (malloc'd), otherwise a dictionary-owned copy.
+ */
+static inline void bsAdoptStr(BsDict *dict, BsNode *node, const bool isvalue, char *str, const size_t len, const bool owned) {
 
-    char *buf = NULL;
-    size_t size = 0;
-    FILE* fl;
+    /* interning dictionaries pool everything */
+    char *out = (dict->flags & BS_INTERN) ? NULL : bsInlineSlot(node, isvalue, len);
+    unsigned int flags = 0;
 
-    /* read from stdin in blocks */
-    if(!strncmp(fileName, "-", 1)) {
+    if(out != NULL) {
 
-	size_t bufsize = BS_STDIN_BLKSIZE;
+	memcpy(out, str, len);
+	out[len] = '\0';
+	flags = isvalue ? BS_INLINE_VALUE : BS_INLINE_NAME;
 
-	xmalloc(buf, bufsize + 1);
-	if(buf == NULL) {
-	    goto failure;
+	if(owned) {
+	    free(str);
 	}
 
-	while(!feof(stdin)) {
+    } else if(owned) {
 
-	    size_t got = fread(buf + size, 1, BS_STDIN_BLKSIZE, stdin);
-	    size += got;
+	xrealloc(out, str, len + 1);
+	out[len] = '\0';
 
-	    /* if we got less than block size, we have probably reached the end */
-	    if(got < BS_STDIN_BLKSIZE) {
-		/* shrink to fit */
-		xrealloc(buf, buf, size + 1);
-	    /* otherwise grow, realloc */
-	    } else if(size == bufsize) {
-		bufsize += BS_STDIN_BLKEXTENT * BS_STDIN_BLKSIZE;
-		xrealloc(buf, buf, bufsize + 1);
-	    }
+    } else {
 
+	out = bsStoreStr(dict, str, len);
+	if(dict->flags & BS_INTERN) {
+	    flags = isvalue ? BS_SHARED_VALUE : BS_SHARED_NAME;
 	}
 
-    } else {
+    }
 
-	/* open file, seek to end, ftell to know the size */
-	if((fl = fopen(fileName, "r")) == NULL || fseek(fl, 0, SEEK_END) < 0 || (size = ftell(fl)) < 0) {
-	    goto failure;
-	}
+    if(isvalue) {
+	node->flags &= ~(BS_SHARED_VALUE | BS_BORROWED_VALUE | BS_INLINE_VALUE);
+	node->value = out;
+    } else {
+	node->flags &= ~(BS_SHARED_NAME | BS_BORROWED_NAME | BS_INLINE_NAME);
+	node->name = out;
+    }
 
-	rewind(fl);
+    node->flags |= flags;
 
-	xmalloc(buf, size + 1);
+}
 
-	size_t ret = fread(buf, 1, size, fl);
+/* finish storing a token handed out by getTokenData() as node's name or value, now that the node exists */
+static inline void bsAdoptToken(BsDict *dict, BsNode *node, BsToken *token, const bool isvalue) {
 
-	if(ret < size) {
+    if(token->inlined) {
+	bsAdoptStr(dict, node, isvalue, token->data, token->len, token->quoted);
+	/* the node has it now */
+	if(token->quoted) {
+	    token->data = NULL;
+	}
+	token->inlined = 0;
+    }
 
-	    if(feof(fl)) {
-		fprintf(stderr, "Error: Truncated data while reading '%s': file size %zu bytes, read %zu bytes\n", fileName, size, ret);
-	    }
+    if(isvalue) {
+	node->flags |= (BS_QUOTED_VALUE & token->quoted) | (BS_BORROWED_VALUE & token->borrowed);
+    } else {
+	node->flags |= (BS_QUOTED_NAME & token->quoted) | (BS_BORROWED_NAME & token->borrowed);
+    }
 
-	    if(ferror(fl)) {
-		fprintf(stderr, "Error while reading '%s': file size %zu bytes, read %zu bytes\n", fileName, size, ret);
-	    }
+    bsAccountStr(dict, node, isvalue, true);
 
-	    goto failure;
+}
 
-	}
+/* replace node name with a dictionary-owned copy of @name */
+static inline void bsSetNodeName(BsDict *dict, BsNode *node, const char *name, const size_t len) {
 
-	fclose(fl);
+    bsAccountStr(dict, node, false, false);
+    bsDropStr(dict, node->name, node->flags & BS_SHARED_NAME, node->flags & BS_BORROWED_NAME, node->flags & BS_INLINE_NAME);
+    /* nothing to keep in the inline buffer now */
+    node->flags &= ~(BS_INLINE_NAME | BS_ORDINAL_NAME);
+    node->nameLen = len;
+    bsAdoptStr(dict, node, false, (char*)name, len, false);
+    bsAccountStr(dict, node, false, true);
 
-    }
+}
 
-    *out = buf;
-    buf[size] = '\0';
-    return(size + 1);
+/* hash of a node's name - pooled strings carry their hash with them */
+static inline uint32_t bsNameHash(BsNode *node) {
 
-failure:
+    if(node->flags & BS_ORDINAL_NAME) {
+	return bsOrdinalHash(node->ordinal);
+    }
 
-    if(buf != NULL) {
-	free(buf);
+    /* the pool uses xxHash, but decimal names must hash as ordinals */
+    if((node->flags & BS_SHARED_NAME) && (node->name[0] < '0' || node->name[0] > '9')) {
+	return spHash(node->name);
     }
 
-    *out = NULL;
-    return 0;
+    return bsHashName(node->name, node->nameLen);
 
 }
 
-/* dump a quoted string (if quoted) and escape characters where needed */
-static inline int bsDumpQuoted(FILE* fl, char *src, bool quoted) {
+/* integer hash of an array member ordinal (murmur3 finaliser) */
+static inline uint32_t bsOrdinalHash(uint32_t n) {
 
-    int ret;
-    int c;
+    n ^= n >> 16;
+    n *= 0x85ebca6b;
+    n ^= n >> 13;
+    n *= 0xc2b2ae35;
+    n ^= n >> 16;
 
-    if(quoted) {
+    return n;
 
-	ret = fprintf(fl, "%c", BS_QUOTE_CHAR);
-	if(ret < 0) {
-	    return -1;
-	    }
+}
 
-	for(char *marker = src; c = *marker, c != '\0'; marker++) {
-	    /* since we only print with double quotes, do not escape other quotes */
-	    if(cclass(BF_ESC)
-#ifdef BS_QUOTE1_CHAR
-		&& c != BS_QUOTE1_CHAR
-#endif
-#ifdef BS_QUOTE2_CHAR
-		&& c != BS_QUOTE2_CHAR
-#endif
-#ifdef BS_QUOTE2_CHAR
-		&& c != BS_QUOTE3_CHAR
-#endif
-	    ) {
-		ret = fprintf(fl, "%c%c", BS_ESCAPE_CHAR, esccodes[c]);
-		if(ret < 0) {
-		    return -1;
-		}
-	    } else {
-		    ret = fprintf(fl, "%c", c);
-		    if(ret < 0) {
-			return -1;
-		    }
-	    }
-	}
+/* check if string is a canonical decimal u32 (no sign, no leading zeros) and parse it into @out if so */
+static inline bool bsParseOrdinal(const char *str, const size_t len, uint32_t *out) {
 
-	ret = fprintf(fl, "%c", BS_QUOTE_CHAR);
+    uint64_t n = 0;
 
-    } else {
-	ret = fprintf(fl, "%s", src);
-	if(ret < 0) {
-	    return -1;
+    if(len == 0 || len > 10 || (str[0] == '0' && len > 1)) {
+	return false;
+    }
+
+    for(size_t i = 0; i < len; i++) {
+	if(str[i] < '0' || str[i] > '9') {
+	    return false;
 	}
+	n = n * 10 + (str[i] - '0');
     }
 
-    return 0;
+    if(n > UINT32_MAX) {
+	return false;
+    }
+
+    *out = n;
+    return true;
 
 }
 
-/*
- * This is so inconceivably fugly it makes me want to take a rusty screwdriver
- * to my neck and stab myself repeatedly with it. But it will have to do for now.
- *
- * Dump node contents recursively to a file pointer.
- */
-static int _bsDumpNode(FILE* fl, BsNode *node, int level)
-{
-    bool noIndentArray = true;
+/* number of decimal digits in an ordinal */
+static inline size_t bsOrdinalLen(uint32_t n) {
 
-    /* allocate enough indentation space for current level + 1 */
-    int maxwidth = (level + 1) * BS_INDENT_WIDTH;
-    char indent[ maxwidth + 1];
-    BsNode *n = NULL;
-    bool inArray = (node->parent != NULL && node->parent->type == BS_NODE_ARRAY);
-    bool isArray = (node->type == BS_NODE_ARRAY);
-    bool hadBranchSibling = inArray && node->_prev != NULL && node->_prev->type != BS_NODE_LEAF;
+    size_t ret = 1;
 
-    /* fill up the buffer with indent char, but up to current level only */
-    memset(indent, BS_INDENT_CHAR, maxwidth);
-    memset(indent + level * BS_INDENT_WIDTH, '\0', BS_INDENT_WIDTH);
-#ifdef COLL_DEBUG
-    fprintf(fl, "\n// hash: 0x%08x\n", node->hash);
-#endif /* COLL_DEBUG */
-    /* yessir... */
-    indent[maxwidth] = '\0';
+    while(n >= 10) {
+	n /= 10;
+	ret++;
+    }
 
-	fprintf(fl, "%s", inArray && noIndentArray && !hadBranchSibling ? " " : indent);
+    return ret;
 
-	if(node->parent != NULL) {
+}
 
-	    if(!inArray) {
+/*
+ * hash a node name string. Names which are canonical decimal numbers hash the same
+ * as array members with that ordinal, so that "/features/123" finds the 124th member
+ * of "features" without array members ever having a string name.
+ */
+static inline uint32_t bsHashName(const char *name, const size_t len) {
 
-		if(node->flags & BS_INACTIVE) {
-		    fprintf(fl, "inactive: ");
-		}
-		
-		bsDumpQuoted(fl, node->name, node->flags & BS_QUOTED_NAME);
+    uint32_t ord;
 
-		if(node->type == BS_NODE_INSTANCE) {
-		    fprintf(fl, " ");
+    if(len > 0 && name[0] >= '0' && name[0] <= '9' && bsParseOrdinal(name, len, &ord)) {
+	return bsOrdinalHash(ord);
+    }
 
-		    node = node->_firstChild;
-		    inArray = (node->parent != NULL && node->parent->type == BS_NODE_ARRAY);
-		    isArray = (node->type == BS_NODE_ARRAY);
+    return xxHash32(name, len);
 
-		    bsDumpQuoted(fl, node->name, node->flags & BS_QUOTED_NAME);
+}
 
-		    if(node->childCount == 1) {
-			BsNode *tmp = (BsNode*)node->_firstChild;
-			if(tmp != NULL && tmp->type == BS_NODE_LEAF) {
-			    fprintf(fl, " ");
+/* get node name without materialising it: ordinal names are formatted into @buf (INT_STRSIZE + 1) */
+static inline char* bsNameOf(BsNode *node, char *buf) {
 
-			    bsDumpQuoted(fl, tmp->name, tmp->flags & BS_QUOTED_NAME);
+    if(node->name == NULL && (node->flags & BS_ORDINAL_NAME)) {
+	u32toa(buf, node->ordinal);
+	return buf;
+    }
 
-			    if(tmp->value != NULL) {
-				fprintf(fl, " ");
+    return node->name;
 
-				bsDumpQuoted(fl, tmp->value, tmp->flags & BS_QUOTED_VALUE);
+}
 
-			    }
+/* check if node is called @name - @isnum and @ord are the result of bsParseOrdinal() on @name */
+static inline bool bsNameMatch(BsNode *node, const char *name, const size_t len, const bool isnum, const uint32_t ord) {
 
-			    fprintf(fl, "%c\n", BS_ENDVAL_CHAR);
+    if(node->nameLen != len) {
+	return false;
+    }
 
-			    return 0;
-			}
+    if(node->flags & BS_ORDINAL_NAME) {
+	return isnum && node->ordinal == ord;
+    }
 
-		    }
+    return !strncmp(name, node->name, len);
 
+}
 
-		}
+/* fetch next character from buffer and advance, return it as int or EOF if end reached */
+static inline int bsForward(BsState *state) {
 
-	    }
-	}
+    int c;
 
-    if(node->childCount == 0) {
-	if(node->type != BS_NODE_ROOT) {
+    if(state->current >= state->end) {
+        return EOF;
+    }
 
-	    if(node->value && node->valueLen > 0) {
+    state->prev = state->c;
 
-		if(!inArray) {
-		    fprintf(fl, " ");
-		}
+    state->current++;
 
-		bsDumpQuoted(fl, node->value, node->flags & BS_QUOTED_VALUE);
+    /* the buffer need not be NUL-terminated - parallel parsing hands out pieces of one */
+    c = (state->current < state->end) ? *state->current : '\0';
 
-		if(!inArray) {
-		    fprintf(fl, "%c", BS_ENDVAL_CHAR);
-		}
+    if(c == '\0') {
+        state->c = EOF;
+        return EOF;
+    }
 
-		if(!inArray) {
-		    fprintf(fl, "\n");
-		}
-	    } else {
-		if(!inArray) {
-		    fprintf(fl, "%c", BS_ENDVAL_CHAR);
-		}
-		if(!isArray || !noIndentArray) {
-		    fprintf(fl, "\n");
-		}
+    /* no line accounting here - bsLocate() works it out from the position when needed */
+    return (state->c = c);
 
-	    }
-	
-	}
+}
 
-    } else {
+/*
+ * prepare a character set (with member[] filled in) for vectorised scanning. Two encodings:
+ * nibble tables for byte shuffles (AVX2), where each distinct set of low nibbles sharing
+ * a high nibble takes one of 8 buckets, and a short list of characters to compare with (SSE2).
+ * If neither fits, the set is scanned one byte at a time. Where AVX2 is picked at run time,
+ * the nibble tables are only kept if the CPU has it.
+ */
+static void bsCharSetInit(BsCharSet *set) {
+
+    uint16_t patterns[16] = { 0 };
+    uint16_t buckets[8];
+    int nbuckets = 0;
+    int count = 0;
+
+    memset(set->lo, 0, sizeof(set->lo));
+    memset(set->hi, 0, sizeof(set->hi));
+    set->min = 255;
+    set->max = 0;
+    set->listLen = 0;
+    set->nibbles = true;
+    set->listed = true;
+
+    for(int i = 0; i < 256; i++) {
+	if(set->member[i]) {
+	    patterns[i >> 4] |= 1 << (i & 0x0f);
+	    set->min = min(set->min, i);
+	    set->max = max(set->max, i);
+	    count++;
+	}
+    }
 
-	if(node->type != BS_NODE_ROOT) {
-		fprintf(fl,  "%s%c", strlen(node->name) ? " " : "",
-		    isArray ? BS_STARTARRAY_CHAR : BS_STARTBLOCK_CHAR);
+    if(count == 0) {
+	set->nibbles = set->listed = false;
+	return;
+    }
 
-		if(!isArray || !noIndentArray) {
-		    fprintf(fl, "\n");
-		}
-	}
+    /* nibble tables */
+    for(int h = 0; h < 16 && set->nibbles; h++) {
 
-	/* increase indent in case if we want to print something here later */
-	memset(indent + level * BS_INDENT_WIDTH, BS_INDENT_CHAR, BS_INDENT_WIDTH);
-	LL_FOREACH_DYNAMIC(node, n) {
+	int b;
 
-		if(_bsDumpNode(fl, n, level + (node->parent != NULL)) < 0) {
-		    return -1;
-		}
+	if(patterns[h] == 0) {
+	    continue;
 	}
 
-	/* decrease indent again */
-	memset(indent + (level) * BS_INDENT_WIDTH, '\0', BS_INDENT_WIDTH);
-	if(node->type != BS_NODE_ROOT) {
-
-		fprintf(fl, "%s", isArray && noIndentArray ? " " : indent);
+	for(b = 0; b < nbuckets && buckets[b] != patterns[h]; b++);
 
-		if(isArray) {
+	if(b == nbuckets) {
+	    if(nbuckets == 8) {
+		set->nibbles = false;
+		break;
+	    }
+	    buckets[nbuckets++] = patterns[h];
+	}
 
-		    fprintf(fl, "%c", BS_ENDARRAY_CHAR);
+	set->hi[h] |= 1 << b;
+	for(int l = 0; l < 16; l++) {
+	    if(patterns[h] & (1 << l)) {
+		set->lo[l] |= 1 << b;
+	    }
+	}
 
-		    if(!inArray) {
-			fprintf(fl, "%c", BS_ENDVAL_CHAR);
-		    }
-		} else {
-		    fprintf(fl, "%c", BS_ENDBLOCK_CHAR);
+    }
 
-		}
+    /* character list: whichever is shorter between min and max - members or the rest */
+    set->stops = count > (set->max - set->min + 1) / 2;
 
+    for(int i = set->min; i <= set->max; i++) {
+	if(set->member[i] != set->stops) {
+	    if(set->listLen == BS_CHARSET_LIST) {
+		set->listed = false;
+		break;
+	    }
+	    set->list[set->listLen++] = i;
 	}
-
-	fprintf(fl, "\n");
-
     }
 
-    if(ferror(fl)) {
-	return -1;
+#if defined(BS_AVX2_DISPATCH)
+    if(!__builtin_cpu_supports("avx2")) {
+	set->nibbles = false;
     }
-
-    return 0;
+#elif !defined(BS_AVX2)
+    /* nothing to use them with */
+    set->nibbles = false;
+#endif
 
 }
 
-/* dump a single node recursively to file, return number of bytes written */
-int bsDumpNode(FILE* fl, BsNode *node) {
-    if(node == NULL) {
-	return fprintf(fl, "null\n");
-    }
-    return _bsDumpNode(fl, node, 0);
-}
+#if defined(BS_AVX2) || defined(BS_AVX2_DISPATCH)
+/* skip 32-byte blocks of @set members starting at @p, return the first non-member or where fewer than 32 bytes are left */
+static BS_AVX2_FUNC char* bsRunEndAvx2(const BsCharSet *set, char *p, const char *end) {
 
-/* dump the whole dictionary */
-void bsDump(FILE* fl, BsDict *dict) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
 
-    _bsDumpNode(fl, dict->root, 0);
+    while(end - p >= 32) {
 
-}
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i m = _mm256_and_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+				_mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+	uint32_t out = _mm256_movemask_epi8(_mm256_cmpeq_epi8(m, zero));
 
-/* free a single node */
-void bsFreeNode(BsNode *node)
-{
+	if(out != 0) {
+	    return p + __builtin_ctz(out);
+	}
 
-    if(node == NULL) {
-	return;
-    }
+	p += 32;
 
-    if(node->name != NULL) {
-	free(node->name);
-    }
-    if(node->value != NULL) {
-	free(node->value);
     }
 
-    free(node);
+    return p;
 
 }
+#endif /* BS_AVX2 || BS_AVX2_DISPATCH */
 
-/*
- * Create a node in dict with parent parent of type type using name 'name' of length 'namelen',
- * and with a value of 'value' and length 'valuelen'. This is the internal version of this function
- * (underscore), which only attaches the name + value to the node. If called directly,
- * the name should have been passed throuh getTokenData() first or otherwise be malloc'd,
- * so that the name is guaranteed not to come from a buffer that will later be destroyed.
- * If zero lengths are given for namelen or valuelen, strlen() is performed.
- */
-static inline BsNode* _bsCreateNode(BsDict *dict, BsNode *parent, const unsigned int type, char* name, const size_t namelen, char* value, size_t valuelen)
-{
-
-    BsNode *ret;
-    size_t slen = 0;
-    size_t vlen = 0;
+/* return the end of the run of @set members starting at @p, not going past @end */
+static inline char* bsRunEnd(const BsCharSet *set, char *p, const char *end) {
 
-    if(dict == NULL) {
-	return NULL;
+#if defined(BS_AVX2) || defined(BS_AVX2_DISPATCH)
+    if(set->nibbles) {
+	p = bsRunEndAvx2(set, p, end);
     }
+#endif
+#if defined(BS_SSE2)
+    if(set->listed && !set->nibbles) {
 
-    xmalloc(ret, sizeof(BsNode));
-
-    /* could have calloc'd, but... */
-
-    ret->value = NULL;
-    ret->parent = parent;
-
-    ret->_indexNext = NULL;
-    LL_CLEAR_HOLDER(ret);
-    LL_CLEAR_MEMBER(ret);
-
-    ret->nameLen = 0;
-    ret->valueLen = 0;
-    ret->childCount = 0;
-    ret->type = type;
-    ret->flags = 0;
-#ifdef COLL_DEBUG
-    ret->collcount = 0;
-#endif /* COLL_DEBUG */
-    if(parent != NULL) {
+	/* unsigned range check: x >= min is max(x, min) == x */
+	const __m128i vmin = _mm_set1_epi8(set->min);
+	const __m128i vmax = _mm_set1_epi8(set->max);
 
-	/* inherit flags */
+	while(end - p >= 16) {
 
-	/* parent's inheritable flags shifted */
-	unsigned int iflags = (parent->flags & BS_INHERITED_FLAGS) << BS_INHERITED_SHIFT;
-	/* also apply parent's already shifted inherited flags */
-	iflags |= parent->flags & (BS_INHERITED_FLAGS << BS_INHERITED_SHIFT);
+	    __m128i v = _mm_loadu_si128((const __m128i*)p);
+	    __m128i hit = _mm_setzero_si128();
+	    __m128i in;
+	    uint32_t out;
 
-	ret->flags |= iflags;
+	    for(int i = 0; i < set->listLen; i++) {
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(set->list[i])));
+	    }
 
-	/* if we are adding an array member, call it by number, ignoring the name */
-	if(parent->type == BS_NODE_ARRAY) {
-	    char numname[INT_STRSIZE + 1];
-	    /* major win over snprintf, 30% total performance difference for citylots.json */
-	    char* endname = u32toa(numname, parent->childCount);
-	    slen = endname - numname;
-	    xmalloc(ret->name, slen + 1);
-	    memcpy(ret->name, numname, slen + 1);
-	} else {
-	    if(name == NULL) {
-		goto onerror;
+	    if(set->stops) {
+		in = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, vmin), v), _mm_cmpeq_epi8(_mm_min_epu8(v, vmax), v));
+		in = _mm_andnot_si128(hit, in);
+	    } else {
+		in = hit;
 	    }
 
-	    ret->name = name;
+	    out = ~_mm_movemask_epi8(in) & 0xffff;
 
-	    if(namelen == 0) {
-		slen = strlen(name);
-	    } else {
-		slen = namelen;
+	    if(out != 0) {
+		return p + __builtin_ctz(out);
 	    }
-	}
 
-	ret->value = value;
+	    p += 16;
 
-	if(value != NULL && valuelen == 0) {
-	    vlen = strlen(value);
-	} else {
-	    vlen = valuelen;
 	}
 
-	/* mix this node's name's hash with parent's hash */
-	ret->hash = BS_MIX_HASH(xxHash32(ret->name, slen), parent->hash, slen);
+    }
+#endif /* BS_SSE2 */
 
-#if 0
-	/* if this is an instance, also mix it with value */
-	if(type == BS_NODE_INSTANCE) {
-	    ret->hash = BS_MIX_HASH(xxHash32(ret->value, vlen), ret->hash, vlen);
-	}
-#endif
-	ret->nameLen = slen;
-	ret->valueLen = vlen;
+    while(p < end && set->member[(unsigned char)*p]) {
+	p++;
+    }
 
-	if(!(dict->flags & BS_NOINDEX)) {
-	    bsIndexPut(dict, ret);
-	}
+    return p;
 
-	LL_APPEND_DYNAMIC(parent, ret);
-	parent->childCount++;
+}
 
-    } else {
+/*
+ * skip a run of @set members starting at the current character and return the character after it,
+ * leaving the state as bsForward() would have. Runs never contain newlines.
+ */
+static inline int bsForwardRun(BsState *state, const BsCharSet *set) {
 
-	if(dict->root != NULL) {
-	    fprintf(stderr, "Error: will not replace dictionary '%s' root with node '%s'\n", dict->name, name);
-	    goto onerror;
-	} else {
-	    dict->root = ret;
-	    ret->type = BS_NODE_ROOT;
-	    xmalloc(ret->name, 1);
-	    ret->name[0] = '\0';
-	    ret->hash = BS_ROOT_HASH;
-	}
+    char *p = bsRunEnd(set, state->current, state->end);
+    int c;
 
+    if(p == state->current) {
+	return state->c;
     }
 
-    dict->nodecount++;
-    return ret;
+    state->prev = *(p - 1);
+    state->current = p;
 
-onerror:
+    c = (p < state->end) ? *p : '\0';
 
-    bsFreeNode(ret);
-    return NULL;
+    if(c == '\0') {
+	state->c = EOF;
+	return EOF;
+    }
+
+    return (state->c = c);
 
 }
 
-/*
- * Public node creation wrapper.
- *
- * Create a new node in @dict, attached to @parent, of type @type with name @name.
- * If the parent is an array, we do not need a name. If it's not, the name is duplicated
- * and length is calculated.
- */
-BsNode* bsCreateNode(BsDict *dict, BsNode *parent, const unsigned int type, const char* name, const char *value) {
+/* find the end of the quoted string starting at @p: its closing quote, or the first escape, newline or NUL */
+static inline char* bsQuotedEnd(BsState *state, char *p, const int qchar) {
 
-    char* nout = NULL;
-    size_t nlen = 0;
-    char* vout = NULL;
-    size_t vlen = 0;
+    const BsCharSet *set = &state->quotedChars[0];
 
-    if(parent == NULL) {
-	return NULL;
+#ifdef BS_QUOTE1_CHAR
+    if(qchar == BS_QUOTE1_CHAR) {
+	set = &state->quotedChars[1];
+    }
+#endif
+#ifdef BS_QUOTE2_CHAR
+    if(qchar == BS_QUOTE2_CHAR) {
+	set = &state->quotedChars[2];
+    }
+#endif
+#ifdef BS_QUOTE3_CHAR
+    if(qchar == BS_QUOTE3_CHAR) {
+	set = &state->quotedChars[3];
     }
+#endif
 
-    if(value != NULL) {
+    return bsRunEnd(set, p, state->end);
 
-	/* only leafs and instances can have values */
-	if(type != BS_NODE_LEAF) {
-	    return NULL;
-	}
+}
 
-        vlen = strlen(name);
-        xmalloc(vout, vlen + 1);
-	if(vlen > 0) {
-    	    memcpy(vout, value, vlen);
-	}
-	*(vout + vlen) = '\0';
+/* make sure the scratch buffer holds at least @size bytes */
+static inline void bsScratchReserve(BsState *state, const size_t size) {
+
+    char *old = state->scratch;
+    size_t oldsize = state->scratchSize;
+
+    if(size <= state->scratchSize) {
+	return;
     }
 
-    if(parent != NULL && parent->type == BS_NODE_ARRAY) {
+    if(state->scratchSize == 0) {
+	state->scratchSize = BS_QUOTED_STARTSIZE;
+    }
 
-	return _bsCreateNode(dict, parent, type, NULL, 0, vout, vlen);
+    while(state->scratchSize < size) {
+	state->scratchSize *= 2;
+    }
 
-    }  else {
+    /* strings left in the scratch buffer by the event parser move with it */
+    if(state->inPlace && old != NULL) {
 
-	if(name == NULL || ((nlen = strlen(name)) == 0)) {
-	    xmalloc(nout, 1);
-	} else {
-    	    nlen = strlen(name);
-    	    xmalloc(nout, nlen + 1);
-    	    memcpy(nout, name, nlen);
+	xmalloc(state->scratch, state->scratchSize);
+	memcpy(state->scratch, old, oldsize);
+
+	for(unsigned int i = 0; i < state->tokenCount; i++) {
+	    BsToken *tok = &state->tokenCache[i];
+	    if(tok->data >= old && tok->data <= old + state->scratchBase) {
+		tok->data = state->scratch + (tok->data - old);
+	    }
 	}
 
-	*(nout + nlen) = '\0';
+	free(old);
+	return;
 
-	return _bsCreateNode(dict, parent, type, nout, nlen, vout, vlen);
     }
 
+    xrealloc(state->scratch, state->scratch, state->scratchSize);
+
 }
 
-/* [get|check if] parent node has a child with specified name */
-static inline BsNode* _bsGetChild(BsDict* dict, BsNode *parent, const char* name, const size_t namelen) {
+/* read four hex digits at @p (@end permitting) into @out, return false if they are not there */
+static inline bool bsJsonHex4(const char *p, const char *end, uint32_t *out) {
 
-    uint32_t hash;
-    BsNode *n, *m;
+    uint32_t v = 0;
 
-    if(name != NULL && namelen > 0) {
+    if(end - p < 4) {
+	return false;
+    }
 
-	hash = BS_MIX_HASH(xxHash32(name, namelen), parent->hash, namelen);
+    for(int i = 0; i < 4; i++) {
 
-	/* grab node from index if we can */
-	if(!(dict->flags & BS_NOINDEX)) {
+	const int c = (unsigned char)p[i];
 
-	    /* if we wanted to do a Robin Hood, bsIndexGet() would have to be rewritten to do this part */
-	    for(n = bsIndexGet(dict->index, hash); n != NULL; n = n->_indexNext) {
-		if(n->parent == parent && n->nameLen == namelen && !strncmp(name, n->name, namelen)) {
-		    return n;
-		}
-	    }
+	v <<= 4;
 
-	/* otherwise do a naive search */
+	if(c >= '0' && c <= '9') {
+	    v |= c - '0';
+	} else if(c >= 'a' && c <= 'f') {
+	    v |= c - 'a' + 10;
+	} else if(c >= 'A' && c <= 'F') {
+	    v |= c - 'A' + 10;
 	} else {
+	    return false;
+	}
 
-	    /*
-	     * (todo: investigate skip lists - but that would be an index)
-	     * for now, search from both ends of the list simultaneously.
-	     */
-
-	    n = parent->_firstChild;
-	    m = parent->_lastChild;
-
-	    /* until we meet */
-	    while( m != NULL && n != NULL) {
-
-		if(n->hash == hash && n->nameLen == namelen && !strncmp(name, n->name, namelen)) {
-		    return n;
-		}
-
-		/* we've met */
-		if(m == n) {
-		    break;
-		}
+    }
 
-		if(m->hash == hash && m->nameLen == namelen && !strncmp(name, m->name, namelen)) {
-		    return m;
-		}
+    *out = v;
+    return true;
 
-		n = n->_next;
+}
 
-		/* we're about to pass each other */
-		if(m == n) {
-		    break;
-		}
+/* write code point @cp to @out as UTF-8, return the number of bytes written */
+static inline size_t bsUtf8Put(char *out, const uint32_t cp) {
 
-		m = m->_prev;
+    if(cp < 0x80) {
+	out[0] = cp;
+	return 1;
+    }
 
-	    }
-	
-	}
+    if(cp < 0x800) {
+	out[0] = 0xc0 | (cp >> 6);
+	out[1] = 0x80 | (cp & 0x3f);
+	return 2;
+    }
 
+    if(cp < 0x10000) {
+	out[0] = 0xe0 | (cp >> 12);
+	out[1] = 0x80 | ((cp >> 6) & 0x3f);
+	out[2] = 0x80 | (cp & 0x3f);
+	return 3;
     }
 
-    return NULL;
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
 
 }
 
-/* get a list of children of node with specified name. Returns a dynamic LList* that needs freed */
-static inline LList* _bsGetChildren(LList* out, BsDict* dict, BsNode *parent, const char* name, const size_t namelen) {
+/*
+ * get a JSON string starting at opening quote @p into @tok, return pointer past the closing quote.
+ * Strings with no escapes are left in the buffer like unquoted tokens, so getTokenData()
+ * can borrow or copy them as it sees fit. @set holds what runs over without a second look:
+ * anything but the quote, a backslash or a control character. Escaped strings are unescaped
+ * in the scratch buffer, \uXXXX (surrogate pairs too) as UTF-8, and copied once at their final
+ * size. Control characters, other escapes and unpaired surrogates are errors.
+ */
+static inline char* bsJsonString(BsState *state, const BsCharSet *set, BsToken *tok, char *p) {
 
-    uint32_t hash;
-    BsNode *n, *m;
+    char *start = ++p;
+    size_t len;
+    uint32_t cp, lo;
+    int c;
 
-    if(out == NULL) {
-	out = llCreate();
+    tok->quoted = 0;
+
+    p = bsRunEnd(set, p, state->end);
+
+    if(p < state->end && *p == '"') {
+	/* node creation takes a zero length to mean "use strlen()", so an empty string must be one */
+	tok->data = (p == start) ? (char*)"" : start;
+	tok->len = p - start;
+	return p + 1;
     }
 
-    if(name != NULL && namelen > 0) {
+    len = p - start;
+    bsScratchReserve(state, len + 1);
+    memcpy(state->scratch, start, len);
 
-	hash = BS_MIX_HASH(xxHash32(name, namelen), parent->hash, namelen);
+    while(p < state->end && *p != '"') {
 
-	/* grab node from index if we can */
-	if(!(dict->flags & BS_NOINDEX)) {
+	c = (unsigned char)*p;
 
-	    /* if we wanted to do a Robin Hood, bsIndexGet() would have to be rewritten to do that (put last item in front) */
-	    for(n = bsIndexGet(dict->index, hash); n != NULL; n = n->_indexNext) {
-		if(n->parent == parent && n->nameLen == namelen && !strncmp(name, n->name, namelen)) {
-		    llAppendItem(out, n);
-		}
-	    }
+	/* report the string, not where it broke */
+	if(c < 0x20) {
+	    state->parseError = BS_PERROR_QUOTED;
+	    return start - 1;
+	}
 
-	/* otherwise do a naive search */
-	} else {
+	/* room for the longest UTF-8 sequence */
+	bsScratchReserve(state, len + 4);
 
-	    /*
-	     * (todo: investigate skip lists - but that would be an index)
-	     * for now, search from both ends of the list simultaneously.
-	     */
+	if(c != BS_ESCAPE_CHAR) {
+	    state->scratch[len++] = c;
+	    p++;
+	    continue;
+	}
 
-	    n = parent->_firstChild;
-	    m = parent->_lastChild;
+	if(++p == state->end) {
+	    break;
+	}
 
-	    /* until we meet */
-	    while( m != NULL && n != NULL) {
+	switch(*p) {
 
-		if(n->hash == hash && n->nameLen == namelen && !strncmp(name, n->name, namelen)) {
-		    llAppendItem(out, n);
-		}
+	    case '"':
+	    case '\\':
+	    case '/':
+		c = *p;
+		break;
+	    case 'b':
+		c = '\b';
+		break;
+	    case 'f':
+		c = '\f';
+		break;
+	    case 'n':
+		c = '\n';
+		break;
+	    case 'r':
+		c = '\r';
+		break;
+	    case 't':
+		c = '\t';
+		break;
 
-		/* we've met */
-		if(m == n) {
-		    break;
-		}
+	    case 'u':
 
-		if(m->hash == hash && m->nameLen == namelen && !strncmp(name, m->name, namelen)) {
-		    llAppendItem(out, m);
+		if(!bsJsonHex4(p + 1, state->end, &cp)) {
+		    state->parseError = BS_PERROR_QUOTED;
+		    return start - 1;
 		}
 
-		n = n->_next;
+		p += 4;
 
-		/* we're about to pass each other */
-		if(m == n) {
-		    break;
+		/* a high surrogate must be followed by an escaped low one, a low one cannot stand alone */
+		if(cp >= 0xdc00 && cp <= 0xdfff) {
+		    state->parseError = BS_PERROR_QUOTED;
+		    return start - 1;
 		}
 
-		m = m->_prev;
+		if(cp >= 0xd800 && cp <= 0xdbff) {
 
-	    }
-	
-	}
+		    if(state->end - p < 3 || p[1] != BS_ESCAPE_CHAR || p[2] != 'u' ||
+			    !bsJsonHex4(p + 3, state->end, &lo) || lo < 0xdc00 || lo > 0xdfff) {
+			state->parseError = BS_PERROR_QUOTED;
+			return start - 1;
+		    }
 
-    }
+		    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+		    p += 6;
 
-    return out;
+		}
 
-}
+		len += bsUtf8Put(state->scratch + len, cp);
+		p++;
+		continue;
 
+	    default:
+		state->parseError = BS_PERROR_QUOTED;
+		return start - 1;
 
-/* delete node from the dictionary */
-unsigned int bsDeleteNode(BsDict *dict, BsNode *node)
-{
+	}
 
-    if(node == NULL) {
-	return BS_NODE_NOT_FOUND;
-    }
+	state->scratch[len++] = c;
+	p++;
 
-    /* remove node from index */
-    if(!(dict->flags & BS_NOINDEX)) {
-	bsIndexDelete(dict->index, node);
     }
 
-    /* remove all children recursively first */
-    for ( BsNode *child = node->_firstChild; child != NULL; child = node->_firstChild) {
-	bsDeleteNode(dict, child);
+    if(p >= state->end) {
+	state->parseError = BS_PERROR_EOF;
+	state->scanState = BS_GET_QUOTED;
+	return p;
     }
 
-    /* root node is persistent, otherwise remove node */
-    if(node->parent != NULL) {
-	LL_REMOVE_DYNAMIC(node->parent, node); /* remove self from parent's list */
-	node->parent->childCount--;
-	bsFreeNode(node);
-    }
+    xmalloc(tok->data, len + 1);
+    memcpy(tok->data, state->scratch, len);
+    tok->data[len] = '\0';
+    tok->len = len;
+    tok->quoted = ~0;
 
-    dict->nodecount--;
+    return p + 1;
 
-    return BS_NODE_OK;
 }
 
-/* create a (named) dictionary */
-BsDict* bsCreate(const char *name, const uint32_t flags) {
-
-    size_t slen = 0;
-    BsDict *ret;
+/* check if @p to @end is a valid JSON number: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? */
+static inline bool bsJsonNumber(const char *p, const char *end) {
 
-    xcalloc(ret, 1, sizeof(BsDict));
+    const char *digits;
 
-    /* because no strdup() */
-    if(name == NULL || ((slen = strlen(name)) == 0)) {
-	xmalloc(ret->name, 1);
-	ret->name[0] = '\0';
-    } else {
-	xmalloc(ret->name, slen + 1);
-	memcpy(ret->name, name, slen);
+    if(p < end && *p == '-') {
+	p++;
     }
 
-    *(ret->name + slen) = '\0';
-
-    /* set flags */
-    ret->flags = flags;
-
-    /* create the root node */
-    _bsCreateNode(ret, NULL, BS_NODE_ROOT,NULL,0,NULL,0);
+    if(p == end) {
+	return false;
+    }
 
-    /* create the index */
-    if(!(flags & BS_NOINDEX)) {
-	ret->index = bsIndexCreate();
-	if(ret->index == NULL) {
-	    bsFree(ret);
-	    return NULL;
+    if(*p == '0') {
+	p++;
+    } else {
+	for(digits = p; p < end && *p >= '0' && *p <= '9'; p++);
+	if(p == digits) {
+	    return false;
 	}
     }
 
-    return ret;
-}
-
-void bsEmpty(BsDict *dict) {
-
-    if(dict == NULL) {
-	return;
+    if(p < end && *p == '.') {
+	for(digits = ++p; p < end && *p >= '0' && *p <= '9'; p++);
+	if(p == digits) {
+	    return false;
+	}
     }
 
-    /* if the dictionary is indexed, free the dictionary on index level */
-    if(!(dict->flags & BS_NOINDEX) && dict->index != NULL) {
-	bsIndexFree(dict->index);
-    /* otherwise delete nodes recursively */
-    } else {
-	bsDeleteNode(dict, dict->root);
+    if(p < end && (*p == 'e' || *p == 'E')) {
+	p++;
+	if(p < end && (*p == '+' || *p == '-')) {
+	    p++;
+	}
+	for(digits = p; p < end && *p >= '0' && *p <= '9'; p++);
+	if(p == digits) {
+	    return false;
+	}
     }
 
-    LL_CLEAR_HOLDER(dict->root);
-    LL_CLEAR_MEMBER(dict->root);
-
-    dict->root->childCount = 0;
-#ifdef COLL_DEBUG
-    dict->root->collcount = 0;
-#endif /* COLL_DEBUG */
+    return p == end;
 
 }
 
-/* free a dictionary */
-void bsFree(BsDict *dict) {
+/* peek at the next character without moving forward */
+static inline int bsPeek(BsState *state) {
 
-    if(dict == NULL) {
-	return;
+    if(state->current + 1 >= state->end) {
+	return EOF;
     }
 
-    bsEmpty(dict);
+    return (int)*(state->current + 1);
 
-    if(dict->root != NULL) {
-	bsFreeNode(dict->root);
-    }
+}
 
-    if(dict->name != NULL) {
-	free(dict->name);
-    }
+/* allocate buffer. put file in buffer. return size. file can be '-' */
+size_t getFileBuf(char **out, const char *fileName) {
 
-    free(dict);
+    char *buf = NULL;
+    size_t size = 0;
+    FILE* fl;
 
-}
+    /* read from stdin in blocks */
+    if(!strncmp(fileName, "-", 1)) {
 
-/* unescape a string in place and return new length including NUL-termination */
-inline size_t bsUnescapeStr(char *str) {
+	size_t bufsize = BS_STDIN_BLKSIZE;
 
-    int c;
-    char *in = str;
-    size_t len = 0;
-    bool captured = false;
+	xmalloc(buf, bufsize + 1);
+	if(buf == NULL) {
+	    goto failure;
+	}
 
-    /* keep scanning */
-    while((c = *in) != '\0') {
+	while(!feof(stdin)) {
 
-	if(c == BS_ESCAPE_CHAR) {
-	    c = *++in;
+	    size_t got = fread(buf + size, 1, BS_STDIN_BLKSIZE, stdin);
+	    size += got;
 
-	    /* this is  an escape sequence */
-	    if(cclass(BF_ESS)) {
-		/* place the corresponding control char */
-		str[len] = esccodes[c];
-		captured = true;
+	    /* if we got less than block size, we have probably reached the end */
+	    if(got < BS_STDIN_BLKSIZE) {
+		/* shrink to fit */
+		xrealloc(buf, buf, size + 1);
+	    /* otherwise grow, realloc */
+	    } else if(size == bufsize) {
+		bufsize += BS_STDIN_BLKEXTENT * BS_STDIN_BLKSIZE;
+		xrealloc(buf, buf, bufsize + 1);
 	    }
-	}
 
-	if(captured) {
-	    captured = false;
-	} else {
-	    str[len] = c;
-	    if(c == '\0') {
-		break;
-	    }
 	}
 
-	in++;
-	len++;
-
-    }
-
-    str[len] = '\0';
+    } else {
 
-    return len + 1;
+	/* open file, seek to end, ftell to know the size */
+	if((fl = fopen(fileName, "r")) == NULL || fseek(fl, 0, SEEK_END) < 0 || (size = ftell(fl)) < 0) {
+	    goto failure;
+	}
 
-}
+	rewind(fl);
 
-/* place escaped string in @out, return required length (also if @out is 0) including NUL-termination */
-inline size_t bsEscapeStr(const char *src, char *out) {
+	xmalloc(buf, size + 1);
 
-    int c;
-    char *in = (char*)src;
-    size_t len = 1;
+	size_t ret = fread(buf, 1, size, fl);
 
-    /* keep scanning */
-    while((c = *(in++)) != '\0') {
+	if(ret < size) {
 
-	if(cclass(BF_ESC)) {
-	    if(out != NULL) {
-		*(out++) = BS_ESCAPE_CHAR;
-		*(out++) = esccodes[c];
-	    }
-	    len += 2;
-	} else if (c == BS_PATH_SEP) {
-	    if(out != NULL) {
-		*(out++) = BS_ESCAPE_CHAR;
-		*(out++) = c;
+	    if(feof(fl)) {
+		fprintf(stderr, "Error: Truncated data while reading '%s': file size %zu bytes, read %zu bytes\n", fileName, size, ret);
 	    }
-	    len += 2;
-	} else {
-	    if(out != NULL) {
-		*(out++) = c;
+
+	    if(ferror(fl)) {
+		fprintf(stderr, "Error while reading '%s': file size %zu bytes, read %zu bytes\n", fileName, size, ret);
 	    }
-	    len++;
-	}
 
-    }
+	    goto failure;
 
-    if(out != NULL) {
-	*out = '\0';
-    }
+	}
 
-    return len;
+	fclose(fl);
 
-}
+    }
 
-/* get an escaped duplicate of string src */
-inline char* bsGetEscapedStr(const char* src) {
+    *out = buf;
+    buf[size] = '\0';
+    return(size + 1);
 
-    size_t sl = bsEscapeStr(src, NULL);
-    char* out;
+failure:
 
-    xmalloc(out, sl);
-    bsEscapeStr(src, out);
+    if(buf != NULL) {
+	free(buf);
+    }
 
-    return out;
+    *out = NULL;
+    return 0;
 
 }
 
-/* walk through string @in, and write to + return next token between the 'sep' character */
-static inline BsToken* unescapeToken(BsToken* out, char** in, const char sep) {
+/* dump a quoted string (if quoted) and escape characters where needed */
+static inline int bsDumpQuoted(FILE* fl, char *src, const size_t len, bool quoted) {
 
-    size_t ssize = BS_QUOTED_STARTSIZE;
-    bool captured = false;
+    int ret;
     int c;
 
-    /* skip past the separator and proper whitespace */
-    while( (((c = **in) == sep) || cclass(BF_WSP)) && c != '\0') {
-	(*in)++;
+    if(quoted) {
+
+	ret = fprintf(fl, "%c", BS_QUOTE_CHAR);
+	if(ret < 0) {
+	    return -1;
+	    }
+
+	for(char *marker = src; marker < src + len; marker++) {
+	    c = *marker;
+	    /* since we only print with double quotes, do not escape other quotes */
+	    if(cclass(BF_ESC)
+#ifdef BS_QUOTE1_CHAR
+		&& c != BS_QUOTE1_CHAR
+#endif
+#ifdef BS_QUOTE2_CHAR
+		&& c != BS_QUOTE2_CHAR
+#endif
+#ifdef BS_QUOTE2_CHAR
+		&& c != BS_QUOTE3_CHAR
+#endif
+	    ) {
+		ret = fprintf(fl, "%c%c", BS_ESCAPE_CHAR, esccodes[c]);
+		if(ret < 0) {
+		    return -1;
+		}
+	    } else {
+		    ret = fprintf(fl, "%c", c);
+		    if(ret < 0) {
+			return -1;
+		    }
+	    }
+	}
+
+	ret = fprintf(fl, "%c", BS_QUOTE_CHAR);
+
+    } else {
+	ret = fprintf(fl, "%.*s", (int)len, src);
+	if(ret < 0) {
+	    return -1;
+	}
+    }
+
+    return 0;
+
+}
+
+/*
+ * This is so inconceivably fugly it makes me want to take a rusty screwdriver
+ * to my neck and stab myself repeatedly with it. But it will have to do for now.
+ *
+ * Dump node contents recursively to a file pointer.
+ */
+static int _bsDumpNode(FILE* fl, BsNode *node, int level)
+{
+    bool noIndentArray = true;
+
+    /* allocate enough indentation space for current level + 1 */
+    int maxwidth = (level + 1) * BS_INDENT_WIDTH;
+    char indent[ maxwidth + 1];
+    BsNode *n = NULL;
+    char nbuf[INT_STRSIZE + 1];
+    bool inArray = (bsParent(node) != NULL && bsParent(node)->type == BS_NODE_ARRAY);
+    bool isArray = (node->type == BS_NODE_ARRAY);
+    bool hadBranchSibling = inArray && bsPrevSibling(node) != NULL && bsPrevSibling(node)->type != BS_NODE_LEAF;
+
+    /* fill up the buffer with indent char, but up to current level only */
+    memset(indent, BS_INDENT_CHAR, maxwidth);
+    memset(indent + level * BS_INDENT_WIDTH, '\0', BS_INDENT_WIDTH);
+#ifdef COLL_DEBUG
+    fprintf(fl, "\n// hash: 0x%08x\n", node->hash);
+#endif /* COLL_DEBUG */
+    /* yessir... */
+    indent[maxwidth] = '\0';
+
+	fprintf(fl, "%s", inArray && noIndentArray && !hadBranchSibling ? " " : indent);
+
+	if(bsParent(node) != NULL) {
+
+	    if(!inArray) {
+
+		if(node->flags & BS_INACTIVE) {
+		    fprintf(fl, "inactive: ");
+		}
+		
+		bsDumpQuoted(fl, bsNameOf(node, nbuf), node->nameLen, node->flags & BS_QUOTED_NAME);
+
+		if(node->type == BS_NODE_INSTANCE) {
+		    fprintf(fl, " ");
+
+		    node = bsFirstChild(node);
+		    inArray = (bsParent(node) != NULL && bsParent(node)->type == BS_NODE_ARRAY);
+		    isArray = (node->type == BS_NODE_ARRAY);
+
+		    bsDumpQuoted(fl, bsNameOf(node, nbuf), node->nameLen, node->flags & BS_QUOTED_NAME);
+
+		    if(node->childCount == 1) {
+			BsNode *tmp = bsFirstChild(node);
+			if(tmp != NULL && tmp->type == BS_NODE_LEAF) {
+			    fprintf(fl, " ");
+
+			    bsDumpQuoted(fl, bsNameOf(tmp, nbuf), tmp->nameLen, tmp->flags & BS_QUOTED_NAME);
+
+			    if(tmp->value != NULL) {
+				fprintf(fl, " ");
+
+				bsDumpQuoted(fl, tmp->value, tmp->valueLen, tmp->flags & BS_QUOTED_VALUE);
+
+			    }
+
+			    fprintf(fl, "%c\n", BS_ENDVAL_CHAR);
+
+			    return 0;
+			}
+
+		    }
+
+
+		}
+
+	    }
+	}
+
+    if(node->childCount == 0) {
+	if(node->type != BS_NODE_ROOT) {
+
+	    if(node->value && node->valueLen > 0) {
+
+		if(!inArray) {
+		    fprintf(fl, " ");
+		}
+
+		bsDumpQuoted(fl, node->value, node->valueLen, node->flags & BS_QUOTED_VALUE);
+
+		if(!inArray) {
+		    fprintf(fl, "%c", BS_ENDVAL_CHAR);
+		}
+
+		if(!inArray) {
+		    fprintf(fl, "\n");
+		}
+	    } else {
+		if(!inArray) {
+		    fprintf(fl, "%c", BS_ENDVAL_CHAR);
+		}
+		if(!isArray || !noIndentArray) {
+		    fprintf(fl, "\n");
+		}
+
+	    }
+	
+	}
+
+    } else {
+
+	if(node->type != BS_NODE_ROOT) {
+		fprintf(fl,  "%s%c", node->nameLen ? " " : "",
+		    isArray ? BS_STARTARRAY_CHAR : BS_STARTBLOCK_CHAR);
+
+		if(!isArray || !noIndentArray) {
+		    fprintf(fl, "\n");
+		}
+	}
+
+	/* increase indent in case if we want to print something here later */
+	memset(indent + level * BS_INDENT_WIDTH, BS_INDENT_CHAR, BS_INDENT_WIDTH);
+	BS_FOREACH_CHILD(node, n) {
+
+		if(_bsDumpNode(fl, n, level + (bsParent(node) != NULL)) < 0) {
+		    return -1;
+		}
+	}
+
+	/* decrease indent again */
+	memset(indent + (level) * BS_INDENT_WIDTH, '\0', BS_INDENT_WIDTH);
+	if(node->type != BS_NODE_ROOT) {
+
+		fprintf(fl, "%s", isArray && noIndentArray ? " " : indent);
+
+		if(isArray) {
+
+		    fprintf(fl, "%c", BS_ENDARRAY_CHAR);
+
+		    if(!inArray) {
+			fprintf(fl, "%c", BS_ENDVAL_CHAR);
+		    }
+		} else {
+		    fprintf(fl, "%c", BS_ENDBLOCK_CHAR);
+
+		}
+
+	}
+
+	fprintf(fl, "\n");
+
+    }
+
+    if(ferror(fl)) {
+	return -1;
+    }
+
+    return 0;
+
+}
+
+/* dump a single node recursively to file, return number of bytes written */
+int bsDumpNode(FILE* fl, BsNode *node) {
+    if(node == NULL) {
+	return fprintf(fl, "null\n");
+    }
+    return _bsDumpNode(fl, node, 0);
+}
+
+/* dump the whole dictionary */
+void bsDump(FILE* fl, BsDict *dict) {
+
+    _bsDumpNode(fl, dict->root, 0);
+
+}
+
+/* free a single node's contents - the node itself lives in the dictionary's node store */
+void bsFreeNode(BsNode *node)
+{
+
+    if(node == NULL) {
+	return;
+    }
+
+    if(node->name != NULL) {
+	if(node->flags & BS_SHARED_NAME) {
+	    SP_ENTRY(node->name)->refcount--;
+	} else if(!(node->flags & (BS_BORROWED_NAME | BS_INLINE_NAME))) {
+	    free(node->name);
+	}
+	node->name = NULL;
+    }
+    if(node->value != NULL) {
+	if(node->flags & BS_SHARED_VALUE) {
+	    SP_ENTRY(node->value)->refcount--;
+	} else if(!(node->flags & (BS_BORROWED_VALUE | BS_INLINE_VALUE))) {
+	    free(node->value);
+	}
+	node->value = NULL;
+    }
+
+}
+
+/* free node contents, dropping pooled string references */
+static inline void bsClearNode(BsDict *dict, BsNode *node) {
+
+    bsAccountStr(dict, node, false, false);
+    bsAccountStr(dict, node, true, false);
+    bsDropStr(dict, node->name, node->flags & BS_SHARED_NAME, node->flags & BS_BORROWED_NAME, node->flags & BS_INLINE_NAME);
+    bsDropStr(dict, node->value, node->flags & BS_SHARED_VALUE, node->flags & BS_BORROWED_VALUE, node->flags & BS_INLINE_VALUE);
+    node->name = NULL;
+    node->value = NULL;
+
+}
+
+#ifdef BS_COMPACT_NODES
+/* append node to parent's child list - LL_APPEND_DYNAMIC() for handles */
+static inline void bsAppendChild(BsNode *parent, BsNode *node) {
+
+    BsNode *last = bsLastChild(parent);
+
+    if(last == NULL) {
+	BS_SET_FIRSTCHILD(parent, node);
+    } else {
+	BS_SET_NEXT(last, node);
+    }
+
+    BS_SET_PREV(node, last);
+    BS_SET_NEXT(node, NULL);
+    BS_SET_LASTCHILD(parent, node);
+
+}
+
+/* remove node from parent's child list - LL_REMOVE_DYNAMIC() for handles */
+static inline void bsRemoveChild(BsNode *parent, BsNode *node) {
+
+    BsNode *prev = bsPrevSibling(node);
+    BsNode *next = bsNextSibling(node);
+
+    if(prev == NULL) {
+	BS_SET_FIRSTCHILD(parent, next);
+    } else {
+	BS_SET_NEXT(prev, next);
+    }
+
+    if(next == NULL) {
+	BS_SET_LASTCHILD(parent, prev);
+    } else {
+	BS_SET_PREV(next, prev);
+    }
+
+    BS_SET_NEXT(node, NULL);
+    BS_SET_PREV(node, NULL);
+
+}
+#endif /* BS_COMPACT_NODES */
+
+/* get a node from the dictionary's node store: reuse a released one or hand out the next free slot */
+static inline BsNode* bsAllocNode(BsDict *dict) {
+
+    BsNodeSlab *slab;
+    BsNode *ret;
+
+    /* recycle */
+    if(dict->freenodes != NULL) {
+	ret = dict->freenodes;
+	dict->freenodes = bsIndexNext(ret);
+	return ret;
+    }
+
+    slab = (dict->slabcount > 0) ? dict->slabs[dict->slabcount - 1] : NULL;
+
+    /* last slab full (or no slabs yet), add a new one, twice the size of the last one */
+    if(slab == NULL || slab->used == slab->size) {
+
+	size_t size = (slab == NULL) ? BS_SLAB_MINSIZE : min(slab->size * 2, BS_SLAB_MAXSIZE);
+
+	if(dict->slabcount == dict->slabmax) {
+	    dict->mem.nodes -= dict->slabmax * sizeof(BsNodeSlab*);
+	    dict->slabmax = (dict->slabmax == 0) ? 16 : dict->slabmax * 2;
+	    xrealloc(dict->slabs, dict->slabs, dict->slabmax * sizeof(BsNodeSlab*));
+	    dict->mem.nodes += dict->slabmax * sizeof(BsNodeSlab*);
+	}
+
+	xmalloc(slab, sizeof(BsNodeSlab) + size * sizeof(BsNode));
+	dict->mem.nodes += sizeof(BsNodeSlab) + size * sizeof(BsNode);
+	dict->nodecap += size;
+	slab->dict = dict;
+	slab->index = dict->slabcount;
+	slab->size = size;
+	slab->used = 0;
+	dict->slabs[dict->slabcount++] = slab;
+
+    }
+
+    ret = &slab->nodes[slab->used];
+#ifdef BS_COMPACT_NODES
+    ret->_slot = slab->used;
+#endif /* BS_COMPACT_NODES */
+    slab->used++;
+
+    return ret;
+
+}
+
+/* free node contents and return node to the dictionary's node store */
+static inline void bsReleaseNode(BsDict *dict, BsNode *node) {
+
+    bsClearNode(dict, node);
+    node->flags = BS_UNUSED;
+    BS_SET_INDEXNEXT(node, dict->freenodes);
+    dict->freenodes = node;
+
+}
+
+/*
+ * Free all nodes in the node store. This is a linear pass freeing node contents,
+ * followed by one free() per slab. If @keeproot is set, the root node (always the
+ * first node in the first slab) and its slab are retained. Pooled strings are not
+ * released one by one - the whole pool goes at once.
+ */
+static void bsReleaseNodes(BsDict *dict, bool keeproot) {
+
+    size_t first = keeproot ? 1 : 0;
+
+    for(size_t i = 0; i < dict->slabcount; i++) {
+
+	BsNodeSlab *slab = dict->slabs[i];
+
+	for(size_t j = (i == 0) ? first : 0; j < slab->used; j++) {
+
+	    BsNode *node = &slab->nodes[j];
+
+	    if(node->flags & BS_UNUSED) {
+		continue;
+	    }
+	    if(!(node->flags & (BS_SHARED_NAME | BS_BORROWED_NAME | BS_INLINE_NAME))) {
+		xfree(node->name);
+	    }
+	    if(!(node->flags & (BS_SHARED_VALUE | BS_BORROWED_VALUE | BS_INLINE_VALUE))) {
+		xfree(node->value);
+	    }
+
+	}
+
+	if(i >= first) {
+	    free(slab);
+	}
+
+    }
+
+    dict->freenodes = NULL;
+
+    if(dict->strings != NULL) {
+	spFree(dict->strings);
+	dict->strings = keeproot ? spCreate(0) : NULL;
+    }
+
+    dict->mem.names = 0;
+    dict->mem.values = 0;
+
+    if(keeproot && dict->slabcount > 0) {
+	dict->slabs[0]->used = 1;
+	dict->slabcount = 1;
+	dict->nodecap = dict->slabs[0]->size;
+	dict->mem.nodes = dict->slabmax * sizeof(BsNodeSlab*) + sizeof(BsNodeSlab) + dict->nodecap * sizeof(BsNode);
+	bsAccountStr(dict, dict->root, false, true);
+    } else {
+	xfree(dict->slabs);
+	dict->slabcount = 0;
+	dict->slabmax = 0;
+	dict->nodecap = 0;
+	dict->mem.nodes = 0;
+	dict->root = NULL;
+    }
+
+}
+
+/*
+ * Create a node in dict with parent parent of type type using name 'name' of length 'namelen',
+ * and with a value of 'value' and length 'valuelen'. This is the internal version of this function
+ * (underscore), which only attaches the name + value to the node. If called directly,
+ * the name should have been passed throuh getTokenData() or bsStoreStr() first, so that
+ * the name is guaranteed not to come from a buffer that will later be destroyed, and so
+ * that it is pooled if the dictionary interns strings.
+ * If zero lengths are given for namelen or valuelen, strlen() is performed.
+ */
+static inline BsNode* _bsCreateNode(BsDict *dict, BsNode *parent, const unsigned int type, char* name, const size_t namelen, char* value, size_t valuelen)
+{
+
+    BsNode *ret;
+    size_t slen = 0;
+    size_t vlen = 0;
+
+    if(dict == NULL) {
+	return NULL;
+    }
+
+    ret = bsAllocNode(dict);
+
+    /* could have calloc'd, but... */
+
+    ret->name = NULL;
+    ret->value = NULL;
+    BS_CLEAR_LINKS(ret);
+    BS_SET_PARENT(ret, parent);
+
+    ret->nameLen = 0;
+    ret->valueLen = 0;
+    ret->ordinal = 0;
+    ret->childCount = 0;
+    ret->type = type;
+    ret->flags = 0;
+#ifdef COLL_DEBUG
+    ret->collcount = 0;
+#endif /* COLL_DEBUG */
+    if(parent != NULL) {
+
+	/* inherit flags */
+
+	/* parent's inheritable flags shifted */
+	unsigned int iflags = (parent->flags & BS_INHERITED_FLAGS) << BS_INHERITED_SHIFT;
+	/* also apply parent's already shifted inherited flags */
+	iflags |= parent->flags & (BS_INHERITED_FLAGS << BS_INHERITED_SHIFT);
+
+	ret->flags |= iflags;
+
+	/*
+	 * if we are adding an array member, call it by number, ignoring the name. The number
+	 * is all we keep: the decimal name is only produced when something needs to see it.
+	 */
+	if(parent->type == BS_NODE_ARRAY) {
+	    ret->ordinal = parent->childCount;
+	    ret->flags |= BS_ORDINAL_NAME;
+	    slen = bsOrdinalLen(ret->ordinal);
+	} else {
+	    if(name == NULL) {
+		goto onerror;
+	    }
+
+	    ret->name = name;
+
+	    if(namelen == 0) {
+		slen = strlen(name);
+	    } else {
+		slen = namelen;
+	    }
+	}
+
+	ret->value = value;
+
+	if(dict->flags & BS_INTERN) {
+	    if(ret->name != NULL) {
+		ret->flags |= BS_SHARED_NAME;
+	    }
+	    if(value != NULL) {
+		ret->flags |= BS_SHARED_VALUE;
+	    }
+	}
+
+	if(value != NULL && valuelen == 0) {
+	    vlen = strlen(value);
+	} else {
+	    vlen = valuelen;
+	}
+
+	ret->nameLen = slen;
+
+	/* mix this node's name's hash with parent's hash */
+	ret->hash = BS_MIX_HASH(bsNameHash(ret), parent->hash, slen);
+
+#if 0
+	/* if this is an instance, also mix it with value */
+	if(type == BS_NODE_INSTANCE) {
+	    ret->hash = BS_MIX_HASH(xxHash32(ret->value, vlen), ret->hash, vlen);
+	}
+#endif
+	ret->valueLen = vlen;
+
+	dict->indexOps->put(dict, ret);
+
+	BS_APPEND_CHILD(parent, ret);
+	parent->childCount++;
+	bsMembersPut(dict, ret);
+	bsAuxBuild(dict, parent);
+
+    } else {
+
+	if(dict->root != NULL) {
+	    fprintf(stderr, "Error: will not replace dictionary '%s' root with node '%s'\n", dict->name, name);
+	    goto onerror;
+	} else {
+	    dict->root = ret;
+	    ret->type = BS_NODE_ROOT;
+	    xmalloc(ret->name, 1);
+	    ret->name[0] = '\0';
+	    bsAccountStr(dict, ret, false, true);
+	    ret->hash = BS_ROOT_HASH;
+	}
+
+    }
+
+    dict->nodecount++;
+    return ret;
+
+onerror:
+
+    bsReleaseNode(dict, ret);
+    return NULL;
+
+}
+
+/* create a node with dictionary-owned copies of @name and @value - inline, pooled or duplicated */
+static inline BsNode* bsCreateNodeCopy(BsDict *dict, BsNode *parent, const unsigned int type, const char* name, const size_t namelen, const char* value, const size_t valuelen) {
+
+    BsNode *ret;
+
+    /* pooled strings must be in place before the node is hashed - and they are accounted for by the pool */
+    if(dict->flags & BS_INTERN) {
+	return _bsCreateNode(dict, parent, type,
+		    name == NULL ? NULL : bsStoreStr(dict, name, namelen), namelen,
+		    value == NULL ? NULL : bsStoreStr(dict, value, valuelen), valuelen);
+    }
+
+    /* otherwise the node only points at the originals until it can take its own copies */
+    ret = _bsCreateNode(dict, parent, type, (char*)name, namelen, (char*)value, valuelen);
+
+    if(ret != NULL) {
+	if(ret->name != NULL) {
+	    bsAdoptStr(dict, ret, false, ret->name, ret->nameLen, false);
+	    bsAccountStr(dict, ret, false, true);
+	}
+	if(ret->value != NULL) {
+	    bsAdoptStr(dict, ret, true, ret->value, ret->valueLen, false);
+	    bsAccountStr(dict, ret, true, true);
+	}
+    }
+
+    return ret;
+
+}
+
+/*
+ * Public node creation wrapper.
+ *
+ * Create a new node in @dict, attached to @parent, of type @type with name @name.
+ * If the parent is an array, we do not need a name. If it's not, the name is duplicated
+ * (or pooled) and length is calculated.
+ */
+BsNode* bsCreateNode(BsDict *dict, BsNode *parent, const unsigned int type, const char* name, const char *value) {
+
+    size_t nlen = 0;
+    size_t vlen = 0;
+
+    if(parent == NULL) {
+	return NULL;
+    }
+
+    if(value != NULL) {
+
+	/* only leafs and instances can have values */
+	if(type != BS_NODE_LEAF) {
+	    return NULL;
+	}
+
+        vlen = strlen(value);
+    }
+
+    if(parent != NULL && parent->type == BS_NODE_ARRAY) {
+
+	return bsCreateNodeCopy(dict, parent, type, NULL, 0, value, vlen);
+
+    }  else {
+
+	if(name != NULL) {
+	    nlen = strlen(name);
+	}
+
+	return bsCreateNodeCopy(dict, parent, type, nlen > 0 ? name : "", nlen, value, vlen);
+    }
+
+}
+
+/* get node name, materialising the name of an array member the first time it is needed */
+const char* bsGetNodeName(BsDict *dict, BsNode *node) {
+
+    if(node == NULL) {
+	return NULL;
+    }
+
+    if(node->name == NULL && (node->flags & BS_ORDINAL_NAME)) {
+
+	char nbuf[INT_STRSIZE + 1];
+
+	bsAdoptStr(dict, node, false, bsNameOf(node, nbuf), node->nameLen, false);
+	bsAccountStr(dict, node, false, true);
+
+    }
+
+    return node->name;
+
+}
+
+/* [get|check if] parent node has a child with specified name */
+static inline BsNode* _bsGetChild(BsDict* dict, BsNode *parent, const char* name, const size_t namelen) {
+
+    uint32_t hash;
+    uint32_t ord = 0;
+    bool isnum;
+
+    if(name != NULL && namelen > 0) {
+
+	BsNode *n;
+
+	/* parse the name as a number only once */
+	isnum = bsParseOrdinal(name, namelen, &ord);
+
+	/* large arrays: straight to the member */
+	if(bsMemberGet(dict, parent, name, namelen, isnum, ord, &n)) {
+	    return n;
+	}
+
+	hash = BS_MIX_HASH(isnum ? bsOrdinalHash(ord) : xxHash32(name, namelen), parent->hash, namelen);
+
+	return dict->indexOps->child(dict, parent, name, namelen, hash, isnum, ord);
+
+    }
+
+    return NULL;
+
+}
+
+/* get a list of children of node with specified name. Returns a dynamic LList* that needs freed */
+static inline LList* _bsGetChildren(LList* out, BsDict* dict, BsNode *parent, const char* name, const size_t namelen) {
+
+    uint32_t hash;
+    uint32_t ord = 0;
+    bool isnum;
+
+    if(out == NULL) {
+	out = llCreate();
+    }
+
+    if(name != NULL && namelen > 0) {
+
+	BsNode *n;
+
+	isnum = bsParseOrdinal(name, namelen, &ord);
+
+	/* large arrays: straight to the member */
+	if(bsMemberGet(dict, parent, name, namelen, isnum, ord, &n)) {
+	    if(n != NULL) {
+		llAppendItem(out, n);
+	    }
+	    return out;
+	}
+
+	hash = BS_MIX_HASH(isnum ? bsOrdinalHash(ord) : xxHash32(name, namelen), parent->hash, namelen);
+
+	dict->indexOps->children(out, dict, parent, name, namelen, hash, isnum, ord);
+
+    }
+
+    return out;
+
+}
+
+/* find a child of @parent by name in the index */
+BsNode* bsIndexedChild(BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord) {
+
+    for(BsNode *n = dict->indexOps->get(dict->index, hash); n != NULL; n = bsIndexNext(n)) {
+	if(bsParent(n) == parent && bsNameMatch(n, name, len, isnum, ord)) {
+	    return n;
+	}
+    }
+
+    return NULL;
+
+}
+
+/* append all children of @parent with given name to @out, found in the index */
+void bsIndexedChildren(LList *out, BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord) {
+
+    for(BsNode *n = dict->indexOps->get(dict->index, hash); n != NULL; n = bsIndexNext(n)) {
+	if(bsParent(n) == parent && bsNameMatch(n, name, len, isnum, ord)) {
+	    llAppendItem(out, n);
+	}
+    }
+
+}
+
+/* find a node by path in the index: the path hash leads to a chain of candidates, the path confirms */
+BsNode* bsIndexedPath(BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count, const uint32_t hash) {
+
+    for(BsNode *n = dict->indexOps->get(dict->index, hash); n != NULL; n = bsIndexNext(n)) {
+	if(bsPathMatch(n, node, segs, count)) {
+	    return n;
+	}
+    }
+
+    return NULL;
+
+}
+
+/* check if @n is reached from @node through path segments @segs - walk up from @n, matching names last to first */
+static inline bool bsPathMatch(BsNode *n, const BsNode *node, const BsPathSeg *segs, size_t count) {
+
+    while(count > 0) {
+
+	count--;
+
+	if(n == NULL || !bsNameMatch(n, segs[count].name, segs[count].len, segs[count].isnum, segs[count].ord)) {
+	    return false;
+	}
+
+	n = bsParent(n);
+
+    }
+
+    return n == node;
+
+}
+
+/*
+ * find a child of @parent by name without an index. (todo: investigate skip lists - but that
+ * would be an index) for now, search from both ends of the list simultaneously.
+ */
+static BsNode* bsScanChild(BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord) {
+
+    /* many children: search the child map instead */
+    if(parent->flags & BS_CHILDMAP) {
+
+	BsNodeAux *map = bsAuxSlot(dict, parent);
+
+	for(BsNode *c = map->buckets[hash & map->mask]; c != NULL; c = bsIndexNext(c)) {
+	    if(c->hash == hash && bsNameMatch(c, name, len, isnum, ord)) {
+		return c;
+	    }
+	}
+
+	return NULL;
+
+    }
+
+    BsNode *n = bsFirstChild(parent);
+    BsNode *m = bsLastChild(parent);
+
+    /* until we meet */
+    while( m != NULL && n != NULL) {
+
+	if(n->hash == hash && bsNameMatch(n, name, len, isnum, ord)) {
+	    return n;
+	}
+
+	/* we've met */
+	if(m == n) {
+	    break;
+	}
+
+	if(m->hash == hash && bsNameMatch(m, name, len, isnum, ord)) {
+	    return m;
+	}
+
+	n = bsNextSibling(n);
+
+	/* we're about to pass each other */
+	if(m == n) {
+	    break;
+	}
+
+	m = bsPrevSibling(m);
+
+    }
+
+    return NULL;
+
+}
+
+/* append all children of @parent with given name to @out, without an index */
+static void bsScanChildren(LList *out, BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord) {
+
+    /* many children: search the child map instead */
+    if(parent->flags & BS_CHILDMAP) {
+
+	BsNodeAux *map = bsAuxSlot(dict, parent);
+
+	for(BsNode *c = map->buckets[hash & map->mask]; c != NULL; c = bsIndexNext(c)) {
+	    if(c->hash == hash && bsNameMatch(c, name, len, isnum, ord)) {
+		llAppendItem(out, c);
+	    }
+	}
+
+	return;
+
+    }
+
+    BsNode *n = bsFirstChild(parent);
+    BsNode *m = bsLastChild(parent);
+
+    /* until we meet */
+    while( m != NULL && n != NULL) {
+
+	if(n->hash == hash && bsNameMatch(n, name, len, isnum, ord)) {
+	    llAppendItem(out, n);
+	}
+
+	/* we've met */
+	if(m == n) {
+	    break;
+	}
+
+	if(m->hash == hash && bsNameMatch(m, name, len, isnum, ord)) {
+	    llAppendItem(out, m);
+	}
+
+	n = bsNextSibling(n);
+
+	/* we're about to pass each other */
+	if(m == n) {
+	    break;
+	}
+
+	m = bsPrevSibling(m);
+
+    }
+
+}
+
+/*
+ * find a node by path without an index, moving down the tree a path segment at a time.
+ * Names need not be unique, so every child by a name is a candidate until one leads to a match.
+ */
+static BsNode* bsScanPath(BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count, const uint32_t hash) {
+
+    BsNode *n, *ret;
+
+    if(count == 0) {
+	return node;
+    }
+
+    /* large arrays: a dense member vector holds the only member by that number */
+    if(bsMemberGet(dict, node, segs->name, segs->len, segs->isnum, segs->ord, &n)) {
+	return n == NULL ? NULL : bsScanPath(dict, n, segs + 1, count - 1, hash);
+    }
+
+    const uint32_t chash = BS_MIX_HASH(segs->hash, node->hash, segs->len);
+
+    /* many children: the candidates are all in one child map bucket */
+    if(node->flags & BS_CHILDMAP) {
+
+	BsNodeAux *map = bsAuxSlot(dict, node);
+
+	for(n = map->buckets[chash & map->mask]; n != NULL; n = bsIndexNext(n)) {
+	    if(n->hash == chash && bsNameMatch(n, segs->name, segs->len, segs->isnum, segs->ord) &&
+		(ret = bsScanPath(dict, n, segs + 1, count - 1, hash)) != NULL) {
+		return ret;
+	    }
+	}
+
+	return NULL;
+
+    }
+
+    BS_FOREACH_CHILD(node, n) {
+	if(n->hash == chash && bsNameMatch(n, segs->name, segs->len, segs->isnum, segs->ord) &&
+	    (ret = bsScanPath(dict, n, segs + 1, count - 1, hash)) != NULL) {
+	    return ret;
+	}
+    }
+
+    return NULL;
+
+}
+
+/* registry slot @node's lookup structures would ideally take */
+static inline size_t bsAuxHome(const BsNode *node, const size_t mask) {
+
+    uint64_t h = (uintptr_t)node;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (size_t)h & mask;
+
+}
+
+/* registry slot holding @node's lookup structures, or the free slot where they would go */
+static inline BsNodeAux* bsAuxSlot(BsDict *dict, const BsNode *node) {
+
+    const size_t mask = dict->auxsize - 1;
+    size_t i;
+
+    for(i = bsAuxHome(node, mask); dict->aux[i].node != NULL && dict->aux[i].node != node; i = (i + 1) & mask);
+
+    return &dict->aux[i];
+
+}
+
+/* resize the registry to @size slots, leaving out entries holding nothing */
+static void bsAuxResize(BsDict *dict, const size_t size) {
+
+    BsNodeAux *old = dict->aux;
+    const size_t oldsize = dict->auxsize;
+
+    dict->auxsize = size;
+    xcalloc(dict->aux, size, sizeof(BsNodeAux));
+    dict->mem.index += size * sizeof(BsNodeAux);
+    dict->mem.index -= oldsize * sizeof(BsNodeAux);
+    dict->auxcount = 0;
+
+    for(size_t i = 0; i < oldsize; i++) {
+	if(old[i].node != NULL && (old[i].node->flags & (BS_CHILDMAP | BS_MEMBERS))) {
+	    *bsAuxSlot(dict, old[i].node) = old[i];
+	    dict->auxcount++;
+	}
+    }
+
+    free(old);
+
+}
+
+/* get @node's registry entry, adding an empty one if it has none */
+static BsNodeAux* bsAuxGet(BsDict *dict, BsNode *node) {
+
+    BsNodeAux *aux;
+
+    if(node->flags & (BS_CHILDMAP | BS_MEMBERS)) {
+	return bsAuxSlot(dict, node);
+    }
+
+    /* keep the registry at most half full */
+    if((dict->auxcount + 1) * 2 > dict->auxsize) {
+	bsAuxResize(dict, (dict->auxsize == 0) ? 16 : dict->auxsize * 2);
+    }
+
+    aux = bsAuxSlot(dict, node);
+    memset(aux, 0, sizeof(BsNodeAux));
+    aux->node = node;
+    dict->auxcount++;
+
+    return aux;
+
+}
+
+/* remove @node's registry entry once it holds nothing */
+static void bsAuxRelease(BsDict *dict, BsNode *node) {
+
+    if(node->flags & (BS_CHILDMAP | BS_MEMBERS)) {
+	return;
+    }
+
+    const size_t mask = dict->auxsize - 1;
+    BsNodeAux *aux = bsAuxSlot(dict, node);
+    size_t i = aux - dict->aux;
+    size_t j;
+
+    if(aux->node == NULL) {
+	return;
+    }
+
+    aux->node = NULL;
+    dict->auxcount--;
+
+    /* close the gap: move back any entry after it that would have liked to be here or before */
+    for(j = (i + 1) & mask; dict->aux[j].node != NULL; j = (j + 1) & mask) {
+
+	const size_t home = bsAuxHome(dict->aux[j].node, mask);
+
+	if(((j - home) & mask) >= ((j - i) & mask)) {
+	    dict->aux[i] = dict->aux[j];
+	    dict->aux[j].node = NULL;
+	    i = j;
+	}
+
+    }
+
+}
+
+/* drop all lookup structures */
+static void bsAuxFree(BsDict *dict) {
+
+    for(size_t i = 0; i < dict->auxsize; i++) {
+
+	BsNodeAux *aux = &dict->aux[i];
+
+	if(aux->node == NULL) {
+	    continue;
+	}
+
+	if(aux->node->flags & BS_CHILDMAP) {
+	    dict->mem.index -= (aux->mask + 1) * sizeof(BsNode*);
+	    free(aux->buckets);
+	}
+
+	if(aux->node->flags & BS_MEMBERS) {
+	    dict->mem.index -= aux->memberSize * sizeof(BsNode*);
+	    free(aux->members);
+	}
+
+	aux->node->flags &= ~(BS_CHILDMAP | BS_MEMBERS);
+
+    }
+
+    dict->mem.index -= dict->auxsize * sizeof(BsNodeAux);
+    xfree(dict->aux);
+    dict->auxsize = 0;
+    dict->auxcount = 0;
+
+}
+
+/* move the children in @map to @size new buckets */
+static void bsChildMapResize(BsDict *dict, BsNodeAux *map, const uint32_t size) {
+
+    BsNode **old = map->buckets;
+    const size_t oldsize = (old == NULL) ? 0 : (size_t)map->mask + 1;
+    BsNode *n, *next;
+
+    xcalloc(map->buckets, size, sizeof(BsNode*));
+    map->mask = size - 1;
+    dict->mem.index += (size - oldsize) * sizeof(BsNode*);
+
+    for(size_t i = 0; i < oldsize; i++) {
+	for(n = old[i]; n != NULL; n = next) {
+	    next = bsIndexNext(n);
+	    BS_SET_INDEXNEXT(n, map->buckets[n->hash & map->mask]);
+	    map->buckets[n->hash & map->mask] = n;
+	}
+    }
+
+    free(old);
+
+}
+
+/* build @node's child map, unless it has one */
+static BsNodeAux* bsChildMapBuild(BsDict *dict, BsNode *node) {
+
+    BsNodeAux *map = bsAuxGet(dict, node);
+    BsNode *n;
+    uint32_t size = 16;
+
+    if(node->flags & BS_CHILDMAP) {
+	return map;
+    }
+
+    while(size < node->childCount) {
+	size *= 2;
+    }
+
+    map->count = 0;
+    bsChildMapResize(dict, map, size);
+
+    BS_FOREACH_CHILD(node, n) {
+	BS_SET_INDEXNEXT(n, map->buckets[n->hash & map->mask]);
+	map->buckets[n->hash & map->mask] = n;
+	map->count++;
+    }
+
+    node->flags |= BS_CHILDMAP;
+
+    return map;
+
+}
+
+/* add a node to its parent's child map, if the parent has one */
+static void bsChildMapPut(BsDict *dict, BsNode *node) {
+
+    BsNode *parent = bsParent(node);
+
+    if(parent == NULL || !(parent->flags & BS_CHILDMAP)) {
+	return;
+    }
+
+    BsNodeAux *map = bsAuxSlot(dict, parent);
+    BsNode **bucket = &map->buckets[node->hash & map->mask];
+
+    BS_SET_INDEXNEXT(node, *bucket);
+    *bucket = node;
+    map->count++;
+
+    /* grow at one child per bucket */
+    if(map->count > map->mask) {
+	bsChildMapResize(dict, map, (map->mask + 1) * 2);
+    }
+
+}
+
+/* remove a node from its parent's child map, if the parent has one */
+static void bsChildMapDelete(BsDict *dict, BsNode *node) {
+
+    BsNode *parent = bsParent(node);
+
+    if(parent == NULL || !(parent->flags & BS_CHILDMAP)) {
+	return;
+    }
+
+    BsNodeAux *map = bsAuxSlot(dict, parent);
+    BsNode *prev = NULL;
+
+    for(BsNode *n = map->buckets[node->hash & map->mask]; n != NULL; prev = n, n = bsIndexNext(n)) {
+	if(n == node) {
+	    if(prev == NULL) {
+		map->buckets[node->hash & map->mask] = bsIndexNext(n);
+	    } else {
+		BS_SET_INDEXNEXT(prev, bsIndexNext(n));
+	    }
+	    BS_SET_INDEXNEXT(n, NULL);
+	    map->count--;
+	    return;
+	}
+    }
+
+}
+
+/* drop @node's child map */
+static void bsChildMapDrop(BsDict *dict, BsNode *node) {
+
+    if(!(node->flags & BS_CHILDMAP)) {
+	return;
+    }
+
+    BsNodeAux *map = bsAuxSlot(dict, node);
+
+    dict->mem.index -= (map->mask + 1) * sizeof(BsNode*);
+    xfree(map->buckets);
+    node->flags &= ~BS_CHILDMAP;
+    bsAuxRelease(dict, node);
+
+}
+
+/* drop all child maps */
+static void bsChildMapsFree(BsDict *dict) {
+
+    bool dropped = false;
+
+    for(size_t i = 0; i < dict->auxsize; i++) {
+	if(dict->aux[i].node != NULL && (dict->aux[i].node->flags & BS_CHILDMAP)) {
+	    dict->aux[i].node->flags &= ~BS_CHILDMAP;
+	    dict->mem.index -= (dict->aux[i].mask + 1) * sizeof(BsNode*);
+	    xfree(dict->aux[i].buckets);
+	    dropped = true;
+	}
+    }
+
+    /* entries left holding nothing go with a rebuild of the registry */
+    if(dropped) {
+	bsAuxResize(dict, dict->auxsize);
+    }
+
+}
+
+/* build array @node's member vector, unless it has one */
+static BsNodeAux* bsMembersBuild(BsDict *dict, BsNode *node) {
+
+    BsNodeAux *aux = bsAuxGet(dict, node);
+    BsNode *n;
+
+    if(node->flags & BS_MEMBERS) {
+	return aux;
+    }
+
+    aux->memberSize = 16;
+    while(aux->memberSize < node->childCount) {
+	aux->memberSize *= 2;
+    }
+
+    xmalloc(aux->members, aux->memberSize * sizeof(BsNode*));
+    dict->mem.index += aux->memberSize * sizeof(BsNode*);
+    aux->memberCount = 0;
+    aux->dense = true;
+
+    BS_FOREACH_CHILD(node, n) {
+	aux->dense &= (n->flags & BS_ORDINAL_NAME) && n->ordinal == aux->memberCount;
+	aux->members[aux->memberCount++] = n;
+    }
+
+    node->flags |= BS_MEMBERS;
+
+    return aux;
+
+}
+
+/* append a new member to its array's member vector, if the array has one */
+static inline void bsMembersPut(BsDict *dict, BsNode *node) {
+
+    BsNode *parent = bsParent(node);
+
+    if(parent == NULL || !(parent->flags & BS_MEMBERS)) {
+	return;
+    }
+
+    BsNodeAux *aux = bsAuxSlot(dict, parent);
+
+    if(aux->memberCount == aux->memberSize) {
+	dict->mem.index += aux->memberSize * sizeof(BsNode*);
+	aux->memberSize *= 2;
+	xrealloc(aux->members, aux->members, aux->memberSize * sizeof(BsNode*));
+    }
+
+    aux->dense &= (node->flags & BS_ORDINAL_NAME) && node->ordinal == aux->memberCount;
+    aux->members[aux->memberCount++] = node;
+
+}
+
+/* remove a member from its array's member vector, if the array has one */
+static void bsMembersDelete(BsDict *dict, BsNode *node) {
+
+    BsNode *parent = bsParent(node);
+    size_t i;
+
+    if(parent == NULL || !(parent->flags & BS_MEMBERS)) {
+	return;
+    }
+
+    BsNodeAux *aux = bsAuxSlot(dict, parent);
+
+    /* a dense vector says where it is, otherwise look from the end, where members usually go from */
+    if(aux->dense && node->ordinal < aux->memberCount && aux->members[node->ordinal] == node) {
+	i = node->ordinal + 1;
+    } else {
+	for(i = aux->memberCount; i > 0 && aux->members[i - 1] != node; i--);
+    }
+
+    if(i == 0) {
+	return;
+    }
+
+    /* members after this one move up, so their ordinals no longer tell their positions */
+    if(i < aux->memberCount) {
+	memmove(&aux->members[i - 1], &aux->members[i], (aux->memberCount - i) * sizeof(BsNode*));
+	aux->dense = false;
+    }
+
+    aux->memberCount--;
+
+}
+
+/*
+ * build the lookup structures @node is due and does not have yet. They are built here, as nodes
+ * are added, rather than on first lookup, so that lookups only ever read the dictionary.
+ */
+static inline void bsAuxBuild(BsDict *dict, BsNode *node) {
+
+    if(node->type == BS_NODE_ARRAY && node->childCount >= BS_MEMBERS_MIN && !(node->flags & BS_MEMBERS)) {
+	bsMembersBuild(dict, node);
+    }
+
+    /* child maps stand in for an index, so not while one is on its way, see bsDeferIndex() */
+    if(dict->indexOps == &bsIndexNone && node->childCount >= BS_CHILDMAP_MIN && !(node->flags & BS_CHILDMAP)) {
+	bsChildMapBuild(dict, node);
+    }
+
+}
+
+/* drop @node's member vector */
+static void bsMembersDrop(BsDict *dict, BsNode *node) {
+
+    if(!(node->flags & BS_MEMBERS)) {
+	return;
+    }
+
+    BsNodeAux *aux = bsAuxSlot(dict, node);
+
+    dict->mem.index -= aux->memberSize * sizeof(BsNode*);
+    xfree(aux->members);
+    node->flags &= ~BS_MEMBERS;
+    bsAuxRelease(dict, node);
+
+}
+
+/*
+ * look up an array member by name via the member vector, return false if the vector cannot tell.
+ * Members are numbered as they are appended, so until one is deleted or moved in, member n is
+ * at position n and no other member can be named n.
+ */
+static inline bool bsMemberGet(BsDict *dict, BsNode *array, const char *name, const size_t len,
+			const bool isnum, const uint32_t ord, BsNode **out) {
+
+    if(!(array->flags & BS_MEMBERS)) {
+	return false;
+    }
+
+    BsNodeAux *aux = bsAuxSlot(dict, array);
+
+    if(!aux->dense) {
+	return false;
+    }
+
+    *out = (isnum && ord < aux->memberCount && bsNameMatch(aux->members[ord], name, len, isnum, ord)) ?
+	    aux->members[ord] : NULL;
+
+    return true;
+
+}
+
+/* append members of @array at positions @from to @to - 1 to @out */
+static void bsMemberSlice(LList *out, BsDict *dict, BsNode *array, size_t from, size_t to) {
+
+    BsNode *n;
+    size_t i = 0;
+
+    to = min(to, array->childCount);
+
+    if(from >= to) {
+	return;
+    }
+
+    if(array->flags & BS_MEMBERS) {
+
+	BsNodeAux *aux = bsAuxSlot(dict, array);
+
+	for(i = from; i < to; i++) {
+	    llAppendItem(out, aux->members[i]);
+	}
+
+	return;
+
+    }
+
+    BS_FOREACH_CHILD(array, n) {
+	if(i >= to) {
+	    break;
+	}
+	if(i++ >= from) {
+	    llAppendItem(out, n);
+	}
+    }
+
+}
+
+/* check if path segment @seg is an array slice (from:to, either end optional), get its bounds if so */
+static inline bool bsParseSlice(const BsPathSeg *seg, size_t *from, size_t *to) {
+
+    const char *sep = memchr(seg->name, BS_SLICE_SEP, seg->len);
+    uint32_t ord;
+
+    if(sep == NULL) {
+	return false;
+    }
+
+    const size_t flen = sep - seg->name;
+    const size_t tlen = seg->len - flen - 1;
+
+    *from = 0;
+    *to = SIZE_MAX;
+
+    if(flen > 0) {
+	if(!bsParseOrdinal(seg->name, flen, &ord)) {
+	    return false;
+	}
+	*from = ord;
+    }
+
+    if(tlen > 0) {
+	if(!bsParseOrdinal(sep + 1, tlen, &ord)) {
+	    return false;
+	}
+	*to = ord;
+    }
+
+    return true;
+
+}
+
+/* append all children of @parent matching a path segment to @out */
+static inline void bsSegChildren(LList *out, BsDict *dict, BsNode *parent, const BsPathSeg *seg) {
+
+    BsNode *n;
+
+    /* large arrays: straight to the member */
+    if(bsMemberGet(dict, parent, seg->name, seg->len, seg->isnum, seg->ord, &n)) {
+	if(n != NULL) {
+	    llAppendItem(out, n);
+	}
+	return;
+    }
+
+    dict->indexOps->children(out, dict, parent, seg->name, seg->len,
+		BS_MIX_HASH(seg->hash, parent->hash, seg->len), seg->isnum, seg->ord);
+
+}
+
+/* append nodes matching path segments under @node to @out, moving down the tree a segment at a time */
+static LList* bsPathWalk(LList *out, BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count) {
+
+    LList* l = llCreate();
+    /* we start with the parent node */
+    llAppendItem(l, node);
+    LListMember *mb;
+    LList* m = NULL;
+    size_t from, to;
+
+    if(out == NULL) {
+	out = llCreate();
+    }
+
+    /* iterate over segments, moving down the tree as we find children segment by segment */
+    for(size_t i = 0; i < count && l->count > 0; i++) {
+
+	const bool slice = bsParseSlice(&segs[i], &from, &to);
+
+	m = llCreate();
+
+	/* iterate over all children matching path so far*/
+	LL_FOREACH_DYNAMIC(l, mb) {
+
+	    BsNode *parent = mb->value;
+
+	    if(slice && parent->type == BS_NODE_ARRAY) {
+		bsMemberSlice(m, dict, parent, from, to);
+	    } else {
+		/* append all children matching current segment */
+		bsSegChildren(m, dict, parent, &segs[i]);
+	    }
+
+	}
+
+	/* drop the original list, we will now iterate over the deeper list */
+	llFree(l);
+	l = m;
+
+    }
+
+    LL_FOREACH_DYNAMIC(l, mb) {
+	llAppendItem(out, mb->value);
+    }
+
+    llFree(l);
+    return out;
+
+}
+
+/*
+ * no index: nothing to maintain but the child maps of nodes with many children,
+ * lookups walk the tree
+ */
+static void* bsNoneCreate() { return NULL; }
+static void bsNoneFree(void *index) { }
+static void* bsNoneGet(void *index, const uint32_t hash) { return NULL; }
+static void bsNoneBuild(BsDict *dict, BsIndexEntry *entries, const size_t count) { }
+
+const BsIndexOps bsIndexNone = {
+    .name	= "none",
+    .create	= bsNoneCreate,
+    .free	= bsNoneFree,
+    .get	= bsNoneGet,
+    .put	= bsChildMapPut,
+    .build	= bsNoneBuild,
+    .del	= bsChildMapDelete,
+    .child	= bsScanChild,
+    .children	= bsScanChildren,
+    .path	= bsScanPath
+};
+
+/*
+ * deferred: while bsDeferIndex() holds indexing off, nothing is maintained at all - an indexed
+ * dictionary has no child maps to keep up, and none are built, the index is on its way
+ */
+static void bsDeferredPut(BsDict *dict, BsNode *node) { }
+static void bsDeferredDelete(BsDict *dict, BsNode *node) { }
+
+static const BsIndexOps bsIndexDeferred = {
+    .name	= "deferred",
+    .create	= bsNoneCreate,
+    .free	= bsNoneFree,
+    .get	= bsNoneGet,
+    .put	= bsDeferredPut,
+    .build	= bsNoneBuild,
+    .del	= bsDeferredDelete,
+    .child	= bsScanChild,
+    .children	= bsScanChildren,
+    .path	= bsScanPath
+};
+
+/* delete node from the dictionary */
+unsigned int bsDeleteNode(BsDict *dict, BsNode *node)
+{
+
+    if(node == NULL) {
+	return BS_NODE_NOT_FOUND;
+    }
+
+    /* remove node from index */
+    dict->indexOps->del(dict, node);
+
+    /* the children are going, and so are their lookup structures */
+    bsChildMapDrop(dict, node);
+    bsMembersDrop(dict, node);
+
+    /* remove all children recursively first */
+    for ( BsNode *child = bsFirstChild(node); child != NULL; child = bsFirstChild(node)) {
+	bsDeleteNode(dict, child);
+    }
+
+    /* root node is persistent, otherwise remove node */
+    if(bsParent(node) != NULL) {
+	BsNode *parent = bsParent(node);
+	bsMembersDelete(dict, node);
+	BS_REMOVE_CHILD(parent, node); /* remove self from parent's list */
+	parent->childCount--;
+	bsReleaseNode(dict, node);
+    }
+
+    dict->nodecount--;
+
+    return BS_NODE_OK;
+}
+
+/* create a (named) dictionary */
+BsDict* bsCreate(const char *name, const uint32_t flags) {
+
+    return bsCreateWithIndex(name, flags, NULL);
+
+}
+
+/* create and initialise a dictionary indexed with the given backend, or the one @flags choose if NULL */
+BsDict* bsCreateWithIndex(const char *name, const uint32_t flags, const BsIndexOps *ops) {
+
+    size_t slen = 0;
+    BsDict *ret;
+
+    xcalloc(ret, 1, sizeof(BsDict));
+
+    /* because no strdup() */
+    if(name == NULL || ((slen = strlen(name)) == 0)) {
+	xmalloc(ret->name, 1);
+	ret->name[0] = '\0';
+    } else {
+	xmalloc(ret->name, slen + 1);
+	memcpy(ret->name, name, slen);
+    }
+
+    *(ret->name + slen) = '\0';
+
+    /* set flags */
+    ret->flags = flags;
+
+    /* pick the index backend - no index means naive search, until bsIndex() */
+    if(ops == &bsIndexNone) {
+	ret->flags |= BS_NOINDEX;
+	ops = NULL;
+    }
+
+    if(ops == NULL) {
+	ops = (flags & BS_INDEX_HASH) ? &bsIndexHash : &bsIndexRbt;
+    }
+
+    ret->indexEngine = ops;
+    ret->indexOps = (ret->flags & BS_NOINDEX) ? &bsIndexNone : ops;
+
+    /* create the string pool */
+    if(flags & BS_INTERN) {
+	ret->strings = spCreate(0);
+    }
+
+    /* create the root node */
+    _bsCreateNode(ret, NULL, BS_NODE_ROOT,NULL,0,NULL,0);
+
+    /* create the index */
+    if(!(ret->flags & BS_NOINDEX)) {
+	ret->index = ops->create();
+	if(ret->index == NULL) {
+	    bsFree(ret);
+	    return NULL;
+	}
+    }
+
+    return ret;
+}
+
+void bsEmpty(BsDict *dict) {
+
+    if(dict == NULL) {
+	return;
+    }
+
+    bsAuxFree(dict);
+
+    /* nodes are not freed by the index - drop it and start a new one */
+    if(dict->index != NULL) {
+	dict->indexEngine->free(dict->index);
+	dict->index = (dict->flags & BS_NOINDEX) ? NULL : dict->indexEngine->create();
+	dict->mem.index = 0;
+	dict->mem.collisions = 0;
+    }
+
+    /* release everything but the root in one pass over the node store */
+    bsReleaseNodes(dict, true);
+
+    BS_CLEAR_LINKS(dict->root);
+
+    dict->root->childCount = 0;
+    dict->nodecount = 1;
+#ifdef COLL_DEBUG
+    dict->root->collcount = 0;
+#endif /* COLL_DEBUG */
+
+}
+
+/* free a dictionary */
+void bsFree(BsDict *dict) {
+
+    if(dict == NULL) {
+	return;
+    }
+
+    if(dict->index != NULL) {
+	dict->indexEngine->free(dict->index);
+    }
+
+    bsAuxFree(dict);
+    bsReleaseNodes(dict, false);
+    bsFreeSources(dict);
+
+    if(dict->name != NULL) {
+	free(dict->name);
+    }
+
+    free(dict);
+
+}
+
+/* get a breakdown of memory used by dictionary - everything but the string pool is kept up to date as we go */
+BsMemStats bsMemoryStats(BsDict *dict) {
+
+    BsMemStats ret = { 0 };
+
+    if(dict == NULL) {
+	return ret;
+    }
+
+    ret = dict->mem;
+
+    if(dict->strings != NULL) {
+	StrPool *pool = dict->strings;
+	ret.strings = sizeof(StrPool) + pool->size * sizeof(SpEntry*) + pool->count * sizeof(SpEntry) + pool->bytes;
+    }
+
+    ret.slack = (dict->nodecap - dict->nodecount) * sizeof(BsNode);
+    ret.total = ret.nodes + ret.names + ret.values + ret.strings + ret.index;
+
+    return ret;
+
+}
+
+/* unescape a string in place and return new length including NUL-termination */
+inline size_t bsUnescapeStr(char *str) {
+
+    int c;
+    char *in = str;
+    size_t len = 0;
+    bool captured = false;
+
+    /* keep scanning */
+    while((c = *in) != '\0') {
+
+	if(c == BS_ESCAPE_CHAR) {
+	    c = *++in;
+
+	    /* this is  an escape sequence */
+	    if(cclass(BF_ESS)) {
+		/* place the corresponding control char */
+		str[len] = esccodes[c];
+		captured = true;
+	    }
+	}
+
+	if(captured) {
+	    captured = false;
+	} else {
+	    str[len] = c;
+	    if(c == '\0') {
+		break;
+	    }
+	}
+
+	in++;
+	len++;
+
+    }
+
+    str[len] = '\0';
+
+    return len + 1;
+
+}
+
+/* place escaped string in @out, return required length (also if @out is 0) including NUL-termination */
+inline size_t bsEscapeStr(const char *src, char *out) {
+
+    return bsEscapeStrn(src, strlen(src), out);
+
+}
+
+/* same as bsEscapeStr, but for a string of known length which need not be NUL-terminated */
+size_t bsEscapeStrn(const char *src, const size_t srclen, char *out) {
+
+    int c;
+    char *in = (char*)src;
+    size_t len = 1;
+
+    /* keep scanning */
+    while(in < src + srclen) {
+
+	c = *(in++);
+
+	if(cclass(BF_ESC)) {
+	    if(out != NULL) {
+		*(out++) = BS_ESCAPE_CHAR;
+		*(out++) = esccodes[c];
+	    }
+	    len += 2;
+	} else if (c == BS_PATH_SEP) {
+	    if(out != NULL) {
+		*(out++) = BS_ESCAPE_CHAR;
+		*(out++) = c;
+	    }
+	    len += 2;
+	} else {
+	    if(out != NULL) {
+		*(out++) = c;
+	    }
+	    len++;
+	}
+
+    }
+
+    if(out != NULL) {
+	*out = '\0';
+    }
+
+    return len;
+
+}
+
+/* get an escaped duplicate of string src */
+inline char* bsGetEscapedStr(const char* src) {
+
+    size_t sl = bsEscapeStr(src, NULL);
+    char* out;
+
+    xmalloc(out, sl);
+    bsEscapeStr(src, out);
+
+    return out;
+
+}
+
+/* walk through string @in, and write to + return next token between the 'sep' character */
+static inline BsToken* unescapeToken(BsToken* out, char** in, const char sep) {
+
+    size_t ssize = BS_QUOTED_STARTSIZE;
+    bool captured = false;
+    int c;
+
+    /* skip past the separator and proper whitespace */
+    while( (((c = **in) == sep) || cclass(BF_WSP)) && c != '\0') {
+	(*in)++;
+    }
+
+    if(c == '\0') {
+	return NULL;
+    }
+
+    out->len = 0;
+    xmalloc(out->data, ssize + 1);
+
+    /* keep scanning */
+    while(((c = **in) != sep) && c != '\0') {
+
+	if(c == BS_ESCAPE_CHAR) {
+	    (*in)++;
+	    c = **in;
+	    /* this is  an escape sequence */
+	    if(cclass(BF_ESS)) {
+		/* place the corresponding control char */
+		out->data[out->len] = esccodes[c];
+		captured = true;
+	    /* but the separator can also be escaped */
+	    } else if(c == sep) {
+		out->data[out->len] = sep;
+		captured = true;
+	    }
+	}
+
+	if(captured) {
+	    captured = false;
+	} else {
+	    if(c == '\0') {
+		goto finalise;
+	    }
+	    out->data[out->len] = c;
+	}
+
+	(*in)++;
+	out->len++;
+
+	/* grow - we do not bother shrinking to fit, these are usually short-lived and used for hashing */
+	if(out->len == ssize) {
+	    ssize *= 2;
+	    xrealloc(out->data, out->data, ssize + 1);
+	}
+
+    }
+
+    if(c != '\0') {
+	(*in)++;
+    }
+
+finalise:
+
+    out->data[out->len] = '\0';
+    return out;
+
+}
+
+/* recursive node rehash callback */
+static void* bsRehashCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
+
+    if(bsParent(node) != NULL) {
+	dict->indexOps->del(dict, node);
+	node->hash = BS_MIX_HASH(bsNameHash(node), bsParent(node)->hash, node->nameLen);
+	dict->indexOps->put(dict, node);
+    }
+
+    return NULL;
+}
+
+/* run a callback recursively on node, return node where callback stoped the walk */
+BsNode* bsNodeWalk(BsDict *dict, BsNode *node, void* user, void* feedback, BsCallback callback) {
+
+    bool stop = false;
+
+    BsNode *n, *o;
+
+    void* feedback1 = callback(dict, node, user, feedback, &stop);
+
+    if(stop) {
+	return node;
+    }
+
+    BS_FOREACH_CHILD(node, n) {
+	o = bsNodeWalk(dict, n, user, feedback1, callback);
+	if(o != NULL) {
+	    return o;
+	}
+    }
+
+    return NULL;
+}
+
+/* run a callback recursively on dictionary, return node where callback stopped the walk */
+BsNode*  bsWalk(BsDict *dict, void* user, BsCallback callback) {
+
+    return bsNodeWalk(dict, dict->root, user, NULL, callback);
+
+}
+
+/*
+ * run a callback on every node in storage order, return node where callback stopped the walk.
+ * This is a linear pass over the node store with no pointer chasing, so it is the
+ * fastest way to visit every node when tree order and feedback do not matter.
+ */
+BsNode* bsForEachNode(BsDict *dict, void* user, BsCallback callback) {
+
+    bool stop = false;
+
+    for(size_t i = 0; i < dict->slabcount; i++) {
+
+	BsNodeSlab *slab = dict->slabs[i];
+
+	for(size_t j = 0; j < slab->used; j++) {
+
+	    BsNode *node = &slab->nodes[j];
+
+	    if(node->flags & BS_UNUSED) {
+		continue;
+	    }
+
+	    callback(dict, node, user, NULL, &stop);
+
+	    if(stop) {
+		return node;
+	    }
+
+	}
+
+    }
+
+    return NULL;
+
+}
+
+/* run a callback recursively on node, return linked list that callback permitted */
+LList* bsNodeFilter(LList* list, BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback) {
+
+    bool stop = false;
+    BsNode *n;
+
+    void* feedback1 = callback(dict, node, user, feedback, &stop);
+
+    if(list == NULL) {
+	list = llCreate();
+    }
+
+    if(stop) {
+	llAppendItem(list, node);
+    }
+
+    BS_FOREACH_CHILD(node, n) {
+	bsNodeFilter(list, dict, n, user, feedback1, callback);
+    }
+
+    return list;
+}
+
+/* run a callback recursively on dictionary, return linked list that callback permitted */
+LList* bsFilter(LList* list, BsDict *dict, void* user, BsCallback callback) {
+
+    if(list == NULL) {
+	list = llCreate();
+    }
+
+    bsNodeFilter(list, dict, dict->root, user, NULL, callback);
+    return list;
+
+}
+
+/* run a callback recursively on node, passing a BsToken with node's full path as feedback */
+BsNode* bsNodePWalk(BsDict *dict, BsNode *node, void* user, void* feedback, BsCallback callback, bool escape) {
+
+    BsToken *ptok = feedback;
+    BsToken tok = { "\0", 0, 0 };
+    bool stop = false;
+    BsNode *n, *o;
+    size_t pl = 0;
+
+    if(ptok != NULL && ptok->data != NULL && ptok->data[0] != '\0') {
+	pl = ptok->len + 1;
+    } else {
+	/* this way we never give the callback a NULL */
+	pl = 0;
+    }
+
+    size_t sl = node->nameLen + pl;
+    char nbuf[INT_STRSIZE + 1];
+    char *nodename = bsNameOf(node, nbuf);
+
+    /*
+     * twice the name len because we can potentially escape every character,
+     * and we allocate on the stack, so anything in a {} scope is local,
+     * and is gone once we leave the scope, so we can't do two different
+     * stack allocations depending on escape contidion.
+     * this whole idea is dangerous territory anyway.
+     */
+    char name[sl + node->nameLen + 1];
+
+    if(pl > 1) {
+	memcpy(name, ptok->data, ptok->len);
+	name[ptok->len]='/';
+    }
+    if(sl > 0) {
+	tok.data = name;
+	if(escape) {
+	    size_t enl = bsEscapeStrn(nodename, node->nameLen, NULL);
+
+	    char ename[enl];
+	    bsEscapeStrn(nodename, node->nameLen, ename);
+	    /* this also copies the NUL termination... */
+	    memcpy(name + pl, ename, enl);
+	    tok.len = pl + enl - 1;
+	    /* ...but we can never be too careful */
+	    name[tok.len] = '\0';
+	} else {
+	    memcpy(name + pl, nodename, node->nameLen);
+	    name[sl] = '\0';
+	    tok.len = sl;
+	}
+    }
+
+    /* callback uses the path */
+    callback(dict, node, user, &tok, &stop);
+
+    if(stop) {
+	return node;
+    }
+
+    BS_FOREACH_CHILD(node, n) {
+	/* recursion expands the path */
+	o = bsNodePWalk(dict, n, user, &tok, callback, escape);
+	if(o != NULL) {
+	    return o;
+	}
+    }
+
+    return NULL;
+}
+
+/* same as bsWalk, but every callback is passed a BsToken as feedback, with node's full path */
+BsNode*  bsPWalk(BsDict *dict, void* user, BsCallback callback, bool escape) {
+
+    return bsNodePWalk(dict, dict->root, user, NULL, callback, escape);
+}
+
+/*
+ * run a callback recursively on node, return linked list of nodes
+ * that callback permitted, callback gets node path. If NULL passed as list,
+ * create one, if not - append.
+ */
+LList* bsNodePFilter(LList *list, BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback, bool escape) {
+
+    BsToken *ptok = feedback;
+    BsToken tok = { "\0", 0, 0 };
+    bool stop = false;
+    BsNode *n;
+    size_t pl = 0;
+
+    if(ptok != NULL && ptok->data != NULL && ptok->data[0] != '\0') {
+	pl = ptok->len + 1;
+    } else {
+	/* this way we never give the callback a NULL */
+	pl = 0;
+    }
+
+    size_t sl = node->nameLen + pl;
+    char nbuf[INT_STRSIZE + 1];
+    char *nodename = bsNameOf(node, nbuf);
+
+    /*
+     * twice the name len because we can potentially escape every character,
+     * and we allocate on the stack, so anything in a {} scope is local,
+     * and is gone once we leave the scope, so we can't do two different
+     * stack allocations depending on escape contidion.
+     * this whole idea is dangerous territory anyway.
+     */
+    char name[sl + node->nameLen + 1];
+
+    if(pl > 1) {
+	memcpy(name, ptok->data, ptok->len);
+	name[ptok->len]='/';
+    }
+
+    if(sl > 0) {
+	tok.data = name;
+	if(escape) {
+	    size_t enl = bsEscapeStrn(nodename, node->nameLen, NULL);
+
+	    char ename[enl];
+	    bsEscapeStrn(nodename, node->nameLen, ename);
+	    /* this also copies the NUL termination... */
+	    memcpy(name + pl, ename, enl);
+	    tok.len = pl + enl - 1;
+	    /* ...but we can never be too careful */
+	    name[tok.len] = '\0';
+	} else {
+	    memcpy(name + pl, nodename, node->nameLen);
+	    name[sl] = '\0';
+	    tok.len = sl;
+	}
+    }
+
+    /* callback uses the path */
+    callback(dict, node, user, &tok, &stop);
+
+    if(list == NULL) {
+	list = llCreate();
+    }
+
+    if(stop) {
+	llAppendItem(list, node);
+    }
+
+    BS_FOREACH_CHILD(node, n) {
+	/* recursion expands the path */
+	bsNodePFilter(list, dict, n, user, &tok, callback, escape);
+    }
+
+    return list;
+
+}
+
+/* run a callback recursively on dictionary, return linked list that callback permitted, callback gets node path */
+LList* bsPFilter(LList* list, BsDict *dict, void* user, BsCallback callback, bool escape) {
+
+    if(list == NULL) {
+	list = llCreate();
+    }
+
+    bsNodePFilter(list, dict, dict->root, user, NULL, callback, escape);
+
+    return list;
+
+}
+
+/* strstr() for a haystack of known length which need not be NUL-terminated */
+static inline bool bsStrnStr(const char *hay, const size_t haylen, const char *needle) {
+
+    size_t nl = strlen(needle);
+
+    if(nl == 0) {
+	return true;
+    }
+
+    for(const char *p = hay; nl <= (size_t)(hay + haylen - p); p++) {
+	if((p = memchr(p, *needle, hay + haylen - p)) == NULL) {
+	    return false;
+	}
+	if((size_t)(hay + haylen - p) >= nl && !memcmp(p, needle, nl)) {
+	    return true;
+	}
+    }
+
+    return false;
+
+}
+
+/* callback for use with bsFilter, checking if node value contains string */
+void* bsValueContainsCb(BsDict *dict, BsNode *node, void* user, void* feedback, bool* matches) {
+
+    if(node->value != NULL && user != NULL && bsStrnStr(node->value, node->valueLen, user)) {
+	*matches = true;
+    }
+
+    return NULL;
+
+}
+
+/* callback for use with bsFilter, checking if node value contains string */
+void* bsNameContainsCb(BsDict *dict, BsNode *node, void* user, void* feedback, bool* matches) {
+
+    char nbuf[INT_STRSIZE + 1];
+    char *name = bsNameOf(node, nbuf);
+
+    if(name != NULL && user != NULL && bsStrnStr(name, node->nameLen, user)) {
+	*matches = true;
+    }
+
+    return NULL;
+
+}
+
+/* work out line number, line start and position in line of @pos, counting a CR-LF pair as one newline */
+static void bsLocate(BsState *state, const char *pos) {
+
+    const char *linestart = state->start;
+    size_t lineno = 1 + state->lineBase;
+    int prev = '\0';
+
+    for(const char *p = state->start; p < pos; p++) {
+
+	int c = *p;
+
+	if(chclass(c, BF_NLN)) {
+	    /* the second character of a pair of different newline characters is not another line */
+	    if(!chclass(prev, BF_NLN) || c == prev) {
+		lineno++;
+	    }
+	    linestart = p + 1;
+	}
+
+	prev = c;
+
+    }
+
+    state->linestart = (char*)linestart;
+    state->lineno = lineno;
+    state->linepos = pos - linestart;
+
+}
+
+/* get line and column (both counted from 1) of @pos in source buffer @buf */
+void bsSourcePos(const char *buf, const char *pos, size_t *line, size_t *column) {
+
+    BsState state;
+
+    state.start = (char*)buf;
+    state.lineBase = 0;
+    bsLocate(&state, pos);
+
+    if(line != NULL) {
+	*line = state.lineno;
+    }
+
+    if(column != NULL) {
+	*column = state.linepos + 1;
+    }
+
+}
+
+/* print error hint from state structure */
+static void bsErrorHint(BsState *state) {
+
+	size_t lw = BS_ERRORDUMP_LINEWIDTH;
+	size_t hlw = lw / 2;
+	char *marker = state->linestart;
+	char linebuf[lw + 1];
+	char pointbuf[lw + 1];
+	bool rtrunc = true;
+
+
+	memset(pointbuf, ' ', lw);
+	memset(linebuf, 0, lw + 1);
+	pointbuf[lw] = '\0';
+
+	if(state->linepos > hlw) {
+	    marker += state->linepos - hlw;
+	    pointbuf[hlw] = '^';
+	} else {
+	    pointbuf[state->linepos] = '^';
+	}
+
+	for(int i = 0; i < lw ; i++) {
+	    if((*marker == '\0') || chclass(*marker, BF_NLN)) {
+		rtrunc = false;
+		break;
+	    }
+	    linebuf[i] = *(marker++);
+	}
+
+	fprintf(stderr,"\t%s%s%s\n\t%s%s\n",
+	    state->linepos > hlw ? "..." : "", linebuf,
+	    rtrunc ? "..." : "",
+	    state->linepos > hlw ? "   " : "", pointbuf);
+
+}
+
+/* print parser error - must be done before the source buffer is freed */
+void bsPrintError(BsState *state) {
+
+    if(state->parseError == BS_PERROR_NONE) {
+
+	fprintf(stderr, "No error: parsed successfully\n");
+	return;
+
+    } else {
+
+	fprintf(stderr, "Parse error: ");
+	/* the error is where we stopped, unless it began where we entered the current state */
+	bsLocate(state, state->current);
+	switch (state->parseError) {
+	    case BS_PERROR_EOF:
+
+		switch(state->scanState) {
+		    case BS_GET_QUOTED:
+			fprintf(stderr, "Unterminated quoted string");
+			restorestate(state);
+			break;
+		    case BS_SKIP_MLCOMMENT:
+			fprintf(stderr, "Unterminated multiline comment");
+			restorestate(state);
+			break;
+		    default:
+			fprintf(stderr, "Unexpected EOF");
+			break;
+		}
+
+		break;
+	    case BS_PERROR_UNEXPECTED:
+		fprintf(stderr, "Unexpected character: '%c' (0x%02x)", *state->current, *state->current);
+		break;
+	    case BS_PERROR_LEVEL:
+		restorestate(state);
+		fprintf(stderr, "Unbalanced bracket(s) found");
+		break;
+	    case BS_PERROR_TOKENS:
+		fprintf(stderr, "Too many consecutive identifiers");
+		break;
+	    case BS_PERROR_EXP_ID:
+		restorestate(state);
+		fprintf(stderr, "Expected node name / identifier");
+		break;
+	    case BS_PERROR_UNEXP_ID:
+		fprintf(stderr, "Unexpected node name / identifier");
+		break;
+	    case BS_PERROR_BLOCK:
+		fprintf(stderr, "Unexpected block element");
+		break;
+	    case BS_PERROR_NULL:
+		fprintf(stderr, "Dictionary object is NULL\n");
+		return;
+	    case BS_PERROR_FILE:
+		fprintf(stderr, "Could not read input file\n");
+		return;
+	    case BS_PERROR_QUOTED:
+		restorestate(state);
+		fprintf(stderr, "Unterminated or invalid quoted string");
+		break;
+	    default:
+		fprintf(stderr, "Unexpected parser error 0x%x\n", state->parseError);
+	}
+
+	fprintf(stderr," at line %zd position %zd:\n\n", state->lineno, state->linepos + 1);
+	bsErrorHint(state);
+
+    }
+
+}
+
+/* main buffer scanner / lexer state machine */
+static inline void bsScan(BsState *state) {
+
+    int qchar = BS_QUOTE_CHAR;
+    int c = (state->current < state->end) ? *state->current : EOF;
+    BsToken *tok = &state->tokenCache[state->tokenCount];
+
+    /*
+     * continue scanning until an event occurs. note that break; is crucial
+     * in some places because we need to check for control characters.
+     */
+    do {
+	/* search for tokens or quoted strings, skip comments, etc. */
+	again: /* short-circuit */
+	switch (state->scanState) {
+
+	    case BS_SKIP_WHITESPACE:
+		while(cclass(BF_SPC | BF_NLN)) {
+		    /* newlines need line accounting, everything else can go in one run */
+		    if(state->spaceChars.member[(unsigned char)c]) {
+			c = bsForwardRun(state, &state->spaceChars);
+		    } else {
+			c = bsForward(state);
+		    }
+		}
+		/* we have reached a multiline comment outer character... */
+		if(c == BS_MLCOMMENT_OUT_CHAR) {
+		    /* ...and the next character is the inner multiline comment character */
+		    if(bsPeek(state) == BS_MLCOMMENT_IN_CHAR) {
+			/* save state when entering a 'find closing character' type state */
+			savestate(state);
+			c = bsForward(state);
+			state->scanState = BS_SKIP_MLCOMMENT;
+			goto again;
+		    }
+		    /* ...and the next character is also a multiline comment outer character */
+		    if(bsPeek(state) == BS_MLCOMMENT_OUT_CHAR) {
+			c = bsForward(state);
+			state->scanState = BS_SKIP_COMMENT;
+			goto again;
+		    }
+		}
+		state->scanState = BS_GET_TOKEN;
+		break;
+
+	    case BS_GET_TOKEN:
+		tok->data = state->current;
+		tok->len = 0;
+		tok->quoted = 0;
+		/*
+		 * ...and we have a problem. Juniper uses ':' in both names and in values,
+		 * so if we want to parse JSON, we have a conflict, because of the ':' value separator.
+		 */
+//		int flags = BF_TOK | (!!state->tokenCount * BF_EXT);
+		if(state->tokenChars.member[(unsigned char)c]) {
+		    c = bsForwardRun(state, &state->tokenChars);
+		    tok->len = state->current - tok->data;
+		}
+		while(cclass(BF_TOK | BF_EXT)) {
+			c = bsForward(state);
+			tok->len++;
+		}
+
+		/* raise a "got token" event if we got anything */
+		if(tok->len > 0) {
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_GOT_TOKEN;
+		    return;
+		}
+
+		break;
+
+	    case BS_GET_QUOTED:
+		tok->len = 0;
+		tok->quoted = ~0;
+		tok->data = NULL;
+		bool captured = false;
+
+		/*
+		 * fast path: a string with no escapes (and no newlines, which are an error anyway)
+		 * is copied once at its final size. Anything else is assembled in the scratch buffer.
+		 */
+		char *qend = bsQuotedEnd(state, state->current, qchar);
+
+		if(qend < state->end && *qend == qchar) {
+
+		    tok->len = qend - state->current;
+
+		    /* or not copied at all, if it can stay where it is */
+		    if(state->inPlace) {
+			tok->data = state->current;
+			tok->quoted = 0;
+		    } else {
+			xmalloc(tok->data, tok->len + 1);
+			memcpy(tok->data, state->current, tok->len);
+			tok->data[tok->len] = '\0';
+		    }
+
+		    /* jump to the closing quote - what bsForward() would have done */
+		    state->prev = *(qend - 1);
+		    state->current = qend;
+		    c = state->c = qchar;
+
+		    c = bsForward(state);
+
+		    if(c != BS_ESCAPE_CHAR) {
+			state->parseEvent = BS_GOT_TOKEN;
+			state->scanState = BS_SKIP_WHITESPACE;
+			return;
+		    }
+
+		    /* a multiline string - continue in the scratch buffer */
+		    bsScratchReserve(state, state->scratchBase + tok->len + 1);
+		    memcpy(state->scratch + state->scratchBase, tok->data, tok->len);
+		    if(tok->quoted) {
+			free(tok->data);
+		    }
+		    tok->data = NULL;
+		    goto multiline;
+
+		}
+
+	        nextbatch:
+
+		while(c != qchar) {
+
+		    bsScratchReserve(state, state->scratchBase + tok->len + 1);
+
+		    if(cclass(BF_NLN)) {
+			    state->parseEvent = BS_ERROR;
+			    state->parseError = BS_PERROR_QUOTED;
+			    return;
+		    }
+
+		    if(c == BS_ESCAPE_CHAR) {
+			c = bsForward(state);
+			/* this is  an escape sequence */
+			if(cclass(BF_ESS)) {
+			    /* place the corresponding control char */
+			    state->scratch[state->scratchBase + tok->len] = esccodes[c];
+			    captured = true;
+			}
+		    }
+
+		    if(captured) {
+			captured = false;
+		    } else {
+			if(c == EOF) {
+			    state->parseEvent = BS_ERROR;
+			    state->parseError = BS_PERROR_EOF;
+			    return;
+			}
+			state->scratch[state->scratchBase + tok->len] = c;
+		    }
+		    c = bsForward(state);
+		    tok->len++;
+		}
+		
+		c = bsForward(state);
+
+		multiline:
+
+		/* try a multiline string */
+		if(c == BS_ESCAPE_CHAR) {
+
+		    /* skip whitespaces and newlines */
+		    do {
+			savestate(state);
+			c = bsForward(state);
+		    } while(cclass(BF_WSP | BF_NLN));
+
+		    /* continue consuming multiline string */
+		    if(c == qchar) {
+			c = bsForward(state);
+			goto nextbatch;
+		    } else {
+			state->parseEvent = BS_ERROR;
+			state->parseError = BS_PERROR_QUOTED;
+			return;
+		    }
+		}
+
+		if(state->inPlace) {
+		    /* leave it in the scratch buffer, next to the statement's other strings */
+		    tok->data = state->scratch + state->scratchBase;
+		    tok->quoted = 0;
+		    state->scratchBase += tok->len;
+		} else {
+		    /* one copy at the final size */
+		    xmalloc(tok->data, tok->len + 1);
+		    memcpy(tok->data, state->scratch, tok->len);
+		    tok->data[tok->len] = '\0';
+		}
+
+		/* raise a "got token" event */
+		state->parseEvent = BS_GOT_TOKEN;
+		state->scanState = BS_SKIP_WHITESPACE;
+		return;
+
+	    case BS_SKIP_COMMENT:
+		while(!cclass(BF_NLN) && c != EOF) {
+		    c = bsForward(state);
+		}
+		state->scanState = BS_SKIP_NEWLINE;
+		/* fall-through */
+
+	    case BS_SKIP_NEWLINE:
+		while(cclass(BF_NLN)) {
+		    c = bsForward(state);
+		}
+		state->scanState = BS_SKIP_WHITESPACE;
+		break;
+
+	    case BS_SKIP_MLCOMMENT:
+
+		while(c != BS_MLCOMMENT_OUT_CHAR && c != EOF) {
+		    c = bsForward(state);
+		}
+		if(c == BS_MLCOMMENT_OUT_CHAR) {
+		    /* not the inner character that opened the comment, which is right after the mark */
+		    if (state->prev == BS_MLCOMMENT_IN_CHAR && state->current - state->mark > 2) {
+			/* end of comment */
+			state->scanState = BS_SKIP_WHITESPACE;
+		    }
+		    /* keep moving on */
+		    c = bsForward(state);
+		} else if (c == EOF) {
+		    state->parseEvent = BS_ERROR;
+		    state->parseError = BS_PERROR_EOF;
+		    return;
+		}
+		break;
+
+	    default:
+		state->parseEvent = BS_ERROR;
+		state->parseError = BS_PERROR;
+		return;
+
+	}
+
+	/* if no event raised, check for control characters, raise parser events and move search state accordingly */
+	if(state->parseEvent == BS_NOEVENT) {
+
+	    switch(c) {
+#ifdef BS_QUOTE1_CHAR
+		case BS_QUOTE1_CHAR:
+#endif
+#ifdef BS_QUOTE2_CHAR
+		case BS_QUOTE2_CHAR:
+#endif
+#ifdef BS_QUOTE3_CHAR
+		case BS_QUOTE3_CHAR:
+#endif
+		case BS_QUOTE_CHAR:
+		    state->scanState = BS_GET_QUOTED;
+		    /* save state when entering a 'find closing character' type state */
+		    savestate(state);
+		    /* because we can have two quotation mark types, we save the one we encountered */
+		    qchar = c;
+		    c = bsForward(state);
+		    goto again;
+#ifdef BS_ENDVAL1_CHAR
+		case BS_ENDVAL1_CHAR:
+#endif
+#ifdef BS_ENDVAL2_CHAR
+		case BS_ENDVAL2_CHAR:
+#endif
+#ifdef BS_ENDVAL3_CHAR
+		case BS_ENDVAL3_CHAR:
+#endif
+#ifdef BS_ENDVAL4_CHAR
+		case BS_ENDVAL4_CHAR:
+#endif
+#ifdef BS_ENDVAL5_CHAR
+		case BS_ENDVAL5_CHAR:
+#endif
+		case BS_ENDVAL_CHAR:
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_GOT_ENDVAL;
+		    bsForward(state);
+		    return;
+		/*
+		 * note: we could minimise the number of cases if we defined event type constants
+		 * as the corresponding characters. So if BS_GOT_BLOCK = BS_STARTBLOCK_CHAR,
+		 * we just have parseEvent = c. This could be used for a fast JSON parser.
+		 */
+		case BS_STARTBLOCK_CHAR:
+		    savestate(state);
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_GOT_BLOCK;
+		    bsForward(state);
+		    return;
+		case BS_ENDBLOCK_CHAR:
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_END_BLOCK;
+		    bsForward(state);
+		    return;
+		case BS_STARTARRAY_CHAR:
+		    savestate(state);
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_GOT_ARRAY;
+		    bsForward(state);
+		    return;
+		case BS_ENDARRAY_CHAR:
+		    state->scanState = BS_SKIP_WHITESPACE;
+		    state->parseEvent = BS_END_ARRAY;
+		    bsForward(state);
+		    return;
+		case BS_COMMENT_CHAR:
+		    state->scanState = BS_SKIP_COMMENT;
+		    c = bsForward(state);
+		    goto again;
+		/* bsForward() _currently_ returns EOF on end, but we still need to handle NUL */
+		case '\0':
+		case EOF:
+		    /* this is a 'legal' end of buffer, as opposed to unexpected EOF */
+		    state->parseEvent = BS_GOT_EOF;
+		    return;
+		default:
+		    if(cclass(BF_ILL)) {
+			state->parseEvent = BS_ERROR;
+			state->parseError = BS_PERROR_UNEXPECTED;
+			return;
+		    }
+		break;
+	    }
+	}
+
+    } while(state->parseEvent == BS_NOEVENT);
+
+    return;
+}
+
+/*
+ * parse the contents of buf into dictionary dict, return last state.
+ * a lot of this logic (different token number cases, see bsStatement()) is to allow
+ * consumption of weirder formats like Juniper configuration. bsParseJson() is the simplified
+ * version for JSON which has none of that; there could also be a "native" one
+ * that forgoes some of the Juniper oddness.
+ */
+BsState bsParse(BsDict *dict, char *buf, const size_t len) {
+
+    BsParser parser = { .dict = dict };
+    bool deferred;
+
+    bsInitState(&parser.state, buf, len);
+
+    if(dict == NULL) {
+	parser.state.parseError = BS_PERROR_NULL;
+	return parser.state;
+    }
+
+    parser.head = dict->root; /* this is the current node we are appending to */
+
+    deferred = bsDeferIndex(dict);
+
+    bsParseRun(&parser, true);
+
+    if(deferred) {
+	bsIndex(dict);
+    }
+
+    xfree(parser.stack);
+
+    return parser.state;
+
+}
+
+/*
+ * parse the JSON contents of buf into dictionary dict, return last state.
+ * This builds the same tree bsParse() does, but with none of the token juggling:
+ * a strict grammar is walked one expected element at a time. The document must
+ * be an object, and its members are attached to the root node.
+ */
+BsState bsParseJson(BsDict *dict, char *buf, const size_t len) {
+
+    /* node stack, so we know where to return when an object or array ends */
+    PST_DECL(nodestack, BsNode*, 16);
+
+    BsNode *head;
+    BsNode *newnode;
+    BsState state;
+    BsCharSet space, quotedset;
+    BsToken *name = &state.tokenCache[0];
+    BsToken *value = &state.tokenCache[1];
+    char *p = buf;
+    char *end = buf + len;
+    char *q;
+    int expect = BS_JSON_KEY_OR_END;
+    bool closed = false;
+    bool quoted;
+    bool deferred;
+
+    bsInitState(&state, buf, len);
+
+    if(dict == NULL) {
+	state.parseError = BS_PERROR_NULL;
+	return state;
+    }
+
+    deferred = bsDeferIndex(dict);
+
+    /* JSON whitespace is all we skip - no comments, no semicolons */
+    memset(space.member, 0, sizeof(space.member));
+    space.member[' '] = space.member['\t'] = space.member['\n'] = space.member['\r'] = true;
+    bsCharSetInit(&space);
+
+    /* and strings run until a quote, a backslash or a control character */
+    for(int i = 0; i < 256; i++) {
+	quotedset.member[i] = (i >= 0x20) && (i != '"') && (i != BS_ESCAPE_CHAR);
+    }
+    bsCharSetInit(&quotedset);
+
+    head = dict->root;
+    PST_INIT(nodestack);
+
+    p = bsRunEnd(&space, p, end);
+
+    /* a terminating NUL counts as end of data */
+    if(p == end || *p == '\0') {
+	state.parseError = BS_PERROR_EOF;
+    } else if(*p != '{') {
+	state.parseError = BS_PERROR_UNEXPECTED;
+    } else {
+	p++;
+    }
+
+    while(!state.parseError && !closed) {
+
+	p = bsRunEnd(&space, p, end);
+
+	if(p == end || *p == '\0') {
+	    state.parseError = BS_PERROR_EOF;
+	    break;
+	}
+
+	/* errors are reported where the element began */
+	state.mark = p;
+
+	switch(expect) {
+
+	    case BS_JSON_KEY_OR_END:
+		if(*p == '}') {
+		    goto endblock;
+		}
+		/* fall through */
+	    case BS_JSON_KEY:
+		if(*p != '"') {
+		    state.parseError = BS_PERROR_EXP_ID;
+		    break;
+		}
+		p = bsJsonString(&state, &quotedset, name, p);
+		expect = BS_JSON_COLON;
+		break;
+
+	    case BS_JSON_COLON:
+		if(*p != ':') {
+		    state.parseError = BS_PERROR_UNEXPECTED;
+		    break;
+		}
+		p++;
+		expect = BS_JSON_VALUE;
+		break;
+
+	    case BS_JSON_VALUE_OR_END:
+		if(*p == ']') {
+		    goto endblock;
+		}
+		/* fall through */
+	    case BS_JSON_VALUE:
+
+		/* objects and arrays: descend, array members are unnamed */
+		if(*p == '{' || *p == '[') {
+
+		    const unsigned int type = (*p == '{') ? BS_NODE_BRANCH : BS_NODE_ARRAY;
+
+		    PST_PUSH_GROW(nodestack, head);
+
+		    if(head->type == BS_NODE_ARRAY) {
+			newnode = _bsCreateNode(dict, head, type, NULL, 0, NULL, 0);
+		    } else {
+			newnode = _bsCreateNode(dict, head, type, getTokenData(dict, name), name->len, NULL, 0);
+			bsAdoptToken(dict, newnode, name, false);
+			newnode->flags |= BS_QUOTED_NAME;
+		    }
+
+		    head = newnode;
+		    expect = (type == BS_NODE_ARRAY) ? BS_JSON_VALUE_OR_END : BS_JSON_KEY_OR_END;
+		    p++;
+		    break;
+
+		}
+
+		/* anything else is a leaf: string, number or a literal */
+		quoted = (*p == '"');
+
+		if(quoted) {
+		    p = bsJsonString(&state, &quotedset, value, p);
+		    if(state.parseError) {
+			break;
+		    }
+		} else {
+		    q = bsRunEnd(&state.tokenChars, p, end);
+		    if(!(((q - p == 4) && (!memcmp(p, "true", 4) || !memcmp(p, "null", 4))) ||
+			    ((q - p == 5) && !memcmp(p, "false", 5)) || bsJsonNumber(p, q))) {
+			state.parseError = BS_PERROR_UNEXPECTED;
+			break;
+		    }
+		    value->data = p;
+		    value->len = q - p;
+		    value->quoted = 0;
+		    p = q;
+		}
+
+		if(head->type == BS_NODE_ARRAY) {
+		    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, getTokenData(dict, value), value->len);
+		} else {
+		    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, getTokenData(dict, name), name->len,
+					    getTokenData(dict, value), value->len);
+		    bsAdoptToken(dict, newnode, name, false);
+		    newnode->flags |= BS_QUOTED_NAME;
+		}
+
+		/* strings were left as plain tokens if they had nothing to unescape */
+		if(quoted) {
+		    newnode->flags |= BS_QUOTED_VALUE;
+		}
+		bsAdoptToken(dict, newnode, value, true);
+
+		expect = BS_JSON_COMMA_OR_END;
+		break;
+
+	    case BS_JSON_COMMA_OR_END:
+
+		if(*p == ',') {
+		    p++;
+		    expect = (head->type == BS_NODE_ARRAY) ? BS_JSON_VALUE : BS_JSON_KEY;
+		    break;
+		}
+
+		if(*p != ((head->type == BS_NODE_ARRAY) ? ']' : '}')) {
+		    state.parseError = BS_PERROR_UNEXPECTED;
+		    break;
+		}
+
+endblock:
+		p++;
+
+		/* that was the document itself */
+		if(PST_EMPTY(nodestack)) {
+		    closed = true;
+		    break;
+		}
+
+		head = PST_POP(nodestack);
+		expect = BS_JSON_COMMA_OR_END;
+		break;
+
+	    default:
+		break;
+
+	}
+
+    }
+
+    /* nothing but whitespace may follow the document */
+    if(!state.parseError && (p = bsRunEnd(&space, p, end)) < end && *p != '\0') {
+	state.parseError = BS_PERROR_UNEXPECTED;
+	state.mark = p;
+    }
+
+    state.current = p;
+    state.parseEvent = state.parseError ? BS_ERROR : BS_GOT_EOF;
+
+    /* line and position are only worked out now */
+    if(state.parseEvent == BS_ERROR) {
+	bsLocate(&state, state.current);
+    }
+
+    /* clean up */
+    tokencleanup();
+    PST_FREE(nodestack);
+
+    if(deferred) {
+	bsIndex(dict);
+    }
+
+    return state;
+
+}
+
+/*
+ * act on the parser event in @state, telling @sink what the tokens collected so far amount to.
+ * This is the statement grammar, shared by bsParse() and bsParseEvents(), which only differ
+ * in the sink: one creates nodes, the other makes callbacks. Return false at EOF.
+ */
+static inline bool bsStatement(BsState *state, const BsSink *sink, void *ctx) {
+
+    int count;
+
+    switch(state->parseEvent) {
+
+	/* we got a token or quoted string - increment counter and check if we can handle the count */
+	case BS_GOT_TOKEN:
+
+	    /* check for node modifiers */
+	    if(state->tokenCount == 0 && state->prev == BS_MODIFIER_CHAR) {
+		/* "inactive" modifier */
+		if(!strncmp(ts(0), "inactive", tl(0) - 1)) {
+		    state->flags |= BS_INACTIVE;
+		    state->tokenOffset++;
+		}
+	    }
+
+	    if(++state->tokenCount == BS_MAX_TOKENS) {
+		/* we can have as many tokens as we want when in an array, add them in batches */
+		if(sink->inArray(ctx)) {
+		    for(int i = 0; i < state->tokenCount - state->tokenOffset; i++) {
+			sink->item(ctx, state, i, BS_NONE);
+		    }
+		    tokenreset();
+		} else{
+		    state->parseEvent = BS_ERROR;
+		    state->parseError = BS_PERROR_TOKENS;
+		}
+	    }
+	    break;
+
+	/* we got start of a block, i.e. '{' */
+	case BS_GOT_BLOCK:
+
+	    count = state->tokenCount - state->tokenOffset;
+
+	    /* it's all different for arrays, because ' a b c { something }' means 4 nodes - 3 leaves and a branch member */
+	    if(sink->inArray(ctx)) {
+
+		/* first insert any existing tokens as array leaves */
+		for(int i = 0; i < count; i++) {
+		    sink->item(ctx, state, i, state->flags);
+		}
+
+		/* now enter into an unnamed branch which is a new member of the array */
+		sink->open(ctx, state, BS_NODE_BRANCH, -1, BS_NONE);
+		sink->enter(ctx);
+
+	    /* selective parsing: skip blocks that lead nowhere we were asked to go */
+	    } else if(sink->skip != NULL && sink->skip(ctx, state)) {
+
+		break;
+
+	    /* create different node arrangements based on token count */
+	    } else {
+
+		switch(count) {
+		    case 1:
+			sink->open(ctx, state, BS_NODE_BRANCH, 0, state->flags);
+			sink->enter(ctx);
+			break;
+		    case 2:
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_BRANCH, 1, BS_NONE);
+			sink->enter(ctx);
+			break;
+		    case 3:
+			/* or should we swap instance and branch - compare with JunOS */
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_BRANCH, 1, BS_NONE);
+			sink->open(ctx, state, BS_NODE_BRANCH, 2, BS_NONE);
+			sink->enter(ctx);
+			break;
+		    /* unnamed branch? only at root level and only once */
+		    case 0:
+			if(state->tokenCount == 0 && sink->atTop(ctx)) {
+			    /* imaginary descent. This allows us to put empty {}s around the whole content */
+			    sink->enter(ctx);
+			/* nope. */
+			} else {
+			    state->parseEvent = BS_ERROR;
+			    state->parseError = BS_PERROR_EXP_ID;
+			}
+			break;
+
+		    default:
+			break;
+		}
+
+	    }
+	    /* we don't need the tokens anymore */
+	    tokenreset();
+	    break;
+
+	/*
+	 * end of block. remaining tokens do not need to be terminated,
+	 * so if we have any, we fall through to endval case. If we have none,
+	 * leave the last bracket and we're golden.
+	 * without the fall through, this would have to be a duplicate of the endval case.
+	 */
+	case BS_END_BLOCK:
+
+	    if(state->tokenCount == 0) {
+		/* 
+		 * WOOP WOOP, WIND SHEAR, BANK ANGLE, PULL UP, TOO LOW, TERRAIN, TERRAIN
+		 * we cannot move up since we are already at the top
+		 */
+		if(!sink->leave(ctx)) {
+		    state->parseEvent = BS_ERROR;
+		    state->parseError = BS_PERROR_BLOCK;
+		}
+		break;
+	    }
+
+	    /* end of block inside an array? nope. */
+	    if(sink->inArray(ctx)) {
+		state->parseEvent = BS_ERROR;
+		state->parseError = BS_PERROR_BLOCK;
+		break;
+	    }
+
+	    /* fall-through to GOT_ENDVAL */
+	    
+	/* we encountered an end of value indication like ';' or ',' (JSON) */
+	case BS_GOT_ENDVAL:
+
+	    count = state->tokenCount - state->tokenOffset;
+
+	    /* arrays are special that way, a single token is a leaf with a value */
+	    if(sink->inArray(ctx)) {
+
+		switch(count) {
+
+		    case 1:
+			sink->item(ctx, state, 0, state->flags);
+			break;
+		    /* this is only a courtesy thing. array members are always unnamed - we only take the value */
+		    case 2:
+			sink->item(ctx, state, 1, state->flags);
+			break;
+		    /* stray endval character, ignore */
+		    case 0:
+			break;
+		    default:
+			state->parseEvent = BS_ERROR;
+			state->parseError = BS_PERROR_TOKENS;
+		    break;
+		}
+
+	    } else if(sink->skip != NULL && sink->skip(ctx, state)) {
+
+		/* selective parsing: not asked for */
+
+	    } else {
+
+		switch(count) {
+
+		    case 1:
+			sink->leaf(ctx, state, 0, -1, state->flags);
+			break;
+		    case 2:
+			sink->leaf(ctx, state, 0, 1, state->flags);
+			break;
+		    case 3:
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_BRANCH, 1, BS_NONE);
+			sink->leaf(ctx, state, 2, -1, BS_NONE);
+			sink->shut(ctx);
+			break;
+		    case 4:
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_BRANCH, 1, BS_NONE);
+			sink->leaf(ctx, state, 2, 3, BS_NONE);
+			sink->shut(ctx);
+			break;
+		    /* stray endval character, ignore */
+		    case 0:
+			break;
+
+		    /* at least 5 tokens */
+		    default:
+
+			/* too many tokens */
+			if(state->tokenCount > BS_MAX_TOKENS) {
+
+			    state->parseEvent = BS_ERROR;
+			    state->parseError = BS_PERROR_TOKENS;
+
+			} else {
+
+			    /*
+			    * 5+ consecutive tokens we treat as branch with (n-1) / 2 leaf-value pairs,
+			    * if the number is odd, the last leaf has no value.
+			    */
+			    sink->open(ctx, state, BS_NODE_BRANCH, 0, state->flags);
+			    for(int i = 1; i < count; i += 2) {
+				sink->leaf(ctx, state, i, (i + 1 < count) ? i + 1 : -1, BS_NONE);
+			    }
+			    sink->shut(ctx);
+
+			}
+
+			break;
+		}
+	    }
+
+	    /* aftermath of the previous fall-through */
+	    if(state->parseEvent == BS_END_BLOCK) {
+		/* 
+		 * WOOP WOOP, WIND SHEAR, BANK ANGLE, PULL UP, TOO LOW, TERRAIN, TERRAIN
+		 * we cannot move up since we are already at the top
+		 */
+		if(!sink->leave(ctx)) {
+		    state->parseEvent = BS_ERROR;
+		    state->parseError = BS_PERROR_LEVEL;
+		    break;
+		}
+	    }
+
+	    tokenreset();
+	    break;
+
+	/* array start block i.e. '[' */
+	case BS_GOT_ARRAY:
+
+	    count = state->tokenCount - state->tokenOffset;
+
+	    /* handle nested arrays - same case as GOT_BLOCK in an array */
+	    if(sink->inArray(ctx)) {
+
+		/* first insert any existing tokens as array leaves */
+		for(int i = 0; i < count; i++) {
+		    sink->item(ctx, state, i, BS_NONE);
+		}
+
+		/* now enter into an unnamed array which is a new member of the upper array */
+		sink->open(ctx, state, BS_NODE_ARRAY, -1, BS_NONE);
+		sink->enter(ctx);
+
+	    /* selective parsing: arrays are kept or skipped whole */
+	    } else if(sink->skip != NULL && sink->skip(ctx, state)) {
+
+		break;
+
+	    } else {
+
+		switch(count) {
+		    case 1:
+			sink->open(ctx, state, BS_NODE_ARRAY, 0, state->flags);
+			sink->enter(ctx);
+			break;
+		    case 2:
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_ARRAY, 1, BS_NONE);
+			sink->enter(ctx);
+			break;
+		    case 3:
+			sink->open(ctx, state, BS_NODE_INSTANCE, 0, state->flags);
+			sink->open(ctx, state, BS_NODE_BRANCH, 1, BS_NONE);
+			sink->open(ctx, state, BS_NODE_ARRAY, 2, BS_NONE);
+			sink->enter(ctx);
+			break;
+		    /* unnamed array?  nope. */
+		    case 0:
+			state->parseEvent = BS_ERROR;
+			state->parseError = BS_PERROR_EXP_ID;
+			break;
+		    default:
+			break;
+		}
+
+	    }
+
+	    tokenreset();
+
+	    break;
+
+	/* array end block i.e. ']' */
+	case BS_END_ARRAY:
+
+	    /* end of arRAY OUTSIDE AN ARRAY?! What are you, some kind of an animal?! */
+	    if(!sink->inArray(ctx)) {
+		state->parseEvent = BS_ERROR;
+		state->parseError = BS_PERROR_BLOCK;
+		break;
+	    }
+
+	    /*
+	     * We allow some flexibility when constructing arrays. If we reach the end of an array,
+	     * any leftover tokens are added as array leaves. This means that an array can be defined
+	     * as a list of whitespace-separated tokens.
+	     */
+	    for(int i = 0; i < state->tokenCount - state->tokenOffset; i++) {
+		sink->item(ctx, state, i, BS_NONE);
+	    }
+
+	    /* return to last branching point */
+	    if(!sink->leave(ctx)) {
+		state->parseEvent = BS_ERROR;
+		state->parseError = BS_PERROR_BLOCK;
+		break;
+	    }
+
+	    tokenreset();
+
+	    break;
+
+	case BS_GOT_EOF:
+	    /* we got an EOF but were left with some tokens. */
+	    if(state->tokenCount > 0) {
+		state->parseEvent = BS_ERROR;
+		state->parseError = BS_PERROR_EOF;
+	    }
+	    /* all she wrote */
+	    return false;
+	case BS_NOEVENT:
+	case BS_ERROR:
+	default:
+	    break;
+    }
+
+    return true;
+
+}
+
+/* bsParse() sink: is the current node an array */
+static bool bsNodeInArray(void *ctx) {
+
+    BsNodeSink *sink = ctx;
+
+    return sink->parser->head->type == BS_NODE_ARRAY;
+
+}
+
+/* bsParse() sink: are we at the root, with no bracket open */
+static bool bsNodeAtTop(void *ctx) {
+
+    BsNodeSink *sink = ctx;
+
+    return sink->parser->head == sink->parser->dict->root && sink->parser->depth == 0;
+
+}
+
+/* bsParse() sink: create a @type node named after token #n (unnamed if n < 0) under the last one opened */
+static void bsNodeOpen(void *ctx, BsState *state, const int type, const int n, const uint32_t flags) {
+
+    BsNodeSink *sink = ctx;
+    BsDict *dict = sink->parser->dict;
+
+    /*
+     * the macros td, tq and tl are defined at the top of this file. They simply
+     * grab the data, quoted field and len field from the given item in token cache.
+     */
+    if(n < 0) {
+	sink->node = _bsCreateNode(dict, sink->node, type, NULL, 0, NULL, 0);
+    } else {
+	sink->node = _bsCreateNode(dict, sink->node, type, td(n), tl(n), NULL, 0);
+	tname(sink->node, n);
+    }
+
+    sink->node->flags |= flags;
+
+}
+
+/*
+ * bsParse() sink: a bracket, the last node opened becomes the current node. Note that we push
+ * the current node onto the stack, so that we can return to it when this block ends, rather than
+ * returning upwards to some nested node that is obviously not it.
+ */
+static void bsNodeEnter(void *ctx) {
+
+    BsNodeSink *sink = ctx;
+    BsParser *parser = sink->parser;
+
+    if(parser->depth == parser->stackSize) {
+	parser->stackSize = (parser->stackSize == 0) ? 16 : parser->stackSize * 2;
+	xrealloc(parser->stack, parser->stack, parser->stackSize * sizeof(BsNode*));
+    }
+
+    parser->stack[parser->depth++] = parser->head;
+    parser->head = sink->node;
+
+}
+
+/* bsParse() sink: end of statement, go back to the current node */
+static void bsNodeShut(void *ctx) {
+
+    BsNodeSink *sink = ctx;
+
+    sink->node = sink->parser->head;
+
+}
+
+/* bsParse() sink: end of bracket, return to the node we entered it from */
+static bool bsNodeLeave(void *ctx) {
+
+    BsNodeSink *sink = ctx;
+    BsParser *parser = sink->parser;
+
+    if(parser->depth == 0) {
+	return false;
+    }
+
+    parser->head = parser->stack[--parser->depth];
+    sink->node = parser->head;
+
+    return true;
+
+}
+
+/* bsParse() sink: create a leaf named after token #n, with the value of token #v (if v >= 0) */
+static void bsNodeLeaf(void *ctx, BsState *state, const int n, const int v, const uint32_t flags) {
+
+    BsNodeSink *sink = ctx;
+    BsDict *dict = sink->parser->dict;
+    BsNode *newnode;
+
+    if(v < 0) {
+	newnode = _bsCreateNode(dict, sink->node, BS_NODE_LEAF, td(n), tl(n), NULL, 0);
+	tname(newnode, n);
+    } else {
+	newnode = _bsCreateNode(dict, sink->node, BS_NODE_LEAF, td(n), tl(n), td(v), tl(v));
+	tname(newnode, n);
+	tvalue(newnode, v);
+    }
+
+    newnode->flags |= flags;
+
+}
+
+/* bsParse() sink: create an array member with the value of token #n */
+static void bsNodeItem(void *ctx, BsState *state, const int n, const uint32_t flags) {
+
+    BsNodeSink *sink = ctx;
+    BsDict *dict = sink->parser->dict;
+    BsNode *newnode;
+
+    newnode = _bsCreateNode(dict, sink->node, BS_NODE_LEAF, NULL, 0, td(n), tl(n));
+    tvalue(newnode, n);
+    newnode->flags |= flags;
+
+}
+
+/* bsParse() sink: selective parsing, leave out statements that lead nowhere we were asked to go */
+static bool bsNodeSkip(void *ctx, BsState *state) {
+
+    BsNodeSink *sink = ctx;
+    BsParser *parser = sink->parser;
+    int selected;
+
+    if(parser->select == NULL) {
+	return false;
+    }
+
+    /* a leaf statement, ended by ';' or '}' */
+    if(state->parseEvent != BS_GOT_BLOCK && state->parseEvent != BS_GOT_ARRAY) {
+	if(bsSelectLeaf(parser->select, parser->dict->root, parser->head, &state->tokenCache[state->tokenOffset],
+		    state->tokenCount - state->tokenOffset, parser->depth)) {
+	    return false;
+	}
+	tokendrop();
+	return true;
+    }
+
+    selected = bsSelectCheck(parser->select, parser->dict->root, parser->head, &state->tokenCache[state->tokenOffset],
+		state->tokenCount - state->tokenOffset, parser->depth);
+
+    if(selected == BS_SELECT_SKIP) {
+	tokendrop();
+	if(!bsSkipBlock(state, parser->select)) {
+	    state->parseEvent = BS_ERROR;
+	    state->parseError = BS_PERROR_LEVEL;
+	}
+	return true;
+    }
+
+    /* everything in this block is wanted (arrays are kept whole), the node it opens will be pushed next */
+    if((selected == BS_SELECT_KEEP || state->parseEvent == BS_GOT_ARRAY) && parser->select->keepFrom == 0) {
+	parser->select->keepFrom = parser->depth + 1;
+    }
+
+    return false;
+
+}
+
+/* bsParse() builds nodes */
+static const BsSink bsNodeSinkOps = {
+    .inArray = bsNodeInArray,
+    .atTop = bsNodeAtTop,
+    .open = bsNodeOpen,
+    .enter = bsNodeEnter,
+    .shut = bsNodeShut,
+    .leave = bsNodeLeave,
+    .leaf = bsNodeLeaf,
+    .item = bsNodeItem,
+    .skip = bsNodeSkip
+};
+
+/*
+ * the parse loop behind bsParse() and bsParseFeed(): parse from where @parser left off
+ * to the end of its state's buffer. Unless @final, running out of data does not end the
+ * parse: whatever follows the last complete statement is dropped and parser->state.current
+ * is left there, so that the statement can be parsed again once the rest of it arrives.
+ * The node stack is kept in @parser, so the next chunk picks up where this one left us.
+ */
+static void bsParseRun(BsParser *parser, const bool final) {
+
+    BsNodeSink sink = { .parser = parser, .node = parser->head };
+    BsState state = parser->state;
+
+    /* end of the last complete statement */
+    char *commit = state.current;
+    int commitprev = state.prev;
+
+    /* keep parsing until no more data or parser error encountered */
+    while(!state.parseError) {
+
+	state.parseEvent = BS_NOEVENT;
+	state.parseError = BS_PERROR_NONE;
+
+	/* scan state machine runs until it barfs an event */
+	bsScan(&state);
+
+	/*
+	 * more data may be coming: a token ending at the end of data may go on in the next chunk,
+	 * and so may whatever made us hit the end (unterminated quoted string or comment).
+	 * Go back to the end of the last complete statement and wait for the rest of it.
+	 */
+	if(!final && (state.parseEvent == BS_GOT_EOF ||
+		((state.parseEvent == BS_GOT_TOKEN || state.parseError) && state.current >= state.end))) {
+	    tokencleanup();
+	    state.flags = 0;
+	    state.current = commit;
+	    state.prev = commitprev;
+	    state.c = (commit < state.end) ? *commit : EOF;
+	    state.scanState = BS_SKIP_WHITESPACE;
+	    state.parseEvent = BS_NOEVENT;
+	    state.parseError = BS_PERROR_NONE;
+	    break;
+	}
+
+	/* process parser event */
+	if(!bsStatement(&state, &bsNodeSinkOps, &sink)) {
+	    break;
+	}
+
+	/* no tokens pending: whatever we have seen so far is in the dictionary */
+	if(state.tokenCount == 0) {
+	    commit = state.current;
+	    commitprev = state.prev;
+	}
+
+    }
+
+    /* we should have ended back at the root, if not, we probably have unbalanced brackets */
+    if(final && state.parseEvent != BS_ERROR && parser->head != parser->dict->root) {
+	state.parseEvent = BS_ERROR;
+	state.parseError = BS_PERROR_LEVEL;
+    }
+
+    /* line and position are only worked out now */
+    if(state.parseEvent == BS_ERROR) {
+	bsLocate(&state, state.current);
+    }
+
+    /* clean up */
+    tokencleanup();
+
+    parser->state = state;
+
+}
+
+/*
+ * parse the contents of file @path into dictionary @dict, return last state. The file is mapped
+ * read-only and parsed where it lies, so there is no load phase: pages are read as the parser
+ * gets to them. It must be NUL-terminated for error reporting, which a mapping is for free unless
+ * the file ends exactly on a page boundary; those, stdin ("-"), BS_FILE_COPY and builds without
+ * BS_MMAP are read into memory with getFileBuf() instead. Zero-copy dictionaries keep the file
+ * until bsFree(), others let it go as soon as it is parsed, unless there was an error - the state
+ * then points into the file.
+ */
+BsState bsParseFile(BsDict *dict, const char *path, const uint32_t flags) {
+
+    struct BsSource *src;
+    BsState state;
+    char *buf = NULL;
+    size_t len = 0;
+#ifdef BS_MMAP
+    struct stat st;
+    int fd;
+#endif /* BS_MMAP */
+
+    bsInitState(&state, NULL, 0);
+
+    if(dict == NULL) {
+	state.parseError = BS_PERROR_NULL;
+	return state;
+    }
+
+    xcalloc(src, 1, sizeof(struct BsSource));
+
+#ifdef BS_MMAP
+    if(!(flags & BS_FILE_COPY) && strcmp(path, "-") && (fd = open(path, O_RDONLY)) >= 0) {
+
+	if(fstat(fd, &st) == 0 && st.st_size > 0 && (st.st_size % sysconf(_SC_PAGESIZE)) != 0) {
+
+	    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	    if(buf == MAP_FAILED) {
+		buf = NULL;
+	    } else {
+		posix_madvise(buf, st.st_size, POSIX_MADV_SEQUENTIAL);
+		len = st.st_size;
+		src->mapped = true;
+	    }
+
+	}
+
+	close(fd);
+
+    }
+#endif /* BS_MMAP */
+
+    /* read it then */
+    if(buf == NULL) {
+
+	len = getFileBuf(&buf, path);
+
+	if(buf == NULL) {
+	    free(src);
+	    state.parseError = BS_PERROR_FILE;
+	    return state;
+	}
+
+	/* getFileBuf() counts the terminating NUL */
+	len--;
+
+    }
+
+    src->data = buf;
+    src->size = src->mapped ? len : len + 1;
+
+    state = (flags & BS_FILE_JSON) ? bsParseJson(dict, buf, len) : bsParse(dict, buf, len);
+
+    /* hand the file over to the dictionary if anything still needs it */
+    if((dict->flags & BS_ZEROCOPY) || state.parseError != BS_PERROR_NONE) {
+	src->next = dict->sources;
+	dict->sources = src;
+    } else {
+	bsReleaseSource(src);
+    }
+
+    return state;
+
+}
+
+/* unmap or free a file parsed in place */
+static void bsReleaseSource(struct BsSource *src) {
+
+#ifdef BS_MMAP
+    if(src->mapped) {
+	munmap(src->data, src->size);
+    } else {
+	free(src->data);
+    }
+#else
+    free(src->data);
+#endif /* BS_MMAP */
+
+    free(src);
+
+}
+
+/* release input files parsed in place */
+static void bsFreeSources(BsDict *dict) {
+
+    struct BsSource *src = dict->sources;
+
+    while(src != NULL) {
+	struct BsSource *next = src->next;
+	bsReleaseSource(src);
+	src = next;
+    }
+
+    dict->sources = NULL;
+
+}
+
+/* push @val onto a growing stack of ints */
+static inline void bsIntPush(int **stack, size_t *count, size_t *size, const int val) {
+
+    if(*count == *size) {
+	*size = (*size == 0) ? 16 : *size * 2;
+	xrealloc(*stack, *stack, *size * sizeof(int));
+    }
+
+    (*stack)[(*count)++] = val;
+
+}
+
+/* bsParseEvents() sink: is the innermost open node an array */
+static bool bsEventInArray(void *ctx) {
+
+    BsEventSink *sink = ctx;
+
+    return sink->openCount > 0 && sink->open[sink->openCount - 1] == BS_NODE_ARRAY;
+
+}
+
+/* bsParseEvents() sink: is there no node or bracket open */
+static bool bsEventAtTop(void *ctx) {
+
+    BsEventSink *sink = ctx;
+
+    return sink->openCount == 0 && sink->levelCount == 0;
+
+}
+
+/* bsParseEvents() sink: report the start of a @type node named after token #n (unnamed if n < 0) */
+static void bsEventOpen(void *ctx, BsState *state, const int type, const int n, const uint32_t flags) {
+
+    BsEventSink *sink = ctx;
+
+    bsIntPush(&sink->open, &sink->openCount, &sink->openSize, type);
+    sink->opened++;
+
+    if(sink->handlers->begin != NULL && !sink->stop) {
+	sink->handlers->begin(sink->user, type, (n < 0) ? NULL : ts(n), (n < 0) ? 0 : tl(n), flags, &sink->stop);
+    }
+
+}
+
+/* bsParseEvents() sink: a bracket, remember how many nodes it opened */
+static void bsEventEnter(void *ctx) {
+
+    BsEventSink *sink = ctx;
+
+    bsIntPush(&sink->levels, &sink->levelCount, &sink->levelSize, sink->opened);
+    sink->opened = 0;
+
+}
+
+/* bsParseEvents() sink: end of statement, report the end of the nodes it opened */
+static void bsEventShut(void *ctx) {
+
+    BsEventSink *sink = ctx;
+
+    for(; sink->opened > 0; sink->opened--) {
+	int type = sink->open[--sink->openCount];
+	if(sink->handlers->end != NULL && !sink->stop) {
+	    sink->handlers->end(sink->user, type, &sink->stop);
+	}
+    }
+
+}
+
+/* bsParseEvents() sink: end of bracket, report the end of the nodes it opened */
+static bool bsEventLeave(void *ctx) {
+
+    BsEventSink *sink = ctx;
+
+    if(sink->levelCount == 0) {
+	return false;
+    }
+
+    sink->opened = sink->levels[--sink->levelCount];
+    bsEventShut(ctx);
+
+    return true;
+
+}
+
+/* bsParseEvents() sink: report a leaf named after token #n, with the value of token #v (if v >= 0) */
+static void bsEventLeaf(void *ctx, BsState *state, const int n, const int v, const uint32_t flags) {
+
+    BsEventSink *sink = ctx;
+
+    if(sink->handlers->leaf != NULL && !sink->stop) {
+	sink->handlers->leaf(sink->user, ts(n), tl(n), (v < 0) ? NULL : ts(v), (v < 0) ? 0 : tl(v), flags, &sink->stop);
+    }
+
+}
+
+/* bsParseEvents() sink: report an array member with the value of token #n */
+static void bsEventItem(void *ctx, BsState *state, const int n, const uint32_t flags) {
+
+    BsEventSink *sink = ctx;
+
+    (void)flags;
+
+    if(sink->handlers->item != NULL && !sink->stop) {
+	sink->handlers->item(sink->user, ts(n), tl(n), &sink->stop);
+    }
+
+}
+
+/* bsParseEvents() makes callbacks */
+static const BsSink bsEventSinkOps = {
+    .inArray = bsEventInArray,
+    .atTop = bsEventAtTop,
+    .open = bsEventOpen,
+    .enter = bsEventEnter,
+    .shut = bsEventShut,
+    .leave = bsEventLeave,
+    .leaf = bsEventLeaf,
+    .item = bsEventItem,
+    .skip = NULL
+};
+
+/*
+ * parse the contents of buf without building anything: report what bsParse() would create
+ * to @handlers instead, see BsEventHandlers. Tokens are passed as they lie in the buffer,
+ * and strings with escapes are unescaped side by side in one reused scratch buffer,
+ * so nothing is allocated per token. Statements go through the same bsStatement() as
+ * with bsParse(), so the same errors are reported - unless a handler stops the parse first.
+ */
+BsState bsParseEvents(char *buf, const size_t len, const BsEventHandlers *handlers, void *user) {
+
+    BsEventSink sink = { .handlers = handlers, .user = user };
+    BsState state;
+
+    bsInitState(&state, buf, len);
+    state.inPlace = true;
+
+    while(!state.parseError && !sink.stop) {
+
+	state.parseEvent = BS_NOEVENT;
+	state.parseError = BS_PERROR_NONE;
+
+	bsScan(&state);
+
+	if(!bsStatement(&state, &bsEventSinkOps, &sink)) {
+	    break;
+	}
+
+    }
+
+    /* anything still open means unbalanced brackets */
+    if(!sink.stop && state.parseEvent != BS_ERROR && sink.openCount > 0) {
+	state.parseEvent = BS_ERROR;
+	state.parseError = BS_PERROR_LEVEL;
+    }
+
+    if(state.parseEvent == BS_ERROR) {
+	bsLocate(&state, state.current);
+    }
+
+    tokencleanup();
+    free(sink.open);
+    free(sink.levels);
+
+    return state;
+
+}
+
+/* point the streaming parser's state at the data held in its buffer */
+static void bsParserRebase(BsParser *parser) {
+
+    BsState *state = &parser->state;
+
+    state->start = parser->buf;
+    state->current = parser->buf + parser->offset;
+    state->mark = state->current;
+    state->linestart = parser->buf;
+    state->end = parser->buf + parser->len;
+    state->c = (parser->offset < parser->len) ? *state->current : EOF;
+
+}
+
+/*
+ * start parsing input that arrives in chunks into @dict: feed it with bsParseFeed(), finish
+ * with bsParseEnd() and free with bsParserFree(). Nodes are always copied, since the data
+ * they would borrow does not stay around: BS_ZEROCOPY is off until bsParseEnd(). With
+ * BS_BULKINDEX, nodes are indexed by bsParseEnd().
+ */
+BsParser* bsParseBegin(BsDict *dict) {
+
+    BsParser *parser;
+
+    if(dict == NULL) {
+	return NULL;
+    }
+
+    xcalloc(parser, 1, sizeof(BsParser));
+
+    parser->dict = dict;
+    parser->head = dict->root;
+    parser->dictFlags = dict->flags;
+    dict->flags &= ~BS_ZEROCOPY;
+    bsDeferIndex(dict);
+
+    bsInitState(&parser->state, NULL, 0);
+
+    return parser;
+
+}
+
+/*
+ * parse the next @len bytes of input. Anything past the last complete statement (a token
+ * or quoted string cut in half, a statement waiting for its terminator) is kept and parsed
+ * with the next chunk, so the buffer holds no more than that and one chunk. Errors stick:
+ * once the returned state has one, the rest of the input is ignored.
+ */
+BsState bsParseFeed(BsParser *parser, const char *chunk, const size_t len) {
+
+    BsState *state = &parser->state;
+    char *keep;
+
+    if(state->parseError != BS_PERROR_NONE) {
+	return *state;
+    }
+
+    /* always NUL-terminated, for bsPrintError() */
+    if(parser->len + len + 1 > parser->size) {
+	parser->size = parser->len + len + 1;
+	xrealloc(parser->buf, parser->buf, parser->size);
+    }
+
+    memcpy(parser->buf + parser->len, chunk, len);
+    parser->len += len;
+    parser->buf[parser->len] = '\0';
+
+    bsParserRebase(parser);
+    bsParseRun(parser, false);
+
+    if(state->parseError == BS_PERROR_NONE) {
+	/* keep the unparsed rest, and the line it starts on, so that errors are shown where they are */
+	for(keep = state->current; keep > parser->buf && !chclass(keep[-1], BF_NLN) &&
+		state->current - keep < BS_STREAM_KEEPLINE; keep--);
+	/* count the lines we are dropping */
+	bsLocate(state, keep);
+	state->lineBase = state->lineno - 1;
+	parser->offset = state->current - keep;
+	parser->len -= keep - parser->buf;
+	memmove(parser->buf, keep, parser->len + 1);
+    }
+
+    return *state;
+
+}
+
+/* parse whatever is left of the input and check that it ended where it should, return final state */
+BsState bsParseEnd(BsParser *parser) {
+
+    BsState *state = &parser->state;
+
+    if(state->parseError == BS_PERROR_NONE) {
+	bsParserRebase(parser);
+	bsParseRun(parser, true);
+    }
+
+    parser->dict->flags |= parser->dictFlags & BS_ZEROCOPY;
+
+    /* indexing was held off by bsParseBegin() */
+    if((parser->dictFlags & (BS_BULKINDEX | BS_NOINDEX)) == BS_BULKINDEX) {
+	bsIndex(parser->dict);
+    }
+
+    return *state;
+
+}
+
+/* free a streaming parser, state returned by it cannot be used for bsPrintError() after this */
+void bsParserFree(BsParser *parser) {
+
+    if(parser == NULL) {
+	return;
+    }
+
+    xfree(parser->buf);
+    xfree(parser->stack);
+    free(parser);
+
+}
+
+/*
+ * parse contents of a char buffer into dictionary dict, keeping only the subtrees under
+ * the @count paths in @paths, plus the branches leading to them. Blocks and arrays that
+ * lead to none of them are skipped by counting brackets (minding quoted strings and
+ * comments) instead of being tokenised - which also means errors inside are not noticed.
+ * Arrays are kept or skipped whole, and so are leaf statements that create several nodes.
+ */
+BsState bsParseSelect(BsDict *dict, char *buf, const size_t len, const char **paths, const size_t count) {
+
+    struct BsSelect sel = { .count = count };
+    BsParser parser = { .dict = dict, .select = &sel };
+    BsToken tok;
+    char *marker;
+    size_t total = 0;
+    bool deferred;
+
+    bsInitState(&parser.state, buf, len);
+
+    if(dict == NULL) {
+	parser.state.parseError = BS_PERROR_NULL;
+	return parser.state;
+    }
+
+    /* split the paths into names the way queries are */
+    xcalloc(sel.lengths, count + 1, sizeof(size_t));
+
+    for(size_t i = 0; i < count; i++) {
+	marker = (char*)paths[i];
+	while(unescapeToken(&tok, &marker, BS_PATH_SEP)) {
+	    xrealloc(sel.names, sel.names, (total + 1) * sizeof(BsSelectName));
+	    sel.names[total].data = tok.data;
+	    sel.names[total].len = tok.len;
+	    sel.names[total].isnum = bsParseOrdinal(tok.data, tok.len, &sel.names[total].ordinal);
+	    sel.lengths[i]++;
+	    total++;
+	}
+    }
+
+    /* character classes for skipping, as seen by bsScan() - see also bsFindCuts() */
+    for(int i = 0; i < 256; i++) {
+	sel.plain.member[i] = true;
+	sel.quoted.member[i] = (i != BS_ESCAPE_CHAR) && !chclass(i, BF_NLN);
+	sel.comment.member[i] = !chclass(i, BF_NLN);
     }
 
-    if(c == '\0') {
-	return NULL;
+    const char special[] = { BS_QUOTE_CHAR, BS_STARTBLOCK_CHAR, BS_ENDBLOCK_CHAR, BS_STARTARRAY_CHAR, BS_ENDARRAY_CHAR,
+			    BS_COMMENT_CHAR, BS_MLCOMMENT_OUT_CHAR,
+#ifdef BS_QUOTE1_CHAR
+			    BS_QUOTE1_CHAR,
+#endif
+#ifdef BS_QUOTE2_CHAR
+			    BS_QUOTE2_CHAR,
+#endif
+#ifdef BS_QUOTE3_CHAR
+			    BS_QUOTE3_CHAR,
+#endif
+			    '\0' };
+
+    for(size_t i = 0; i < sizeof(special); i++) {
+	sel.plain.member[(unsigned char)special[i]] = false;
     }
 
-    out->len = 0;
-    xmalloc(out->data, ssize + 1);
+    sel.quoted.member[(unsigned char)BS_QUOTE_CHAR] = false;
+#ifdef BS_QUOTE1_CHAR
+    sel.quoted.member[(unsigned char)BS_QUOTE1_CHAR] = false;
+#endif
+#ifdef BS_QUOTE2_CHAR
+    sel.quoted.member[(unsigned char)BS_QUOTE2_CHAR] = false;
+#endif
+#ifdef BS_QUOTE3_CHAR
+    sel.quoted.member[(unsigned char)BS_QUOTE3_CHAR] = false;
+#endif
 
-    /* keep scanning */
-    while(((c = **in) != sep) && c != '\0') {
+    bsCharSetInit(&sel.plain);
+    bsCharSetInit(&sel.quoted);
+    bsCharSetInit(&sel.comment);
 
-	if(c == BS_ESCAPE_CHAR) {
-	    (*in)++;
-	    c = **in;
-	    /* this is  an escape sequence */
-	    if(cclass(BF_ESS)) {
-		/* place the corresponding control char */
-		out->data[out->len] = esccodes[c];
-		captured = true;
-	    /* but the separator can also be escaped */
-	    } else if(c == sep) {
-		out->data[out->len] = sep;
-		captured = true;
+    parser.head = dict->root;
+
+    deferred = bsDeferIndex(dict);
+
+    bsParseRun(&parser, true);
+
+    if(deferred) {
+	bsIndex(dict);
+    }
+
+    for(size_t i = 0; i < total; i++) {
+	free(sel.names[i].data);
+    }
+
+    free(sel.names);
+    free(sel.lengths);
+    xfree(parser.stack);
+
+    return parser.state;
+
+}
+
+/*
+ * selective parsing: decide on a statement naming @count nodes below @head, @height being the
+ * node stack height. Anything within a subtree being kept is kept. Otherwise the path of @head
+ * plus the names is compared with each requested path: BS_SELECT_KEEP if one of them covers it,
+ * BS_SELECT_PATH if it leads to one of them, BS_SELECT_SKIP if neither. Statements that do not
+ * name one to three nodes are left for the parser to deal with.
+ */
+static int bsSelectCheck(struct BsSelect *sel, BsNode *root, BsNode *head, BsToken *names, const int count, const size_t height) {
+
+    BsSelectName *path = sel->names;
+    size_t depth = 0;
+    int ret = BS_SELECT_SKIP;
+
+    /* we have left the subtree we were keeping */
+    if(sel->keepFrom > 0 && height < sel->keepFrom) {
+	sel->keepFrom = 0;
+    }
+
+    if(sel->keepFrom > 0) {
+	return BS_SELECT_KEEP;
+    }
+
+    if(count < 1 || count > 3) {
+	return BS_SELECT_PATH;
+    }
+
+    for(BsNode *n = head; n != root; n = bsParent(n)) {
+	depth++;
+    }
+
+    for(size_t i = 0; i < sel->count; path += sel->lengths[i], i++) {
+
+	size_t len = sel->lengths[i];
+	size_t level = depth;
+	bool match = true;
+
+	/* the path so far, walking up from @head */
+	for(BsNode *n = head; match && n != root; n = bsParent(n)) {
+	    level--;
+	    if(level < len) {
+		match = bsNameMatch(n, path[level].data, path[level].len, path[level].isnum, path[level].ordinal);
 	    }
 	}
 
-	if(captured) {
-	    captured = false;
-	} else {
-	    if(c == '\0') {
-		goto finalise;
+	/* then what the statement adds */
+	for(size_t j = 0; match && j < (size_t)count && depth + j < len; j++) {
+	    match = names[j].len == path[depth + j].len && !memcmp(names[j].data, path[depth + j].data, names[j].len);
+	}
+
+	if(!match) {
+	    continue;
+	}
+
+	if(len <= depth + count) {
+	    return BS_SELECT_KEEP;
+	}
+
+	ret = BS_SELECT_PATH;
+
+    }
+
+    return ret;
+
+}
+
+/*
+ * selective parsing: decide on a leaf statement of @count tokens, see the GOT_ENDVAL case in bsStatement()
+ * for the nodes they make. 5+ tokens make a branch full of leaves, kept whole if anything in it is wanted.
+ */
+static inline bool bsSelectLeaf(struct BsSelect *sel, BsNode *root, BsNode *head, BsToken *tokens, const int count, const size_t height) {
+
+    if(count < 1 || count > BS_MAX_TOKENS) {
+	return true;
+    }
+
+    if(count >= 5) {
+	return bsSelectCheck(sel, root, head, tokens, 1, height) != BS_SELECT_SKIP;
+    }
+
+    return bsSelectCheck(sel, root, head, tokens, count < 3 ? 1 : 3, height) == BS_SELECT_KEEP;
+
+}
+
+/*
+ * selective parsing: move past the end of the block or array whose opening bracket was just read,
+ * leaving the state as if the closing bracket was. Brackets are counted, quoted strings and comments
+ * skipped the way bsScan() would, and nothing else is looked at. Returns false if the input ends first.
+ */
+static bool bsSkipBlock(BsState *state, const struct BsSelect *sel) {
+
+    char *p = state->current;
+    char *end = state->end;
+    char *q;
+    int depth = 1;
+
+    while(p < end) {
+
+	p = bsRunEnd(&sel->plain, p, end);
+
+	if(p == end || *p == '\0') {
+	    break;
+	}
+
+	switch(*p) {
+
+	    case BS_QUOTE_CHAR:
+#ifdef BS_QUOTE1_CHAR
+	    case BS_QUOTE1_CHAR:
+#endif
+#ifdef BS_QUOTE2_CHAR
+	    case BS_QUOTE2_CHAR:
+#endif
+#ifdef BS_QUOTE3_CHAR
+	    case BS_QUOTE3_CHAR:
+#endif
+		/* a newline ends it too: that is an error we are not reporting, carry on after it */
+		for(q = p + 1; q < end; q++) {
+		    q = bsRunEnd(&sel->quoted, q, end);
+		    if(q == end || *q == *p || chclass(*q, BF_NLN)) {
+			break;
+		    }
+		    if(*q == BS_ESCAPE_CHAR && q + 1 < end) {
+			q++;
+		    }
+		}
+		p = q + 1;
+		break;
+
+	    case BS_MLCOMMENT_OUT_CHAR:
+		/* only a comment where bsScan() would be skipping whitespace - not within a token */
+		for(q = p - 1; q >= state->start && chclass(*q, BF_SPC) && chclass(*q, BF_TOK | BF_EXT); q--);
+		if(p + 1 == end || (q >= state->start && chclass(*q, BF_TOK | BF_EXT) && !chclass(*q, BF_SPC | BF_NLN))) {
+		    p++;
+		    break;
+		}
+		if(p[1] == BS_MLCOMMENT_IN_CHAR) {
+		    /* as in bsScan(), the inner character that opened the comment cannot close it */
+		    for(q = min(p + 3, end); q < end && (*q != BS_MLCOMMENT_OUT_CHAR || q[-1] != BS_MLCOMMENT_IN_CHAR); q++);
+		    p = q + 1;
+		    break;
+		}
+		if(p[1] != BS_MLCOMMENT_OUT_CHAR) {
+		    p++;
+		    break;
+		}
+		/* fall through */
+	    case BS_COMMENT_CHAR:
+		p = bsRunEnd(&sel->comment, p + 1, end);
+		break;
+
+	    case BS_STARTBLOCK_CHAR:
+	    case BS_STARTARRAY_CHAR:
+		depth++;
+		p++;
+		break;
+
+	    case BS_ENDBLOCK_CHAR:
+	    case BS_ENDARRAY_CHAR:
+		if(--depth == 0) {
+		    state->prev = *p;
+		    state->current = p + 1;
+		    state->c = (p + 1 < end && p[1] != '\0') ? p[1] : EOF;
+		    return true;
+		}
+		p++;
+		break;
+
+	    default:
+		p++;
+		break;
+
+	}
+
+    }
+
+    state->current = end;
+    state->c = EOF;
+
+    return false;
+
+}
+
+#ifdef BS_THREADS
+
+/*
+ * Find up to @count - 1 places to split @buf at for a parallel parse, giving roughly equal pieces.
+ * Pieces may only be cut between top-level statements, so this walks the input the way bsScan()
+ * would, skipping quoted strings and comments and counting brackets. Brackets around the whole
+ * input (an unnamed top-level block) belong to no statement: they are returned in @holes, and
+ * the statements inside them count as top level. @dataend is set to where parsing would stop.
+ * Returns the number of cuts, or 0 if there are none or the input is best left to bsParse()
+ * to report errors on (unbalanced brackets, unterminated strings or comments).
+ */
+static size_t bsFindCuts(char *buf, const size_t len, char **cuts, const size_t count, char **holes, size_t *holecount, char **dataend) {
+
+    BsCharSet plain, space, quoted, comment;
+    char *end = buf + len;
+    char *p = buf;
+    char *q;
+    char *target;
+    char *next = NULL;		/* statement boundary to cut at */
+    size_t ncuts = 0;
+    int depth = 0;
+    int top = 0;		/* depth of top-level statements, 1 inside brackets around everything */
+    bool pending = false;	/* a top-level statement has started */
+
+    *holecount = 0;
+    *dataend = end;
+
+    /* character classes as seen by bsScan() */
+    for(int i = 0; i < 256; i++) {
+	space.member[i] = chclass(i, BF_SPC | BF_NLN);
+	quoted.member[i] = (i != BS_ESCAPE_CHAR) && !chclass(i, BF_NLN);
+	comment.member[i] = !chclass(i, BF_NLN);
+	plain.member[i] = true;
+    }
+
+    /* everything that decides how the rest of the input is read */
+    const char special[] = { BS_QUOTE_CHAR, BS_STARTBLOCK_CHAR, BS_ENDBLOCK_CHAR, BS_STARTARRAY_CHAR, BS_ENDARRAY_CHAR,
+			    BS_COMMENT_CHAR, BS_MLCOMMENT_OUT_CHAR, BS_ENDVAL_CHAR,
+#ifdef BS_QUOTE1_CHAR
+			    BS_QUOTE1_CHAR,
+#endif
+#ifdef BS_QUOTE2_CHAR
+			    BS_QUOTE2_CHAR,
+#endif
+#ifdef BS_QUOTE3_CHAR
+			    BS_QUOTE3_CHAR,
+#endif
+#ifdef BS_ENDVAL1_CHAR
+			    BS_ENDVAL1_CHAR,
+#endif
+#ifdef BS_ENDVAL2_CHAR
+			    BS_ENDVAL2_CHAR,
+#endif
+#ifdef BS_ENDVAL3_CHAR
+			    BS_ENDVAL3_CHAR,
+#endif
+#ifdef BS_ENDVAL4_CHAR
+			    BS_ENDVAL4_CHAR,
+#endif
+#ifdef BS_ENDVAL5_CHAR
+			    BS_ENDVAL5_CHAR,
+#endif
+			    '\0' };
+
+    for(size_t i = 0; i < sizeof(special); i++) {
+	plain.member[(unsigned char)special[i]] = false;
+    }
+
+    /* a quoted string runs until its own quote character, the others are just characters */
+    quoted.member[(unsigned char)BS_QUOTE_CHAR] = false;
+#ifdef BS_QUOTE1_CHAR
+    quoted.member[(unsigned char)BS_QUOTE1_CHAR] = false;
+#endif
+#ifdef BS_QUOTE2_CHAR
+    quoted.member[(unsigned char)BS_QUOTE2_CHAR] = false;
+#endif
+#ifdef BS_QUOTE3_CHAR
+    quoted.member[(unsigned char)BS_QUOTE3_CHAR] = false;
+#endif
+
+    bsCharSetInit(&plain);
+    bsCharSetInit(&space);
+    bsCharSetInit(&quoted);
+    bsCharSetInit(&comment);
+
+    target = buf + len / count;
+
+    while(p < end) {
+
+	/* cut at the first statement boundary past the target, then aim for equal pieces of what is left */
+	if(next != NULL) {
+	    if(next >= target && next < end && ncuts < count - 1) {
+		cuts[ncuts++] = next;
+		target = next + (end - next) / (count - ncuts);
 	    }
-	    out->data[out->len] = c;
+	    next = NULL;
+	}
+
+	/* at top level we need to know if a statement has started */
+	if(depth == top) {
+	    p = bsRunEnd(&space, p, end);
+	    if(p < end && plain.member[(unsigned char)*p]) {
+		pending = true;
+	    }
+	}
+
+	p = bsRunEnd(&plain, p, end);
+
+	if(p == end) {
+	    break;
+	}
+
+	switch(*p) {
+
+	    /* bsScan() stops here */
+	    case '\0':
+		*dataend = p;
+		end = p;
+		break;
+
+	    case BS_QUOTE_CHAR:
+#ifdef BS_QUOTE1_CHAR
+	    case BS_QUOTE1_CHAR:
+#endif
+#ifdef BS_QUOTE2_CHAR
+	    case BS_QUOTE2_CHAR:
+#endif
+#ifdef BS_QUOTE3_CHAR
+	    case BS_QUOTE3_CHAR:
+#endif
+		pending = true;
+		for(q = p + 1; q < end; q++) {
+		    q = bsRunEnd(&quoted, q, end);
+		    if(q == end || *q == *p) {
+			break;
+		    }
+		    if(chclass(*q, BF_NLN)) {
+			return 0;
+		    }
+		    if(*q == BS_ESCAPE_CHAR) {
+			q++;
+		    }
+		}
+		if(q >= end) {
+		    return 0;
+		}
+		p = q + 1;
+		break;
+
+	    case BS_MLCOMMENT_OUT_CHAR:
+		/* only a comment where bsScan() would be skipping whitespace - not within a token, which ':' can extend */
+		for(q = p - 1; q >= buf && chclass(*q, BF_SPC) && chclass(*q, BF_TOK | BF_EXT); q--);
+		if(p + 1 == end || (q >= buf && chclass(*q, BF_TOK | BF_EXT) && !chclass(*q, BF_SPC | BF_NLN))) {
+		    pending |= (depth == top);
+		    p++;
+		    break;
+		}
+		if(p[1] == BS_MLCOMMENT_IN_CHAR) {
+		    /* the comment ends with the first outer character that follows an inner one, other than the opening one */
+		    for(q = min(p + 3, end); q < end && (*q != BS_MLCOMMENT_OUT_CHAR || q[-1] != BS_MLCOMMENT_IN_CHAR); q++);
+		    if(q == end) {
+			return 0;
+		    }
+		    p = q + 1;
+		    break;
+		}
+		if(p[1] != BS_MLCOMMENT_OUT_CHAR) {
+		    pending |= (depth == top);
+		    p++;
+		    break;
+		}
+		/* fall through */
+	    case BS_COMMENT_CHAR:
+		p = bsRunEnd(&comment, p + 1, end);
+		break;
+
+	    case BS_STARTBLOCK_CHAR:
+		/* an unnamed top-level block: leave the brackets out, its contents are top level */
+		if(depth == top && !pending) {
+		    if(top > 0 || *holecount == BS_PARALLEL_MAXHOLES) {
+			return 0;
+		    }
+		    holes[(*holecount)++] = p;
+		    top = 1;
+		    next = p + 1;
+		}
+		depth++;
+		p++;
+		break;
+
+	    case BS_STARTARRAY_CHAR:
+		if(depth == top && !pending) {
+		    return 0;
+		}
+		depth++;
+		p++;
+		break;
+
+	    case BS_ENDBLOCK_CHAR:
+	    case BS_ENDARRAY_CHAR:
+		if(depth == 0) {
+		    return 0;
+		}
+		if(depth == top) {
+		    /* end of the unnamed block, unless a statement is left unterminated inside it */
+		    if(*p != BS_ENDBLOCK_CHAR || pending || *holecount == BS_PARALLEL_MAXHOLES) {
+			return 0;
+		    }
+		    holes[(*holecount)++] = p;
+		    top = 0;
+		}
+		depth--;
+		p++;
+		if(depth == top) {
+		    pending = false;
+		    next = p;
+		}
+		break;
+
+	    /* value separators */
+	    default:
+		p++;
+		if(depth == top) {
+		    pending = false;
+		    next = p;
+		}
+		break;
+
+	}
+
+    }
+
+    if(depth != 0) {
+	return 0;
+    }
+
+    return ncuts;
+
+}
+
+/* parallel parse worker: parse one piece of the input, stepping over any holes in it */
+static void* bsParseJobRun(void *arg) {
+
+    BsParseJob *job = arg;
+    char *from = job->start;
+    char *to;
+
+    for(size_t i = 0; i <= job->holecount; i++) {
+
+	to = (i < job->holecount) ? job->holes[i] : job->end;
+	job->state = bsParse(job->dict, from, to - from);
+
+	if(job->state.parseError) {
+	    break;
+	}
+
+	from = to + 1;
+
+    }
+
+    return NULL;
+
+}
+
+/*
+ * Move the contents of @from - a dictionary created for a parallel parse - under the root of @dict.
+ * Nodes stay where they are: @from's slabs are taken over by @dict, in order, so the result
+ * looks as if @dict had parsed everything itself. Node hashes need no work either, since both
+ * roots hash the same. @from is freed.
+ */
+static void bsAdoptDict(BsDict *dict, BsDict *from) {
+
+    const size_t base = dict->slabcount;
+    BsNode *root = from->root;
+    BsNode *node;
+    BsNode *next;
+
+    /* lookup structures are tied to their dictionary, ours are built once the nodes are in */
+    bsAuxFree(from);
+    bsChildMapDrop(dict, dict->root);
+    bsMembersDrop(dict, dict->root);
+
+    /* take over the slabs */
+    if(dict->slabcount + from->slabcount > dict->slabmax) {
+	dict->mem.nodes -= dict->slabmax * sizeof(BsNodeSlab*);
+	while(dict->slabcount + from->slabcount > dict->slabmax) {
+	    dict->slabmax = (dict->slabmax == 0) ? 16 : dict->slabmax * 2;
+	}
+	xrealloc(dict->slabs, dict->slabs, dict->slabmax * sizeof(BsNodeSlab*));
+	dict->mem.nodes += dict->slabmax * sizeof(BsNodeSlab*);
+    }
+
+    for(size_t i = 0; i < from->slabcount; i++) {
+	BsNodeSlab *slab = from->slabs[i];
+	slab->dict = dict;
+	slab->index = base + i;
+	dict->slabs[dict->slabcount++] = slab;
+	dict->mem.nodes += sizeof(BsNodeSlab) + slab->size * sizeof(BsNode);
+	dict->nodecap += slab->size;
+    }
+
+#ifdef BS_COMPACT_NODES
+    /* handles carry the slab number, which has moved up by @base */
+    const BsNodeRef shift = base << 16;
+
+    for(size_t i = base; i < dict->slabcount; i++) {
+	for(size_t j = 0; j < dict->slabs[i]->used; j++) {
+	    node = &dict->slabs[i]->nodes[j];
+	    node->_parent += node->_parent ? shift : 0;
+	    node->_firstChild += node->_firstChild ? shift : 0;
+	    node->_lastChild += node->_lastChild ? shift : 0;
+	    node->_next += node->_next ? shift : 0;
+	    node->_prev += node->_prev ? shift : 0;
+	    node->_indexNext += node->_indexNext ? shift : 0;
 	}
+    }
+#endif /* BS_COMPACT_NODES */
+
+    /* hand the top-level nodes over to our root */
+    for(node = bsFirstChild(root); node != NULL; node = next) {
+	next = bsNextSibling(node);
+	BS_APPEND_CHILD(dict->root, node);
+	BS_SET_PARENT(node, dict->root);
+    }
+
+    dict->root->childCount += root->childCount;
+    dict->nodecount += from->nodecount;
+    dict->mem.names += from->mem.names;
+    dict->mem.values += from->mem.values;
+
+    /* released nodes are ours to reuse now */
+    if(from->freenodes != NULL) {
+	for(node = from->freenodes; bsIndexNext(node) != NULL; node = bsIndexNext(node));
+	BS_SET_INDEXNEXT(node, dict->freenodes);
+	dict->freenodes = from->freenodes;
+    }
+
+    /* the other root is just a released node now */
+    BS_CLEAR_LINKS(root);
+    bsReleaseNode(dict, root);
+    dict->nodecount--;
 
-	(*in)++;
-	out->len++;
+    bsAuxBuild(dict, dict->root);
 
-	/* grow - we do not bother shrinking to fit, these are usually short-lived and used for hashing */
-	if(out->len == ssize) {
-	    ssize *= 2;
-	    xrealloc(out->data, out->data, ssize + 1);
+    for(size_t i = base; i < dict->slabcount; i++) {
+	for(size_t j = 0; j < dict->slabs[i]->used; j++) {
+	    node = &dict->slabs[i]->nodes[j];
+	    if(!(node->flags & BS_UNUSED)) {
+		bsAuxBuild(dict, node);
+	    }
 	}
+    }
 
+    /* index in creation order, the same order bsParse() would have */
+    if(!(dict->flags & BS_NOINDEX)) {
+	bsIndexBulk(dict, base);
     }
 
-    if(c != '\0') {
-	(*in)++;
+    /* nothing left in the other dictionary but its shell */
+    from->slabcount = 0;
+    from->root = NULL;
+    from->freenodes = NULL;
+    bsFree(from);
+
+}
+
+#endif /* BS_THREADS */
+
+/*
+ * parse the contents of buf into dictionary dict using @nthreads threads, return last state.
+ * The input is cut into pieces between top-level statements, each piece is parsed into
+ * a private dictionary by bsParse() on its own thread, and the results are moved under
+ * dict's root in input order, so the tree, node count and index are the same as bsParse()
+ * would give. Interning dictionaries, small inputs and inputs with no place to cut are
+ * parsed by bsParse() directly, and so is anything bsParse() will have to report an error on
+ * that the cutting cannot be sure about (unbalanced brackets and the like). Without BS_THREADS,
+ * everything is.
+ */
+BsState bsParseParallel(BsDict *dict, char *buf, const size_t len, const int nthreads) {
+
+#ifndef BS_THREADS
+
+    (void)nthreads;
+    return bsParse(dict, buf, len);
+
+#else
+
+    char *cuts[BS_PARALLEL_MAXTHREADS];
+    char *holes[BS_PARALLEL_MAXHOLES];
+    size_t holecount;
+    char *dataend;
+    size_t ncuts;
+    size_t failed;
+    BsParseJob *jobs;
+    pthread_t *threads;
+    bool *started;
+    BsState state;
+
+    if(dict == NULL || nthreads < 2 || len < BS_PARALLEL_MINSIZE || (dict->flags & BS_INTERN) ||
+	    (ncuts = bsFindCuts(buf, len, cuts, min(nthreads, BS_PARALLEL_MAXTHREADS), holes, &holecount, &dataend)) == 0) {
+	return bsParse(dict, buf, len);
     }
 
-finalise:
+    xcalloc(jobs, ncuts + 1, sizeof(BsParseJob));
+    xcalloc(threads, ncuts + 1, sizeof(pthread_t));
+    xcalloc(started, ncuts + 1, sizeof(bool));
 
-    out->data[out->len] = '\0';
-    return out;
+    for(size_t i = 0; i <= ncuts; i++) {
 
-}
+	BsParseJob *job = &jobs[i];
 
-/* recursive node rehash callback */
-static void* bsRehashCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
+	job->dict = bsCreate(dict->name, dict->flags | BS_NOINDEX);
+	job->dict->indexOps = &bsIndexDeferred;
+	job->start = (i == 0) ? buf : cuts[i - 1];
+	job->end = (i == ncuts) ? dataend : cuts[i];
+	job->holes = holes;
 
-    if(node->parent != NULL) {
-	if(!(dict->flags & BS_NOINDEX)) {
-	    bsIndexDelete(dict->index, node);
+	/* holes are in input order, so each job gets a run of them */
+	while(job->holes < holes + holecount && *job->holes < job->start) {
+	    job->holes++;
 	}
-	node->hash = BS_MIX_HASH(xxHash32(node->name, node->nameLen), node->parent->hash, node->nameLen);
-	if(!(dict->flags & BS_NOINDEX)) {
-	    bsIndexPut(dict, node);
+	while(job->holes + job->holecount < holes + holecount && job->holes[job->holecount] < job->end) {
+	    job->holecount++;
 	}
-    }
 
-    return NULL;
-}
+    }
 
-/* run a callback recursively on node, return node where callback stoped the walk */
-BsNode* bsNodeWalk(BsDict *dict, BsNode *node, void* user, void* feedback, BsCallback callback) {
+    /* the first piece is ours, and so is anything we could not start a thread for */
+    for(size_t i = 1; i <= ncuts; i++) {
+	started[i] = (pthread_create(&threads[i], NULL, bsParseJobRun, &jobs[i]) == 0);
+    }
 
-    bool stop = false;
+    bsParseJobRun(&jobs[0]);
 
-    BsNode *n, *o;
+    for(size_t i = 1; i <= ncuts; i++) {
+	if(started[i]) {
+	    pthread_join(threads[i], NULL);
+	} else {
+	    bsParseJobRun(&jobs[i]);
+	}
+    }
 
-    void* feedback1 = callback(dict, node, user, feedback, &stop);
+    /* splice in order, up to the first piece that failed - bsParse() would not have gone further */
+    for(failed = 0; failed < ncuts && !jobs[failed].state.parseError; failed++);
 
-    if(stop) {
-	return node;
+    for(size_t i = 0; i <= ncuts; i++) {
+	if(i <= failed) {
+	    bsAdoptDict(dict, jobs[i].dict);
+	} else {
+	    bsFree(jobs[i].dict);
+	}
     }
 
-    LL_FOREACH_DYNAMIC(node,n) {
-	o = bsNodeWalk(dict, n, user, feedback1, callback);
-	if(o != NULL) {
-	    return o;
-	}
+    /* report against the whole buffer */
+    state = jobs[failed].state;
+    state.start = buf;
+    state.end = buf + len;
+
+    if(state.parseError) {
+	bsLocate(&state, state.current);
     }
 
-    return NULL;
-}
+    free(jobs);
+    free(threads);
+    free(started);
 
-/* run a callback recursively on dictionary, return node where callback stopped the walk */
-BsNode*  bsWalk(BsDict *dict, void* user, BsCallback callback) {
+    return state;
 
-    return bsNodeWalk(dict, dict->root, user, NULL, callback);
+#endif /* BS_THREADS */
 
 }
 
-/* run a callback recursively on node, return linked list that callback permitted */
-LList* bsNodeFilter(LList* list, BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback) {
-
-    bool stop = false;
-    BsNode *n;
+/*
+ * index all unindexed nodes in slabs from @first onwards in one go: one linear pass over
+ * the node store collects them with their hashes, a radix sort puts them in hash order,
+ * and the index takes them from there. Only that much is linear - what the backend makes
+ * of the sorted run is up to it: the hash table fills itself front to back, the red-black
+ * tree still does an insertion per distinct hash, only cheaper ones. Sorting is stable, so nodes
+ * sharing a hash stay in creation order and end up chained the same way BsIndexOps.put
+ * one by one would leave them.
+ */
+static void bsIndexBulk(BsDict *dict, const size_t first) {
 
-    void* feedback1 = callback(dict, node, user, feedback, &stop);
+    BsIndexEntry *entries, *tmp;
+    size_t count = 0;
+    size_t cap = 0;
 
-    if(list == NULL) {
-	list = llCreate();
+    for(size_t i = first; i < dict->slabcount; i++) {
+	cap += dict->slabs[i]->used;
     }
 
-    if(stop) {
-	llAppendItem(list, node);
+    if(cap == 0) {
+	return;
     }
 
-    LL_FOREACH_DYNAMIC(node,n) {
-	bsNodeFilter(list, dict, n, user, feedback1, callback);
+    xmalloc(entries, cap * sizeof(BsIndexEntry));
+    xmalloc(tmp, cap * sizeof(BsIndexEntry));
+
+    for(size_t i = first; i < dict->slabcount; i++) {
+	for(size_t j = 0; j < dict->slabs[i]->used; j++) {
+	    BsNode *node = &dict->slabs[i]->nodes[j];
+	    if(!(node->flags & (BS_UNUSED | BS_INDEXED)) && bsParent(node) != NULL) {
+		entries[count].hash = node->hash;
+		entries[count].node = node;
+		count++;
+	    }
+	}
     }
 
-    return list;
+    dict->indexOps->build(dict, bsSortEntries(entries, tmp, count), count);
+
+    free(entries);
+    free(tmp);
+
 }
 
-/* run a callback recursively on dictionary, return linked list that callback permitted */
-LList* bsFilter(LList* list, BsDict *dict, void* user, BsCallback callback) {
+/* sort index entries by hash: LSD radix sort a byte at a time, skipping bytes all hashes share */
+static BsIndexEntry* bsSortEntries(BsIndexEntry *entries, BsIndexEntry *tmp, const size_t count) {
 
-    if(list == NULL) {
-	list = llCreate();
+    size_t counts[4][256] = { { 0 } };
+    BsIndexEntry *in = entries;
+    BsIndexEntry *out = tmp;
+    BsIndexEntry *swap;
+
+    if(count < 2) {
+	return entries;
     }
 
-    bsNodeFilter(list, dict, dict->root, user, NULL, callback);
-    return list;
+    /* all four histograms in one pass */
+    for(size_t i = 0; i < count; i++) {
+	const uint32_t hash = entries[i].hash;
+	counts[0][hash & 0xff]++;
+	counts[1][(hash >> 8) & 0xff]++;
+	counts[2][(hash >> 16) & 0xff]++;
+	counts[3][hash >> 24]++;
+    }
 
-}
+    for(int pass = 0; pass < 4; pass++) {
 
-/* run a callback recursively on node, passing a BsToken with node's full path as feedback */
-BsNode* bsNodePWalk(BsDict *dict, BsNode *node, void* user, void* feedback, BsCallback callback, bool escape) {
+	size_t *c = counts[pass];
+	const int shift = pass * 8;
+	size_t sum = 0;
 
-    BsToken *ptok = feedback;
-    BsToken tok = { "\0", 0, 0 };
-    bool stop = false;
-    BsNode *n, *o;
-    size_t pl = 0;
+	if(c[(in[0].hash >> shift) & 0xff] == count) {
+	    continue;
+	}
 
-    if(ptok != NULL && ptok->data != NULL && ptok->data[0] != '\0') {
-	pl = ptok->len + 1;
-    } else {
-	/* this way we never give the callback a NULL */
-	pl = 0;
-    }
+	/* counts to bucket offsets */
+	for(int b = 0; b < 256; b++) {
+	    const size_t n = c[b];
+	    c[b] = sum;
+	    sum += n;
+	}
 
-    size_t sl = node->nameLen + pl;
+	for(size_t i = 0; i < count; i++) {
+	    out[c[(in[i].hash >> shift) & 0xff]++] = in[i];
+	}
 
-    /*
-     * twice the name len because we can potentially escape every character,
-     * and we allocate on the stack, so anything in a {} scope is local,
-     * and is gone once we leave the scope, so we can't do two different
-     * stack allocations depending on escape contidion.
-     * this whole idea is dangerous territory anyway.
-     */
-    char name[sl + node->nameLen + 1];
+	swap = in;
+	in = out;
+	out = swap;
 
-    if(pl > 1) {
-	memcpy(name, ptok->data, ptok->len);
-	name[ptok->len]='/';
     }
-    if(sl > 0) {
-	tok.data = name;
-	if(escape) {
-	    size_t enl = bsEscapeStr(node->name, NULL);
 
-	    char ename[enl];
-	    bsEscapeStr(node->name, ename);
-	    /* this also copies the NUL termination... */
-	    memcpy(name + pl, ename, enl);
-	    tok.len = pl + enl - 1;
-	    /* ...but we can never be too careful */
-	    name[tok.len] = '\0';
-	} else {
-	    memcpy(name + pl, node->name, node->nameLen);
-	    name[sl] = '\0';
-	    tok.len = sl;
-	}
-    }
+    return in;
 
-    /* callback uses the path */
-    callback(dict, node, user, &tok, &stop);
+}
 
-    if(stop) {
-	return node;
+/* BS_BULKINDEX: hold off indexing while parsing, return true if the caller should bsIndex() when done */
+static inline bool bsDeferIndex(BsDict *dict) {
+
+    if((dict->flags & (BS_BULKINDEX | BS_NOINDEX)) != BS_BULKINDEX) {
+	return false;
     }
 
-    LL_FOREACH_DYNAMIC(node,n) {
-	/* recursion expands the path */
-	o = bsNodePWalk(dict, n, user, &tok, callback, escape);
-	if(o != NULL) {
-	    return o;
+    dict->flags |= BS_NOINDEX;
+    dict->indexOps = &bsIndexDeferred;
+
+    return true;
+
+}
+
+/* node reindexing callback - used when forcing a reindex */
+static void* bsReindexCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
+
+    if(bsParent(node) != NULL) {
+
+	if (node->flags & BS_INDEXED) {
+	    dict->indexOps->del(dict, node);
 	}
+
+	dict->indexOps->put(dict, node);
+
     }
 
     return NULL;
+
 }
 
-/* same as bsWalk, but every callback is passed a BsToken as feedback, with node's full path */
-BsNode*  bsPWalk(BsDict *dict, void* user, BsCallback callback, bool escape) {
+/* index all unindexed nodes in bulk and enable indexing */
+void bsIndex(BsDict* dict) {
+
+    if(dict != NULL) {
+
+	/* clear BS_NOINDEX flag - child maps chain nodes the index will chain now */
+	if(dict->flags & BS_NOINDEX) {
+	    bsChildMapsFree(dict);
+	    if(dict->index == NULL) {
+		dict->index = dict->indexEngine->create();
+	    }
+	    dict->flags &= ~BS_NOINDEX;
+	    dict->indexOps = dict->indexEngine;
+	}
+
+	bsIndexBulk(dict, 0);
+
+    }
 
-    return bsNodePWalk(dict, dict->root, user, NULL, callback, escape);
 }
 
-/*
- * run a callback recursively on node, return linked list of nodes
- * that callback permitted, callback gets node path. If NULL passed as list,
- * create one, if not - append.
- */
-LList* bsNodePFilter(LList *list, BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback, bool escape) {
+/* force full reindex - but not a full rehash */
+void bsReindex(BsDict *dict) {
 
-    BsToken *ptok = feedback;
-    BsToken tok = { "\0", 0, 0 };
-    bool stop = false;
-    BsNode *n;
-    size_t pl = 0;
+    if(dict != NULL) {
+
+	if(!(dict->flags & BS_NOINDEX)) {
+	    bsWalk(dict, NULL, bsReindexCallback);	    
+	}
 
-    if(ptok != NULL && ptok->data != NULL && ptok->data[0] != '\0') {
-	pl = ptok->len + 1;
-    } else {
-	/* this way we never give the callback a NULL */
-	pl = 0;
     }
+}
 
-    size_t sl = node->nameLen + pl;
+/*
+ * Put BS_PATH_SEP-separated path of given node into out. If out is NULL,
+ * required string lenth (including zero-termination) is returned and no
+ * extraction is done. Otherwise the length should be passed as @outlen,
+ * and path is copied into *out.
+ */
+size_t bsGetPath(BsNode *node, char* out, const size_t outlen) {
 
-    /*
-     * twice the name len because we can potentially escape every character,
-     * and we allocate on the stack, so anything in a {} scope is local,
-     * and is gone once we leave the scope, so we can't do two different
-     * stack allocations depending on escape contidion.
-     * this whole idea is dangerous territory anyway.
-     */
-    char name[sl + node->nameLen + 1];
+    size_t pathlen = 1;
+    char* target = out + outlen - 1;
 
-    if(pl > 1) {
-	memcpy(name, ptok->data, ptok->len);
-	name[ptok->len]='/';
+    if(node == NULL) {
+	return 1;
     }
 
-    if(sl > 0) {
-	tok.data = name;
-	if(escape) {
-	    size_t enl = bsEscapeStr(node->name, NULL);
+    for(BsNode *walker = node; bsParent(walker) != NULL; walker = bsParent(walker)) {
 
-	    char ename[enl];
-	    bsEscapeStr(node->name, ename);
-	    /* this also copies the NUL termination... */
-	    memcpy(name + pl, ename, enl);
-	    tok.len = pl + enl - 1;
-	    /* ...but we can never be too careful */
-	    name[tok.len] = '\0';
-	} else {
-	    memcpy(name + pl, node->name, node->nameLen);
-	    name[sl] = '\0';
-	    tok.len = sl;
+	pathlen += walker->nameLen;
+	if(bsParent(bsParent(walker)) != NULL) {
+	    pathlen++;
 	}
-    }
 
-    /* callback uses the path */
-    callback(dict, node, user, &tok, &stop);
+#if 0
+	if(walker->type == BS_NODE_INSTANCE) {
+	    pathlen += walker->valueLen;
+	    pathlen++;
+	}
+#endif
+	if(out != NULL) {
 
-    if(list == NULL) {
-	list = llCreate();
-    }
 
-    if(stop) {
-	llAppendItem(list, node);
+#if 0
+
+	    if(walker->type == BS_NODE_INSTANCE) {
+		target -= walker->valueLen;
+		memcpy(target, walker->value, walker->valueLen);
+		target--;
+		*target = BS_PATH_SEP;
+	    }
+#endif
+	    char nbuf[INT_STRSIZE + 1];
+	    target -= walker->nameLen;
+	    memcpy(target, bsNameOf(walker, nbuf), walker->nameLen);
+	    if(bsParent(bsParent(walker)) != NULL) {
+		target--;
+		*target = BS_PATH_SEP;
+	    }
+	}
     }
 
-    LL_FOREACH_DYNAMIC(node,n) {
-	/* recursion expands the path */
-	bsNodePFilter(list, dict, n, user, &tok, callback, escape);
+    if(out != NULL) {
+	out[pathlen - 1] = '\0';
     }
 
-    return list;
+    return pathlen;
 
 }
 
-/* run a callback recursively on dictionary, return linked list that callback permitted, callback gets node path */
-LList* bsPFilter(LList* list, BsDict *dict, void* user, BsCallback callback, bool escape) {
+/* escaped version of bsGetPath */
+size_t bsGetEscapedPath(BsNode *node, char* out, const size_t outlen) {
 
-    if(list == NULL) {
-	list = llCreate();
+    size_t pathlen = 1;
+    char* target = out + outlen - 1;
+
+    if(node == NULL) {
+	return 1;
     }
 
-    bsNodePFilter(list, dict, dict->root, user, NULL, callback, escape);
+    for(BsNode *walker = node; bsParent(walker) != NULL; walker = bsParent(walker)) {
 
-    return list;
+	char nbuf[INT_STRSIZE + 1];
+	char *wname = bsNameOf(walker, nbuf);
+	size_t elen = bsEscapeStrn(wname, walker->nameLen, NULL) - 1;
+	char ename[elen + 1];
+	bsEscapeStrn(wname, walker->nameLen, ename);
 
-}
+	pathlen += elen;
 
-/* callback for use with bsFilter, checking if node value contains string */
-void* bsValueContainsCb(BsDict *dict, BsNode *node, void* user, void* feedback, bool* matches) {
+	if(bsParent(bsParent(walker)) != NULL) {
+	    pathlen++;
+	}
 
-    if(node->value != NULL && user != NULL && strstr(node->value, user)) {
-	*matches = true;
-    }
+#if 0
+	if(walker->type == BS_NODE_INSTANCE) {
 
-    return NULL;
+	    size_t evlen = bsEscapeStrn(walker->value, walker->valueLen, NULL) - 1;
+	    char evalue[evlen + 1];
+	    bsEscapeStrn(walker->value, walker->valueLen, evalue);
 
-}
+	    pathlen += evlen;
+	    pathlen++;
 
-/* callback for use with bsFilter, checking if node value contains string */
-void* bsNameContainsCb(BsDict *dict, BsNode *node, void* user, void* feedback, bool* matches) {
+	    if(out != NULL) {
+		target -= evlen;
+		memcpy(target, evalue, evlen);
+		target--;
+		*target = BS_PATH_SEP;
+	    }
 
-    if(node->name != NULL && user != NULL && strstr(node->name, user)) {
-	*matches = true;
+	}
+#endif
+	if(out != NULL) {
+	    target -= elen;
+	    memcpy(target, ename, elen);
+	    if(bsParent(bsParent(walker)) != NULL) {
+		target--;
+		*target = BS_PATH_SEP;
+	    }
+	}
     }
 
-    return NULL;
-
-}
-
-/* print error hint from state structure */
-static void bsErrorHint(BsState *state) {
+    if(out != NULL) {
+	out[pathlen - 1] = '\0';
+    }
 
-	size_t lw = BS_ERRORDUMP_LINEWIDTH;
-	size_t hlw = lw / 2;
-	char *marker = state->linestart;
-	char linebuf[lw + 1];
-	char pointbuf[lw + 1];
-	bool rtrunc = true;
+    return pathlen;
 
+}
 
-	memset(pointbuf, ' ', lw);
-	memset(linebuf, 0, lw + 1);
-	pointbuf[lw] = '\0';
+/* length of a query, and the most segments it can split into in @segmax: one more than it has separators */
+static inline size_t bsQuerySize(const char *qry, size_t *segmax) {
 
-	if(state->linepos > hlw) {
-	    marker += state->linepos - hlw;
-	    pointbuf[hlw] = '^';
-	} else {
-	    pointbuf[state->linepos] = '^';
-	}
+    size_t len;
+    size_t seps = 0;
 
-	for(int i = 0; i < lw ; i++) {
-	    if((*marker == '\0') || chclass(*marker, BF_NLN)) {
-		rtrunc = false;
-		break;
-	    }
-	    linebuf[i] = *(marker++);
+    for(len = 0; qry[len] != '\0'; len++) {
+	if(qry[len] == BS_PATH_SEP) {
+	    seps++;
 	}
+    }
 
-	fprintf(stderr,"\t%s%s%s\n\t%s%s\n",
-	    state->linepos > hlw ? "..." : "", linebuf,
-	    rtrunc ? "..." : "",
-	    state->linepos > hlw ? "   " : "", pointbuf);
+    *segmax = seps + 1;
+    return len;
 
 }
 
-/* print parser error - must be done before the source buffer is freed */
-void bsPrintError(BsState *state) {
-
-    if(state->parseError == BS_PERROR_NONE) {
+/*
+ * unescape the next path segment from *@in into *@out, moving both past it, and fill in @seg.
+ * Separators and whitespace before it are skipped and empty segments are passed over. If @raw
+ * is given, it gets the segment as written, and @wild - whether it has unescaped wildcards.
+ * Returns false when there are no segments left.
+ */
+static inline bool bsQuerySegment(const char **in, char **out, BsPathSeg *seg, BsToken *raw, bool *wild) {
 
-	fprintf(stderr, "No error: parsed successfully\n");
-	return;
+    int c;
 
-    } else {
+    do {
 
-	fprintf(stderr, "Parse error: ");
-	switch (state->parseError) {
-	    case BS_PERROR_EOF:
+	/* skip past the separator and proper whitespace */
+	while(((c = **in) == BS_PATH_SEP || cclass(BF_WSP)) && c != '\0') {
+	    (*in)++;
+	}
 
-		switch(state->scanState) {
-		    case BS_GET_QUOTED:
-			fprintf(stderr, "Unterminated quoted string");
-			restorestate(state);
-			break;
-		    case BS_SKIP_MLCOMMENT:
-			fprintf(stderr, "Unterminated multiline comment");
-			restorestate(state);
-			break;
-		    default:
-			fprintf(stderr, "Unexpected EOF");
-			break;
-		}
+	if(c == '\0') {
+	    return false;
+	}
 
-		break;
-	    case BS_PERROR_UNEXPECTED:
-		fprintf(stderr, "Unexpected character: '%c' (0x%02x)", *state->current, *state->current);
-		break;
-	    case BS_PERROR_LEVEL:
-		restorestate(state);
-		fprintf(stderr, "Unbalanced bracket(s) found");
-		break;
-	    case BS_PERROR_TOKENS:
-		fprintf(stderr, "Too many consecutive identifiers");
-		break;
-	    case BS_PERROR_EXP_ID:
-		restorestate(state);
-		fprintf(stderr, "Expected node name / identifier");
-		break;
-	    case BS_PERROR_UNEXP_ID:
-		fprintf(stderr, "Unexpected node name / identifier");
-		break;
-	    case BS_PERROR_BLOCK:
-		fprintf(stderr, "Unexpected block element");
-		break;
-	    case BS_PERROR_NULL:
-		fprintf(stderr, "Dictionary object is NULL\n");
-		return;
-	    case BS_PERROR_QUOTED:
-		restorestate(state);
-		fprintf(stderr, "Unterminated quoted string");
-		break;
-	    default:
-		fprintf(stderr, "Unexpected parser error 0x%x\n", state->parseError);
+	if(raw != NULL) {
+	    raw->data = (char*)*in;
+	    *wild = false;
 	}
 
-	fprintf(stderr," at line %zd position %zd:\n\n", state->lineno, state->linepos + 1);
-	bsErrorHint(state);
+	seg->name = *out;
 
-    }
+	while((c = **in) != BS_PATH_SEP && c != '\0') {
 
-}
+	    if(c == BS_ESCAPE_CHAR) {
+		c = *(++(*in));
+		if(c == '\0') {
+		    break;
+		}
+		/* an escape sequence gives the control char, anything else - the separator too - stands for itself */
+		if(cclass(BF_ESS)) {
+		    c = esccodes[c];
+		}
+	    } else if(raw != NULL && (c == BS_PATTERN_ANY || c == BS_PATTERN_ONE)) {
+		*wild = true;
+	    }
 
-/* main buffer scanner / lexer state machine */
-static inline void bsScan(BsState *state) {
+	    *((*out)++) = c;
+	    (*in)++;
 
-    size_t ssize;
-    int qchar = BS_QUOTE_CHAR;
-    int c = *state->current;
-    BsToken *tok = &state->tokenCache[state->tokenCount];
+	}
 
-    /*
-     * continue scanning until an event occurs. note that break; is crucial
-     * in some places because we need to check for control characters.
-     */
-    do {
-	/* search for tokens or quoted strings, skip comments, etc. */
-	again: /* short-circuit */
-	switch (state->scanState) {
+	seg->len = *out - seg->name;
 
-	    case BS_SKIP_WHITESPACE:
-		while(cclass(BF_SPC | BF_NLN)) {
-		    c = bsForward(state);
-		}
-		/* we have reached a multiline comment outer character... */
-		if(c == BS_MLCOMMENT_OUT_CHAR) {
-		    /* ...and the next character is the inner multiline comment character */
-		    if(bsPeek(state) == BS_MLCOMMENT_IN_CHAR) {
-			/* save state when entering a 'find closing character' type state */
-			savestate(state);
-			c = bsForward(state);
-			state->scanState = BS_SKIP_MLCOMMENT;
-			goto again;
-		    }
-		    /* ...and the next character is also a multiline comment outer character */
-		    if(bsPeek(state) == BS_MLCOMMENT_OUT_CHAR) {
-			c = bsForward(state);
-			state->scanState = BS_SKIP_COMMENT;
-			goto again;
-		    }
-		}
-		state->scanState = BS_GET_TOKEN;
-		break;
+    } while(seg->len == 0);
 
-	    case BS_GET_TOKEN:
-		tok->data = state->current;
-		tok->len = 0;
-		tok->quoted = 0;
-		/*
-		 * ...and we have a problem. Juniper uses ':' in both names and in values,
-		 * so if we want to parse JSON, we have a conflict, because of the ':' value separator.
-		 */
-//		int flags = BF_TOK | (!!state->tokenCount * BF_EXT);
-		while(cclass(BF_TOK | BF_EXT)) {
-			c = bsForward(state);
-			tok->len++;
-		}
+    if(raw != NULL) {
+	raw->len = *in - raw->data;
+    }
 
-		/* raise a "got token" event if we got anything */
-		if(tok->len > 0) {
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_GOT_TOKEN;
-		    return;
-		}
+    seg->isnum = bsParseOrdinal(seg->name, seg->len, &seg->ord);
+    seg->hash = seg->isnum ? bsOrdinalHash(seg->ord) : xxHash32(seg->name, seg->len);
 
-		break;
+    return true;
 
-	    case BS_GET_QUOTED:
-		ssize = BS_QUOTED_STARTSIZE;
-		tok->len = 0;
-		tok->quoted = ~0;
-		xmalloc(tok->data, ssize + 1);
-		bool captured;
+}
 
-	        nextbatch:
+/*
+ * split a query into path segments, unescaped into @query->names, which needs as many bytes
+ * as the query, @query->segs needing room for as many segments as bsQuerySize() says. Nothing is allocated.
+ */
+static inline void bsQuerySplit(BsQuery *query, const char *qry) {
 
-		while(c != qchar) {
+    const char *in = qry;
+    char *out = query->names;
 
-		    if(cclass(BF_NLN)) {
-			    state->parseEvent = BS_ERROR;
-			    state->parseError = BS_PERROR_QUOTED;
-			    return;
-		    }
+    query->count = 0;
 
-		    if(c == BS_ESCAPE_CHAR) {
-			c = bsForward(state);
-			/* this is  an escape sequence */
-			if(cclass(BF_ESS)) {
-			    /* place the corresponding control char */
-			    tok->data[tok->len] = esccodes[c];
-			    captured = true;
-			}
-		    }
+    while(bsQuerySegment(&in, &out, &query->segs[query->count], NULL, NULL)) {
+	query->count++;
+    }
 
-		    if(captured) {
-			captured = false;
-		    } else {
-			if(c == EOF) {
-			    state->parseEvent = BS_ERROR;
-			    state->parseError = BS_PERROR_EOF;
-			    return;
-			}
-			tok->data[tok->len] = c;
-		    }
-		    c = bsForward(state);
-		    tok->len++;
-		    if(tok->len == ssize) {
-			ssize *= 2;
-			xrealloc(tok->data, tok->data, ssize + 1);
-		    }
-		}
-		
-		c = bsForward(state);
+    /* the path hash from the root - any root, all roots hash the same */
+    query->hash = BS_ROOT_HASH;
+    for(size_t i = 0; i < query->count; i++) {
+	query->hash = BS_MIX_HASH(query->segs[i].hash, query->hash, query->segs[i].len);
+    }
 
-		/* try a multiline string */
-		if(c == BS_ESCAPE_CHAR) {
+}
 
-		    /* skip whitespaces and newlines */
-		    do {
-			savestate(state);
-			c = bsForward(state);
-		    } while(cclass(BF_WSP | BF_NLN));
+/* path hash of @query run from @node: segment hashes mixed in one after another, as nodes are created */
+static inline uint32_t bsQueryHash(const BsQuery *query, const BsNode *node) {
 
-		    /* continue consuming multiline string */
-		    if(c == qchar) {
-			c = bsForward(state);
-			goto nextbatch;
-		    } else {
-			state->parseEvent = BS_ERROR;
-			state->parseError = BS_PERROR_QUOTED;
-			return;
-		    }
-		}
+    uint32_t hash = node->hash;
 
-		tok->data[tok->len] = '\0';
+    if(hash == BS_ROOT_HASH) {
+	return query->hash;
+    }
 
-		/* raise a "got token" event */
-		state->parseEvent = BS_GOT_TOKEN;
-		state->scanState = BS_SKIP_WHITESPACE;
-		return;
+    for(size_t i = 0; i < query->count; i++) {
+	hash = BS_MIX_HASH(query->segs[i].hash, hash, query->segs[i].len);
+    }
 
-	    case BS_SKIP_COMMENT:
-		while(!cclass(BF_NLN)) {
-		    c = bsForward(state);
-		}
-		state->scanState = BS_SKIP_NEWLINE;
-		/* fall-through */
+    return hash;
 
-	    case BS_SKIP_NEWLINE:
-		while(cclass(BF_NLN)) {
-		    c = bsForward(state);
-		}
-		state->scanState = BS_SKIP_WHITESPACE;
-		break;
+}
 
-	    case BS_SKIP_MLCOMMENT:
+/* compile a query for repeated use with bsQueryGet() and bsQueryGetAll(), in any dictionary */
+BsQuery* bsCompileQuery(const char *qry) {
 
-		while(c != BS_MLCOMMENT_OUT_CHAR && c != EOF) {
-		    c = bsForward(state);
-		}
-		if(c == BS_MLCOMMENT_OUT_CHAR) {
-		    if (state->prev == BS_MLCOMMENT_IN_CHAR) {
-			/* end of comment */
-			state->scanState = BS_SKIP_WHITESPACE;
-		    }
-		    /* keep moving on */
-		    c = bsForward(state);
-		} else if (c == EOF) {
-		    state->parseEvent = BS_ERROR;
-		    state->parseError = BS_PERROR_EOF;
-		    return;
-		}
-		break;
+    BsQuery *ret;
+    size_t qlen, segmax;
 
-	    default:
-		state->parseEvent = BS_ERROR;
-		state->parseError = BS_PERROR;
-		return;
+    if(qry == NULL) {
+	return NULL;
+    }
 
-	}
+    qlen = bsQuerySize(qry, &segmax);
 
-	/* if no event raised, check for control characters, raise parser events and move search state accordingly */
-	if(state->parseEvent == BS_NOEVENT) {
+    xcalloc(ret, 1, sizeof(BsQuery));
+    xmalloc(ret->names, qlen + 1);
+    xmalloc(ret->segs, segmax * sizeof(BsPathSeg));
 
-	    switch(c) {
-#ifdef BS_QUOTE1_CHAR
-		case BS_QUOTE1_CHAR:
-#endif
-#ifdef BS_QUOTE2_CHAR
-		case BS_QUOTE2_CHAR:
-#endif
-#ifdef BS_QUOTE3_CHAR
-		case BS_QUOTE3_CHAR:
-#endif
-		case BS_QUOTE_CHAR:
-		    state->scanState = BS_GET_QUOTED;
-		    /* save state when entering a 'find closing character' type state */
-		    savestate(state);
-		    /* because we can have two quotation mark types, we save the one we encountered */
-		    qchar = c;
-		    c = bsForward(state);
-		    goto again;
-#ifdef BS_ENDVAL1_CHAR
-		case BS_ENDVAL1_CHAR:
-#endif
-#ifdef BS_ENDVAL2_CHAR
-		case BS_ENDVAL2_CHAR:
-#endif
-#ifdef BS_ENDVAL3_CHAR
-		case BS_ENDVAL3_CHAR:
-#endif
-#ifdef BS_ENDVAL4_CHAR
-		case BS_ENDVAL4_CHAR:
-#endif
-#ifdef BS_ENDVAL5_CHAR
-		case BS_ENDVAL5_CHAR:
-#endif
-		case BS_ENDVAL_CHAR:
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_GOT_ENDVAL;
-		    bsForward(state);
-		    return;
-		/*
-		 * note: we could minimise the number of cases if we defined event type constants
-		 * as the corresponding characters. So if BS_GOT_BLOCK = BS_STARTBLOCK_CHAR,
-		 * we just have parseEvent = c. This could be used for a fast JSON parser.
-		 */
-		case BS_STARTBLOCK_CHAR:
-		    savestate(state);
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_GOT_BLOCK;
-		    bsForward(state);
-		    return;
-		case BS_ENDBLOCK_CHAR:
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_END_BLOCK;
-		    bsForward(state);
-		    return;
-		case BS_STARTARRAY_CHAR:
-		    savestate(state);
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_GOT_ARRAY;
-		    bsForward(state);
-		    return;
-		case BS_ENDARRAY_CHAR:
-		    state->scanState = BS_SKIP_WHITESPACE;
-		    state->parseEvent = BS_END_ARRAY;
-		    bsForward(state);
-		    return;
-		case BS_COMMENT_CHAR:
-		    state->scanState = BS_SKIP_COMMENT;
-		    c = bsForward(state);
-		    goto again;
-		/* bsForward() _currently_ returns EOF on end, but we still need to handle NUL */
-		case '\0':
-		case EOF:
-		    /* this is a 'legal' end of buffer, as opposed to unexpected EOF */
-		    state->parseEvent = BS_GOT_EOF;
-		    return;
-		default:
-		    if(cclass(BF_ILL)) {
-			state->parseEvent = BS_ERROR;
-			state->parseError = BS_PERROR_UNEXPECTED;
-			return;
-		    }
-		break;
-	    }
-	}
+    bsQuerySplit(ret, qry);
 
-    } while(state->parseEvent == BS_NOEVENT);
+    return ret;
 
-    return;
 }
 
-/*
- * parse the contents of buf into dictionary dict, return last state.
- * a lot of this logic (different token number cases) is to allow consumption
- * of weirder formats like Juniper configuration. There should be a simplified
- * version for JSON which has none of that, and a "native" one that forgoes
- * some of the Juniper oddness.
- */
-BsState bsParse(BsDict *dict, char *buf, const size_t len) {
+/* free a compiled query */
+void bsFreeQuery(BsQuery *query) {
 
-    /* node stack, so we can return n levels up if we created multiple in one go */
-    PST_DECL(nodestack, BsNode*, 16);
+    if(query == NULL) {
+	return;
+    }
 
-    BsNode *head;
-    BsNode *newnode;
-    BsState state;
+    free(query->names);
+    free(query->segs);
+    free(query);
 
-    bsInitState(&state, buf, len);
+}
 
-    if(dict == NULL) {
-	state.parseError = BS_PERROR_NULL;
-	return state;
+/* find a single descendant of @node (root if NULL) by compiled query */
+BsNode* bsQueryGet(BsDict* dict, BsNode *node, const BsQuery *query) {
+
+    if(dict == NULL || query == NULL) {
+	return NULL;
     }
 
-    head = dict->root; /* this is the current node we are appending to */
-    PST_INIT(nodestack);
+    if(node == NULL) {
+	node = dict->root;
+    }
 
-    /* keep parsing until no more data or parser error encountered */
-    while(!state.parseError) {
+    return dict->indexOps->path(dict, node, query->segs, query->count, bsQueryHash(query, node));
 
-	state.parseEvent = BS_NOEVENT;
-	state.parseError = BS_PERROR_NONE;
+}
 
-	/* scan state machine runs until it barfs an event */
-	bsScan(&state);
+/* sort lookups by the top 16 bits of their hash - the order both index backends keep hashes in */
+static BsProbe* bsSortProbes(BsProbe *probes, BsProbe *tmp, const size_t count) {
 
-	/* process parser event */
-	switch(state.parseEvent) {
+    size_t counts[2][256] = { { 0 } };
+    BsProbe *in = probes;
+    BsProbe *out = tmp;
+    BsProbe *swap;
 
-	    /* we got a token or quoted string - increment counter and check if we can handle the count */
-	    case BS_GOT_TOKEN:
+    if(count < 2) {
+	return probes;
+    }
 
-		/* check for node modifiers */
-		if(state.tokenCount == 0 && state.prev == BS_MODIFIER_CHAR) {
-		    /* "inactive" modifier */
-		    if(!strncmp(ts(0), "inactive", tl(0) - 1)) {
-			state.flags |= BS_INACTIVE;
-			state.tokenOffset++;
-		    }
-		}
+    for(size_t i = 0; i < count; i++) {
+	counts[0][(probes[i].hash >> 16) & 0xff]++;
+	counts[1][probes[i].hash >> 24]++;
+    }
 
-		if(++state.tokenCount == BS_MAX_TOKENS) {
-		    /* we can have as many tokens as we want when in an array, add them in batches */
-		    if(head->type == BS_NODE_ARRAY) {
-			for(int i = state.tokenOffset; i < state.tokenCount; i++) {
-			    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, td(i), tl(i));
-			    newnode->flags |= BS_QUOTED_VALUE & tq(i);
-			}
-			tokenreset();
-		    } else{
-			state.parseEvent = BS_ERROR;
-			state.parseError = BS_PERROR_TOKENS;
-		    }
-		}
-		break;
+    for(int pass = 0; pass < 2; pass++) {
 
-	    /* we got start of a block, i.e. '{' */
-	    case BS_GOT_BLOCK:
+	size_t *c = counts[pass];
+	const int shift = 16 + pass * 8;
+	size_t sum = 0;
 
-		/*
-		 * create different node arrangements based on token count,
-		 * note that we push the current parent / head onto the stack,
-		 * so that we can return to it when this block ends, rather than returning
-		 * upwards to some nested node that is obviously not it.
-		 */
+	/* counts to bucket offsets */
+	for(int b = 0; b < 256; b++) {
+	    const size_t n = c[b];
+	    c[b] = sum;
+	    sum += n;
+	}
 
-		/* it's all different for arrays, because ' a b c { something }' means 4 nodes - 3 leaves and a branch member */
-		if(head->type == BS_NODE_ARRAY) {
+	for(size_t i = 0; i < count; i++) {
+	    out[c[(in[i].hash >> shift) & 0xff]++] = in[i];
+	}
 
-		    /* first insert any existing tokens as array leaves */
-		    for(int i = state.tokenOffset; i < state.tokenCount; i++) {
-			newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, td(i), tl(i));
-			newnode->flags |= BS_QUOTED_VALUE & tq(i);
-			newnode->flags |= state.flags;
-		    }
+	swap = in;
+	in = out;
+	out = swap;
 
-		    /* now enter into an unnamed branch which is a new member of the array */
-		    PST_PUSH_GROW(nodestack, head); /* save current position */
-		    newnode = _bsCreateNode(dict, head, BS_NODE_BRANCH, NULL, 0, NULL, 0);
-		    head = newnode;
+    }
 
-		} else {
-		    switch(state.tokenCount - state.tokenOffset) {
-			case 1:
-			    PST_PUSH_GROW(nodestack, head);
-			    /*
-			     * the macros td, tq and tl are defined at the top of this file. They simply
-			     * grab the data, quoted field and len field from the given item in token cache.
-			     */
-			    newnode = _bsCreateNode(dict, head, BS_NODE_BRANCH, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    head = newnode;
-			    break;
-			case 2:
-			    PST_PUSH_GROW(nodestack, head);
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    head = newnode;
-			    break;
-			case 3:
-			    /* or should we swap instance and branch - compare with JunOS */
-			    PST_PUSH_GROW(nodestack, head);
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(2), tl(2), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(2);
-			    head = newnode;			
-			    break;
-			/* unnamed branch? only at root level and only once */
-			case 0:
-			    if(state.tokenCount == 0 && head == dict->root && nodestack_sh == 0) {
-				/* imaginary descent. This allows us to put empty {}s around the whole content */
-				PST_PUSH_GROW(nodestack, head);
-			    /* nope. */
-			    } else {
-				state.parseEvent = BS_ERROR;
-				state.parseError = BS_PERROR_EXP_ID;
-			    }
-			    break;
+    return in;
 
-			default:
-			    break;
-		    }
-		}
-		/* we don't need the tokens anymore */
-		tokenreset();
-		break;
+}
 
-	    /*
-	     * end of block. remaining tokens do not need to be terminated,
-	     * so if we have any, we fall through to endval case. If we have none,
-	     * pop the last branching point off the stack and we're golden.
-	     * without the fall through, this would have to be a duplicate of the endval case.
-	     */
-	    case BS_END_BLOCK:
-
-		if(state.tokenCount == 0) {
-		    /* 
-		     * WOOP WOOP, WIND SHEAR, BANK ANGLE, PULL UP, TOO LOW, TERRAIN, TERRAIN
-		     * we cannot move up the node stack since we are already at the top
-		     */
-		    if(PST_EMPTY(nodestack)) {
-			state.parseEvent = BS_ERROR;
-			state.parseError = BS_PERROR_BLOCK;
-			break;
-		    }
-		    head = PST_POP(nodestack);
-		    break;
-		}
+/*
+ * retrieve entries for @count compiled queries relative to @node (root if NULL) in one go,
+ * into @out, NULL where not found. All path hashes are computed first, and the lookups are
+ * pipelined: while the path of one lookup is confirmed, the hash chain of a lookup
+ * BS_PREFETCH_DISTANCE later is fetched and its first node prefetched, and the index memory
+ * of one another BS_PREFETCH_DISTANCE later is prefetched, so several cache misses are
+ * waited for at once instead of one after another. Indexes that cannot prefetch (the rbt)
+ * are walked in hash order instead, front to back rather than all over the tree.
+ */
+BsNode** bsQueryGetMany(BsDict *dict, BsNode *node, BsQuery **queries, const size_t count, BsNode **out) {
 
-		/* end of block inside an array? nope. */
-		if(head->type == BS_NODE_ARRAY) {
-		    state.parseEvent = BS_ERROR;
-		    state.parseError = BS_PERROR_BLOCK;
-		    break;
-		}
+    const size_t ahead = BS_PREFETCH_DISTANCE;
+    BsProbe *probes, *tmp, *sorted;
 
-		/* fall-through to GOT_ENDVAL */
-	    
-	    /* we encountered an end of value indication like ';' or ',' (JSON) */
-	    case BS_GOT_ENDVAL:
+    if(dict == NULL || queries == NULL || out == NULL || count == 0) {
+	return out;
+    }
 
-		/* arrays are special that way, a single token is a leaf with a value */
-		if(head->type == BS_NODE_ARRAY) {
+    if(node == NULL) {
+	node = dict->root;
+    }
 
-		    switch(state.tokenCount - state.tokenOffset) {
-
-			case 1:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, NULL, 0);
-			    newnode->flags |= state.flags;
-			    newnode->value = td(0);
-			    newnode->valueLen = tl(0);
-			    newnode->flags |= BS_QUOTED_VALUE & tq(0);
-			    break;
-			/* this is only a courtesy thing. array members are always unnamed - we only take the value */
-			case 2:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, td(1), tl(1));
-			    newnode->flags |= BS_QUOTED_VALUE & tq(1);
-			    newnode->flags |= state.flags;
-			    break;
-			/* stray endval character, ignore */
-			case 0:
-			    break;
-			default:
-			    state.parseEvent = BS_ERROR;
-			    state.parseError = BS_PERROR_TOKENS;
-			break;
-		    }
+    const BsIndexOps *ops = dict->indexOps;
 
-		} else {
+    /* no hash chains to walk - nothing to prefetch and nothing to gain from reordering */
+    if(ops->path != bsIndexedPath) {
+	for(size_t i = 0; i < count; i++) {
+	    out[i] = bsQueryGet(dict, node, queries[i]);
+	}
+	return out;
+    }
 
-		    switch(state.tokenCount - state.tokenOffset) {
-
-			case 1:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    break;
-			case 2:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, td(0), tl(0), td(1), tl(1));
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= BS_QUOTED_VALUE & tq(1);
-			    newnode->flags |= state.flags;
-			    break;
-			case 3:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_LEAF, td(2), tl(2), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(2);
-			    break;
-			case 4:
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_LEAF, td(2), tl(2), td(3), tl(3));
-			    newnode->flags |= BS_QUOTED_NAME & tq(2);
-			    newnode->flags |= BS_QUOTED_VALUE & tq(3);
-			    break;
-			/* stray endval character, ignore */
-			case 0:
-			    break;
-
-			/* at least 5 tokens */
-			default:
-
-			    /* too many tokens */
-			    if(state.tokenCount > BS_MAX_TOKENS) {
-
-				state.parseEvent = BS_ERROR;
-				state.parseError = BS_PERROR_TOKENS;
-
-			    } else {
-
-				/*
-				* 5+ consecutive tokens we treat as branch with (n-1) / 2 leaf-value pairs,
-				* if the number is odd, the last leaf has no value.
-				*/
-				newnode = _bsCreateNode(dict, head, BS_NODE_BRANCH, td(0), tl(0), NULL, 0);
-				newnode->flags |= BS_QUOTED_NAME & tq(0);
-				newnode->flags |= state.flags;
-
-				BsNode *tmphead = newnode;
-
-				for(int i = state.tokenOffset + 1; i < state.tokenCount; i++) {
-
-				    if((i + 1) < state.tokenCount) {
-					newnode = _bsCreateNode(dict, tmphead, BS_NODE_LEAF, td(i), tl(i), td(i+1), tl(i+1));
-					newnode->flags |= BS_QUOTED_NAME & tq(i);
-					newnode->flags |= BS_QUOTED_VALUE & tq(i+1);
-					i++;
-				    } else {
-					newnode = _bsCreateNode(dict, tmphead, BS_NODE_LEAF, td(i), tl(i), NULL, 0);
-					newnode->flags |= BS_QUOTED_NAME & tq(i);
-				    }
-				}
+    xmalloc(probes, count * sizeof(BsProbe));
+    xmalloc(tmp, count * sizeof(BsProbe));
 
-			    }
+    for(size_t i = 0; i < count; i++) {
+	probes[i].hash = bsQueryHash(queries[i], node);
+	probes[i].id = i;
+    }
 
-			    break;
-		    }
-		}
+    /*
+     * a backend which can prefetch is best left to it, the queries and results being walked in
+     * order. Otherwise lookups go in hash order, so that each starts where the last one left off
+     */
+    sorted = (ops->prefetch != NULL) ? probes : bsSortProbes(probes, tmp, count);
 
-		/* aftermath of the previous fall-through */
-		if(state.parseEvent == BS_END_BLOCK) {
-		    /* 
-		     * WOOP WOOP, WIND SHEAR, BANK ANGLE, PULL UP, TOO LOW, TERRAIN, TERRAIN
-		     * we cannot move up the node stack since we are already at the top
-		     */
-		    if(PST_EMPTY(nodestack)) {
-			state.parseEvent = BS_ERROR;
-			state.parseError = BS_PERROR_LEVEL;
-			break;
-		    }
-		    head = PST_POP(nodestack);
-		}
+    for(size_t i = 0; i < count + 2 * ahead; i++) {
 
-		tokenreset();
-		break;
+	/* stage one: index memory */
+	if(i < count && ops->prefetch != NULL) {
+	    ops->prefetch(dict->index, sorted[i].hash);
+	}
 
-	    /* array start block i.e. '[' */
-	    case BS_GOT_ARRAY:
+	/* stage two: the hash chain, held in @out until confirmed */
+	if(i >= ahead && i - ahead < count) {
 
-		/* handle nested arrays - same case as GOT_BLOCK in an array */
-		if(head->type == BS_NODE_ARRAY) {
+	    const BsProbe *p = &sorted[i - ahead];
+	    BsNode *n = ops->get(dict->index, p->hash);
 
-		    /* first insert any existing tokens as array leaves */
-		    for(int i = state.tokenOffset; i < state.tokenCount; i++) {
-			newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, td(i), tl(i));
-			newnode->flags |= BS_QUOTED_VALUE & tq(i);
-		    }
+	    if(n != NULL) {
+		BS_PREFETCH(n);
+	    }
 
-		    /* now enter into an unnamed array which is a new member of the upper array */
-		    PST_PUSH_GROW(nodestack, head); /* save current position */
-		    newnode = _bsCreateNode(dict, head, BS_NODE_ARRAY, NULL,0, NULL, 0);
-		    head = newnode;
+	    out[p->id] = n;
 
-		} else {
+	}
 
-		    switch(state.tokenCount - state.tokenOffset) {
-			case 1:
-			    PST_PUSH_GROW(nodestack, head);
-			    newnode = _bsCreateNode(dict, head, BS_NODE_ARRAY, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    head = newnode;
-			    break;
-			case 2:
-			    PST_PUSH_GROW(nodestack, head);
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_ARRAY, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    head = newnode;
-			    break;
-			case 3:
-			    PST_PUSH_GROW(nodestack, head);
-			    newnode = _bsCreateNode(dict, head, BS_NODE_INSTANCE, td(0), tl(0), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(0);
-			    newnode->flags |= state.flags;
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_BRANCH, td(1), tl(1), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(1);
-			    newnode = _bsCreateNode(dict, newnode, BS_NODE_ARRAY, td(2), tl(2), NULL, 0);
-			    newnode->flags |= BS_QUOTED_NAME & tq(2);
-			    head = newnode;
-			    break;
-			/* unnamed array?  nope. */
-			case 0:
-			    state.parseEvent = BS_ERROR;
-			    state.parseError = BS_PERROR_EXP_ID;
-			    break;
-			default:
-			    break;
-		    }
+	/* stage three: confirm the path */
+	if(i >= 2 * ahead) {
 
-		}
+	    const BsProbe *p = &sorted[i - 2 * ahead];
+	    const BsQuery *q = queries[p->id];
+	    BsNode *n = out[p->id];
+
+	    while(n != NULL && !bsPathMatch(n, node, q->segs, q->count)) {
+		n = bsIndexNext(n);
+	    }
+
+	    out[p->id] = n;
+
+	}
+
+    }
+
+    free(probes);
+    free(tmp);
+
+    return out;
+
+}
 
-		tokenreset();
+/*
+ * retrieve entries for @count paths from dictionary root in one go into @out, NULL where not found.
+ * Paths are compiled and looked up BS_BATCH_SIZE at a time, so the compiled queries stay small and warm.
+ */
+BsNode** bsGetMany(BsDict *dict, const char **paths, const size_t count, BsNode **out) {
 
-		break;
+    BsQuery *queries;
+    BsQuery **qptrs;
+    char *names = NULL;
+    BsPathSeg *segs = NULL;
+    size_t namesize = 0, segsize = 0;
+    size_t batch;
 
-	    /* array end block i.e. ']' */
-	    case BS_END_ARRAY:
+    if(dict == NULL || paths == NULL || out == NULL || count == 0) {
+	return out;
+    }
 
-		/* end of arRAY OUTSIDE AN ARRAY?! What are you, some kind of an animal?! */
-		if(head->type != BS_NODE_ARRAY) {
-		    state.parseEvent = BS_ERROR;
-		    state.parseError = BS_PERROR_BLOCK;
-		}
+    batch = min(count, BS_BATCH_SIZE);
+    xcalloc(queries, batch, sizeof(BsQuery));
+    xmalloc(qptrs, batch * sizeof(BsQuery*));
 
-		/*
-		 * We allow some flexibility when constructing arrays. If we reach the end of an array,
-		 * any leftover tokens are added as array leaves. This means that an array can be defined
-		 * as a list of whitespace-separated tokens.
-		 */
-		for(int i = state.tokenOffset; i < state.tokenCount; i++) {
-		    newnode = _bsCreateNode(dict, head, BS_NODE_LEAF, NULL, 0, td(i), tl(i));
-		    newnode->flags |= BS_QUOTED_VALUE & tq(i);
-		}
+    for(size_t base = 0; base < count; base += batch) {
 
-		/* 
-		 * WOOP WOOP, WIND SHEAR, BANK ANGLE, PULL UP, TOO LOW, TERRAIN, TERRAIN
-		 * we cannot move up the node stack since we are already at the top...
-		 * although in this particular case this should not really happen.
-		 */
-		if(PST_EMPTY(nodestack)) {
-		    state.parseEvent = BS_ERROR;
-		    state.parseError = BS_PERROR_BLOCK;
-		    break;
-		}
+	const size_t n = min(batch, count - base);
+	size_t nlen = 0, slen = 0, segmax;
 
-		/* return to last branching point */
-		head = PST_POP(nodestack);
+	/* one block of names and one of segments for the whole batch */
+	for(size_t i = 0; i < n; i++) {
+	    if(paths[base + i] != NULL) {
+		nlen += bsQuerySize(paths[base + i], &segmax);
+		slen += segmax;
+	    }
+	}
 
-		tokenreset();
+	if(nlen + 1 > namesize) {
+	    namesize = nlen + 1;
+	    xrealloc(names, names, namesize);
+	}
 
-		break;
+	if(slen + 1 > segsize) {
+	    segsize = slen + 1;
+	    xrealloc(segs, segs, segsize * sizeof(BsPathSeg));
+	}
 
-	    case BS_GOT_EOF:
-		/* we got an EOF but were left with some tokens. */
-		if(state.tokenCount > 0) {
-		    state.parseEvent = BS_ERROR;
-		    state.parseError = BS_PERROR_EOF;
-		}
-		/* all she wrote */
-		goto done;
-	    case BS_NOEVENT:
-	    case BS_ERROR:
-	    default:
-		break;
+	nlen = slen = 0;
+
+	for(size_t i = 0; i < n; i++) {
+	    qptrs[i] = &queries[i];
+	    queries[i].names = names + nlen;
+	    queries[i].segs = segs + slen;
+	    queries[i].count = 0;
+	    queries[i].hash = 0;
+	    if(paths[base + i] != NULL) {
+		nlen += bsQuerySize(paths[base + i], &segmax);
+		slen += segmax;
+		bsQuerySplit(&queries[i], paths[base + i]);
+	    }
 	}
 
-    }
+	bsQueryGetMany(dict, dict->root, qptrs, n, out + base);
 
-done:
+	/* bsGet() finds nothing for no path */
+	for(size_t i = 0; i < n; i++) {
+	    if(paths[base + i] == NULL) {
+		out[base + i] = NULL;
+	    }
+	}
 
-    /* we should have ended back at the root, if not, we probably have unbalanced brackets */
-    if(state.parseEvent != BS_ERROR && head != dict->root) {
-	state.parseEvent = BS_ERROR;
-	state.parseError = BS_PERROR_LEVEL;
     }
 
-    /* clean up */
-    tokencleanup();
-    PST_FREE(nodestack);
+    free(queries);
+    free(qptrs);
+    free(names);
+    free(segs);
 
-    /* return a copy of the state value so we can check for errors */
-    return state;
+    return out;
 
 }
 
-/* node indexing callback - used when indexing a previously unindexed dictionary */
-static void* bsIndexCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
+/* append all descendants of @node (root if NULL) matching a compiled query to a list, array slices allowed */
+LList* bsQueryGetAll(LList* out, BsDict* dict, BsNode *node, const BsQuery *query) {
 
-    if(node->parent != NULL && !(node->flags & BS_INDEXED)) {
-
-	bsIndexPut(dict, node);
+    if(dict == NULL || query == NULL) {
+	return out;
+    }
 
+    if(node == NULL) {
+	node = dict->root;
     }
 
-    return NULL;
+    return bsPathWalk(out, dict, node, query->segs, query->count);
 
 }
 
-/* node reindexing callback - used when forcing a reindex */
-static void* bsReindexCallback(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
-
-    if(node->parent != NULL) {
-
-	if (node->flags & BS_INDEXED) {
-	    bsIndexDelete(dict->index, node);
-	}
+/*
+ * find a single / last descendant of node based on path, and verify that path matches.
+ * The query is compiled on the stack unless it is unusually long.
+ */
+BsNode* bsNodeGet(BsDict* dict, BsNode *node, const char* qry) {
 
-	bsIndexPut(dict, node);
+    BS_QUERY_DECL(query);
+    BsNode *n;
 
+    if(qry == NULL || node == NULL) {
+	return NULL;
     }
 
-    return NULL;
+    BS_QUERY_SPLIT(query, qry);
+    n = bsQueryGet(dict, node, &query);
+    BS_QUERY_FREE(query);
+
+    return n;
 
 }
 
-/* index all unindexed nodes and enable indexing */
-void bsIndex(BsDict* dict) {
+/* only a shortcut to query the root of the dictionary */
+BsNode* bsGet(BsDict* dict, const char* qry) {
 
-    if(dict != NULL) {
+    return bsNodeGet(dict, dict->root, qry);
+}
 
-	/* clear BS_NOINDEX flag */
-	if(dict->flags & BS_NOINDEX) {
-	    if(dict->index == NULL) {
-		dict->index = bsIndexCreate();
-	    }
-	    dict->flags &= ~BS_NOINDEX;
-	}
+/* append all descendants of node matching path to a list, array slices (from:to) allowed */
+LList* bsNodeGetAll(LList* out, BsDict* dict, BsNode *node, const char* qry) {
 
-	bsWalk(dict, NULL, bsIndexCallback);
+    BS_QUERY_DECL(query);
 
+    if(qry == NULL || node == NULL) {
+	return out;
     }
 
-}
+    BS_QUERY_SPLIT(query, qry);
+    out = bsQueryGetAll(out, dict, node, &query);
+    BS_QUERY_FREE(query);
 
-/* force full reindex - but not a full rehash */
-void bsReindex(BsDict *dict) {
+    return out;
 
-    if(dict != NULL) {
+}
 
-	if(!(dict->flags & BS_NOINDEX)) {
-	    bsWalk(dict, NULL, bsReindexCallback);	    
-	}
+/* only a shortcut to query the root of the dictionary */
+LList* bsGetAll(LList* out, BsDict* dict, const char* qry) {
+
+    return bsNodeGetAll(out, dict, dict->root, qry);
 
-    }
 }
 
 /*
- * Put BS_PATH_SEP-separated path of given node into out. If out is NULL,
- * required string lenth (including zero-termination) is returned and no
- * extraction is done. Otherwise the length should be passed as @outlen,
- * and path is copied into *out.
+ * match name @str against the pattern segment @pat as written, escapes and all: BS_PATTERN_ANY
+ * stands for any string, BS_PATTERN_ONE for any single character. When a character does not
+ * match, the last BS_PATTERN_ANY takes one more character and matching resumes after it.
  */
-size_t bsGetPath(BsNode *node, char* out, const size_t outlen) {
+static inline bool bsGlobMatch(const char *pat, const size_t plen, const char *str, const size_t slen) {
 
-    size_t pathlen = 1;
-    char* target = out + outlen - 1;
+    size_t p = 0, s = 0;
+    size_t star = SIZE_MAX, mark = 0;
+    int c;
 
-    if(node == NULL) {
-	return 1;
-    }
+    while(s < slen) {
 
-    for(BsNode *walker = node; walker->parent != NULL; walker = walker->parent) {
+	if(p < plen) {
 
-	pathlen += walker->nameLen;
-	if(walker->parent->parent != NULL) {
-	    pathlen++;
-	}
+	    c = pat[p];
 
-#if 0
-	if(walker->type == BS_NODE_INSTANCE) {
-	    pathlen += walker->valueLen;
-	    pathlen++;
-	}
-#endif
-	if(out != NULL) {
+	    if(c == BS_ESCAPE_CHAR) {
 
+		/* a trailing escape char escapes nothing */
+		if(p + 1 == plen) {
+		    p++;
+		    continue;
+		}
 
-#if 0
+		c = pat[p + 1];
+		if(cclass(BF_ESS)) {
+		    c = esccodes[c];
+		}
+
+		if(c == str[s]) {
+		    p += 2;
+		    s++;
+		    continue;
+		}
+
+	    } else if(c == BS_PATTERN_ANY) {
+
+		star = p++;
+		mark = s;
+		continue;
+
+	    } else if(c == BS_PATTERN_ONE || c == str[s]) {
+
+		p++;
+		s++;
+		continue;
 
-	    if(walker->type == BS_NODE_INSTANCE) {
-		target -= walker->valueLen;
-		memcpy(target, walker->value, walker->valueLen);
-		target--;
-		*target = BS_PATH_SEP;
-	    }
-#endif
-	    target -= walker->nameLen;
-	    memcpy(target, walker->name, walker->nameLen);
-	    if(walker->parent->parent != NULL) {
-		target--;
-		*target = BS_PATH_SEP;
 	    }
+
+	}
+
+	if(star == SIZE_MAX) {
+	    return false;
 	}
+
+	p = star + 1;
+	s = ++mark;
+
     }
 
-    if(out != NULL) {
-	out[pathlen - 1] = '\0';
+    while(p < plen && (pat[p] == BS_PATTERN_ANY || (pat[p] == BS_ESCAPE_CHAR && p + 1 == plen))) {
+	p++;
     }
 
-    return pathlen;
+    return p == plen;
 
 }
 
-/* escaped version of bsGetPath */
-size_t bsGetEscapedPath(BsNode *node, char* out, const size_t outlen) {
+/*
+ * compile a pattern query for use with bsPatternFind(), in any dictionary. Segments are path
+ * segments as in bsCompileQuery(), except that BS_PATTERN_ANY matches any string and
+ * BS_PATTERN_ONE any single character of a name, and a segment of two BS_PATTERN_ANY
+ * matches any number of levels. Escaped, they stand for themselves.
+ */
+BsPattern* bsCompilePattern(const char *pattern) {
 
-    size_t pathlen = 1;
-    char* target = out + outlen - 1;
+    BsPattern *ret;
+    size_t len, segmax, from, to;
+    const char *in;
+    char *out;
+    bool wild;
 
-    if(node == NULL) {
-	return 1;
+    if(pattern == NULL) {
+	return NULL;
     }
 
-    for(BsNode *walker = node; walker->parent != NULL; walker = walker->parent) {
+    len = bsQuerySize(pattern, &segmax);
 
-	size_t elen = bsEscapeStr(walker->name, NULL) - 1;
-	char ename[elen + 1];
-	bsEscapeStr(walker->name, ename);
+    xcalloc(ret, 1, sizeof(BsPattern));
+    xmalloc(ret->names, len + 1);
+    xmalloc(ret->text, len + 1);
+    xmalloc(ret->segs, segmax * sizeof(BsPathSeg));
+    xmalloc(ret->parts, segmax * sizeof(BsPatternPart));
 
-	pathlen += elen;
+    memcpy(ret->text, pattern, len + 1);
+    in = ret->text;
+    out = ret->names;
 
-	if(walker->parent->parent != NULL) {
-	    pathlen++;
+    while(bsQuerySegment(&in, &out, &ret->segs[ret->count], &ret->parts[ret->count].raw, &wild)) {
+
+	BsPatternPart *part = &ret->parts[ret->count];
+	const char *raw = part->raw.data;
+
+	if(!wild) {
+	    part->type = bsParseSlice(&ret->segs[ret->count], &from, &to) ? BS_PSEG_SLICE : BS_PSEG_NAME;
+	} else if(part->raw.len == 1 && raw[0] == BS_PATTERN_ANY) {
+	    part->type = BS_PSEG_ANY;
+	} else if(part->raw.len == 2 && raw[0] == BS_PATTERN_ANY && raw[1] == BS_PATTERN_ANY) {
+	    part->type = BS_PSEG_DEEP;
+	    /* any depth followed by any depth is just any depth */
+	    if(ret->count > 0 && ret->parts[ret->count - 1].type == BS_PSEG_DEEP) {
+		continue;
+	    }
+	} else {
+	    part->type = BS_PSEG_GLOB;
 	}
 
-#if 0
-	if(walker->type == BS_NODE_INSTANCE) {
+	ret->count++;
 
-	    size_t evlen = bsEscapeStr(walker->value, NULL) - 1;
-	    char evalue[evlen + 1];
-	    bsEscapeStr(walker->value, evalue);
+    }
 
-	    pathlen += evlen;
-	    pathlen++;
+    /* runs of plain names, counted from the end */
+    for(size_t i = ret->count; i > 0; i--) {
 
-	    if(out != NULL) {
-		target -= evlen;
-		memcpy(target, evalue, evlen);
-		target--;
-		*target = BS_PATH_SEP;
-	    }
+	BsPatternPart *part = &ret->parts[i - 1];
 
+	part->run = 0;
+
+	if(part->type == BS_PSEG_NAME) {
+	    part->run = (i < ret->count && ret->parts[i].type == BS_PSEG_NAME) ? ret->parts[i].run + 1 : 1;
 	}
-#endif
-	if(out != NULL) {
-	    target -= elen;
-	    memcpy(target, ename, elen);
-	    if(walker->parent->parent != NULL) {
-		target--;
-		*target = BS_PATH_SEP;
-	    }
-	}
+
     }
 
-    if(out != NULL) {
-	out[pathlen - 1] = '\0';
+    return ret;
+
+}
+
+/* free a compiled pattern */
+void bsFreePattern(BsPattern *pattern) {
+
+    if(pattern == NULL) {
+	return;
     }
 
-    return pathlen;
+    free(pattern->names);
+    free(pattern->text);
+    free(pattern->segs);
+    free(pattern->parts);
+    free(pattern);
 
 }
 
-/* expand escape sequences and produce a clean query trimmed on both ends, matching the bsGetPath output */
-static inline size_t cleanupQuery(char* query) {
+/*
+ * look up the run of @run names starting at pattern segment @i below @node, matching the rest
+ * of the pattern below each node found. The children of a small node are simply looked through,
+ * one name at a time. Otherwise, with a hash chained index the run is one lookup whatever its
+ * length: the path hash leads to a chain holding every node at that path.
+ */
+static void bsPatternNames(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern, const size_t i, const size_t run) {
 
-    size_t slen = 0;
-    char *markerin = query;
-    char *markerout = query;
-    BsToken tok;
+    const BsPathSeg *segs = &pattern->segs[i];
+    LListMember *mb;
+    BsNode *n;
 
-    if(query == NULL) {
-	return 0;
-    }
+    /* a few children are quicker to look through than the index */
+    if(node->childCount < BS_CHILDMAP_MIN) {
 
-    /* iterate through BS_PATH_SEP separated tokens and place them back into the original string, cleaned up */
-    while(unescapeToken(&tok, &markerin, BS_PATH_SEP)) {
-	if(tok.len > 0) {
-	    if(slen > 0) {
-		*(markerout++) = BS_PATH_SEP;
-		slen++;
+	BS_FOREACH_CHILD(node, n) {
+	    if(bsNameMatch(n, segs->name, segs->len, segs->isnum, segs->ord)) {
+		bsPatternWalk(out, dict, n, pattern, i + 1);
 	    }
-	   memcpy(markerout, tok.data, tok.len);
-	    markerout += tok.len;
-	    slen += tok.len;
-	    free(tok.data);
 	}
+
+	return;
+
     }
 
-    /* terminate */
-    *markerout = '\0';
-    /* and return new length */
-    return slen;
-}
+    if(dict->indexOps->path == bsIndexedPath) {
+
+	uint32_t hash = node->hash;
+
+	for(size_t j = 0; j < run; j++) {
+	    hash = BS_MIX_HASH(segs[j].hash, hash, segs[j].len);
+	}
 
-/* return a new string containing cleaned up query */
-static inline char* getCleanQuery(const char* query) {
+	for(n = dict->indexOps->get(dict->index, hash); n != NULL; n = bsIndexNext(n)) {
+	    if(bsPathMatch(n, node, segs, run)) {
+		bsPatternWalk(out, dict, n, pattern, i + run);
+	    }
+	}
 
-    char* cqry;
-    size_t sl;
+	return;
 
-    if(query == NULL || (sl = strlen(query)) == 0) {
-	xmalloc(cqry, 1);
-	cqry[0] = '\0';
-	return cqry;
     }
 
-    xmalloc(cqry, sl + 1);
+    /* otherwise a name at a time, through the child map or member vector if there is one */
+    LList *l = llCreate();
 
-    memcpy(cqry, query, sl);
-    cqry[sl] = '\0';
-    cleanupQuery(cqry);
-    return cqry;
+    bsSegChildren(l, dict, node, segs);
 
-}
+    LL_FOREACH_DYNAMIC(l, mb) {
+	bsPatternWalk(out, dict, mb->value, pattern, i + 1);
+    }
 
-/* compute the compound hash of a query path rooted ad node @root */
-static inline uint32_t bsGetPathHash(BsNode* root, const char* query) {
+    llFree(l);
 
-    uint32_t hash;
-    BsToken tok;
-    char* marker = (char*) query;
+}
 
-    if(root == NULL || query == NULL) {
-	return 0;
-    }
+/*
+ * match pattern segments from @i on below @node, appending matching nodes to @out. Names are
+ * looked up, and only wildcard segments go through the children, so the cost follows what
+ * the pattern reaches, not the size of the dictionary.
+ */
+static void bsPatternWalk(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern, const size_t i) {
 
-    hash = root->hash;
+    const BsPatternPart *part;
+    LListMember *mb;
+    LList *l;
+    BsNode *n;
+    size_t from, to;
 
-    /* iterate over tokens */
-    while(unescapeToken(&tok, &marker, BS_PATH_SEP)) {
-	hash = BS_MIX_HASH(xxHash32(tok.data, tok.len), hash, tok.len);
-	free(tok.data);
+    if(i == pattern->count) {
+	llAppendItem(out, node);
+	return;
     }
 
-    return hash;
+    part = &pattern->parts[i];
 
-}
+    switch(part->type) {
 
-/* find a single / last descendant of node based on path, and verify that path matches */
-BsNode* bsNodeGet(BsDict* dict, BsNode *node, const char* qry) {
+	case BS_PSEG_NAME:
+	    bsPatternNames(out, dict, node, pattern, i, part->run);
+	    break;
 
-    BsToken tok;
-    uint32_t hash;
-    BsNode *n = NULL;
-    char *cqry;
-    char *marker;
+	case BS_PSEG_SLICE:
+
+	    if(node->type != BS_NODE_ARRAY || !bsParseSlice(&pattern->segs[i], &from, &to)) {
+		bsPatternNames(out, dict, node, pattern, i, 1);
+		break;
+	    }
 
-    if(qry != NULL) {
+	    l = llCreate();
+	    bsMemberSlice(l, dict, node, from, to);
 
-	hash = bsGetPathHash(node, qry);
-        cqry = getCleanQuery(qry);
+	    LL_FOREACH_DYNAMIC(l, mb) {
+		bsPatternWalk(out, dict, mb->value, pattern, i + 1);
+	    }
 
-	if(cqry != NULL) {
+	    llFree(l);
+	    break;
 
-	    /* if the dictionary is indexed, search in index */
-	    if(!(dict->flags & BS_NOINDEX)) {
+	case BS_PSEG_GLOB:
 
-		for(n = bsIndexGet(dict->index, hash); n != NULL; n = n->_indexNext) {
-		    BS_GETNP(n, path);
-		    /* getCleanQuery() always produces either a null-terminated string or NULL */
-		    if(!strcmp(cqry, path)) {
-		        free(cqry);
-		        return n;
-		    }
+	    BS_FOREACH_CHILD(node, n) {
+		char nbuf[INT_STRSIZE + 1];
+		if(bsGlobMatch(part->raw.data, part->raw.len, bsNameOf(n, nbuf), n->nameLen)) {
+		    bsPatternWalk(out, dict, n, pattern, i + 1);
 		}
-	    /* otherwise do a naive search */
-	    } else {
+	    }
+	    break;
 
-		LList* l = llCreate();
-		/* we start with the parent node */
-		llAppendItem(l, node);
-		LListMember *mb;
-		LList* m = NULL;
+	case BS_PSEG_ANY:
 
-		marker = (char*)qry;
+	    BS_FOREACH_CHILD(node, n) {
+		bsPatternWalk(out, dict, n, pattern, i + 1);
+	    }
+	    break;
 
-		/* iterate over tokens, moving down the tree as we find children token by token */
-		while((l->count > 0) && unescapeToken(&tok, &marker, BS_PATH_SEP)) {
+	case BS_PSEG_DEEP:
 
-		     /* iterate over all children matching path so far*/
-		    LL_FOREACH_DYNAMIC(l, mb) {
+	    /* no levels at all, or one level and any number below that */
+	    bsPatternWalk(out, dict, node, pattern, i + 1);
+	    BS_FOREACH_CHILD(node, n) {
+		bsPatternWalk(out, dict, n, pattern, i);
+	    }
+	    break;
 
-			 /* append all children matching current token */
-			 m = _bsGetChildren(m, dict, mb->value, tok.data, tok.len);
+	default:
+	    break;
 
-		    }
+    }
 
-		    /* drop the original list */
-		    llFree(l);
+}
 
-		    /* we will now iterate over the deeper list */
-		    l = m;
-		    m = NULL;		    
+/* append all descendants of @node (root if NULL) matching a compiled pattern to a list */
+LList* bsPatternFind(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern) {
 
-		    free(tok.data);
+    if(dict == NULL || pattern == NULL) {
+	return out;
+    }
 
-		}
+    if(node == NULL) {
+	node = dict->root;
+    }
 
-		free(cqry);
+    if(out == NULL) {
+	out = llCreate();
+    }
 
-		if(l->count > 0) {
-		    n = l->_firstChild->value;
-		}
+    bsPatternWalk(out, dict, node, pattern, 0);
 
-		llFree(l);
-		return n;
+    return out;
 
-	    }
+}
 
-	    free(cqry);
+/* append all descendants of node matching a pattern to a list */
+LList* bsNodeFind(LList *out, BsDict *dict, BsNode *node, const char *pattern) {
 
-	}
+    BsPattern *pat;
 
+    if(pattern == NULL || node == NULL) {
+	return out;
     }
 
-    return NULL;
+    pat = bsCompilePattern(pattern);
+    out = bsPatternFind(out, dict, node, pat);
+    bsFreePattern(pat);
+
+    return out;
 
 }
 
-/* only a shortcut to query the root of the dictionary */
-BsNode* bsGet(BsDict* dict, const char* qry) {
+/* only a shortcut to search from the root of the dictionary */
+LList* bsFind(LList *out, BsDict *dict, const char *pattern) {
+
+    return bsNodeFind(out, dict, dict->root, pattern);
 
-    return bsNodeGet(dict, dict->root, qry);
 }
 
 /* public version that calls strlen */
@@ -2673,8 +7430,8 @@ LList* bsGetChildren(LList* out, BsDict* dict, BsNode *parent, const char* name)
 
 
 /*
- * Get parent's n-th child - simple iterative search. Yes, we could have
- * a separate index keyed on child numbers, but do we want that?
+ * Get parent's n-th child - simple iterative search, except for large arrays,
+ * which keep their members in a vector.
  */
 BsNode* bsNthChild(BsDict* dict, BsNode *parent, const unsigned int childno) {
 
@@ -2689,12 +7446,16 @@ BsNode* bsNthChild(BsDict* dict, BsNode *parent, const unsigned int childno) {
 	return NULL;
     }
 
+    if(parent->flags & BS_MEMBERS) {
+	return bsAuxSlot(dict, parent)->members[childno];
+    }
+
     /* children are a doubly linked list, so if we are above half, count from the end */
     if(childno > (parent->childCount / 2)) {
 
 	i = parent->childCount - 1;
 
-	LL_FOREACH_DYNAMIC_REVERSE(parent, n) {
+	BS_FOREACH_CHILD_REVERSE(parent, n) {
 
 	    if(i == childno) {
 		return n;
@@ -2705,7 +7466,7 @@ BsNode* bsNthChild(BsDict* dict, BsNode *parent, const unsigned int childno) {
     /* otherwise count from beginning */
     } else {
 
-	LL_FOREACH_DYNAMIC(parent, n) {
+	BS_FOREACH_CHILD(parent, n) {
 
 	    if(i == childno) {
 		return n;
@@ -2722,28 +7483,26 @@ BsNode* bsNthChild(BsDict* dict, BsNode *parent, const unsigned int childno) {
 /* rename a node and recursively reindex if necessary */
 BsNode* bsRenameNode(BsDict* dict, BsNode* node, const char* newname) {
 
-    if(node != NULL && node->parent != NULL && newname != NULL) {
+    if(node != NULL && bsParent(node) != NULL && newname != NULL) {
 
 	/* no renaming of array members */
-	if(node->parent->type == BS_NODE_ARRAY) {
+	if(bsParent(node)->type == BS_NODE_ARRAY) {
 	    return NULL;
 	}
 
 	/* so we don't strlen twice... */
 	size_t sl = strlen(newname);
+	char nbuf[INT_STRSIZE + 1];
 
 	/* name unchanged */
-	if(!strncmp(newname, node->name, min(node->nameLen, sl))) {
+	if(!strncmp(newname, bsNameOf(node, nbuf), min(node->nameLen, sl))) {
 	    return node;
 	}
 
 	/* generate new name */
-	BsToken tok = { (char*)newname, sl, false };
-	free(node->name);
-	node->name = getTokenData(&tok);
-	node->nameLen = sl;
+	bsSetNodeName(dict, node, newname, sl);
 
-	uint32_t newhash = BS_MIX_HASH(xxHash32(node->name, node->nameLen), node->parent->hash, node->nameLen);
+	uint32_t newhash = BS_MIX_HASH(bsNameHash(node), bsParent(node)->hash, node->nameLen);
 
 	/* no need to rehash in the rare case that hash did not change */
 	if(newhash != node->hash) {
@@ -2767,12 +7526,27 @@ static void *bsDupCallback(BsDict *dict, BsNode *node, void* user, void* feedbac
 
     BsDict *dest = user;
     BsNode* target = feedback;
+    char nbuf[INT_STRSIZE + 1];
+    char *name = NULL;
+    char *value = NULL;
+
+    if(target == NULL) {
+	return NULL;
+    }
+
+    /* copy by length - the source may be zero-copy, so its strings need not be NUL-terminated */
+    if(target->type != BS_NODE_ARRAY) {
+	name = bsNameOf(node, nbuf);
+    }
+    if(node->type == BS_NODE_LEAF) {
+	value = node->value;
+    }
 
-    /* bsCreate is called as opposed to _bsCreate, which takes care of duplicating the name */
-    BsNode* newnode = bsCreateNode(dest, target, node->type, node->name, node->value);
+    BsNode* newnode = bsCreateNodeCopy(dest, target, node->type, name, node->nameLen, value, node->valueLen);
 
+    /* storage flags belong to the destination dictionary */
     if(newnode != NULL) {
-	newnode->flags = node->flags;
+	newnode->flags = (node->flags & ~BS_STORAGE_FLAGS) | (newnode->flags & BS_STORAGE_FLAGS);
     }
 
     return newnode;
@@ -2786,21 +7560,27 @@ BsNode* bsCopyNode(BsDict* dict, BsNode* node, BsNode* newparent, const char* ne
 
     /* temporarily set source node's name to new name */
     char* oldname = node->name;
+    size_t oldlen = node->nameLen;
 
     if(newparent == NULL) {
 	return NULL;
     }
 
-    node->name = (newname != NULL && strncmp(newname, node->name, min(node->nameLen, strlen(newname)))) ?
-		    (char*)newname : oldname;
+    char nbuf[INT_STRSIZE + 1];
+
+    if(newname != NULL && strncmp(newname, bsNameOf(node, nbuf), min(node->nameLen, strlen(newname)))) {
+	node->name = (char*)newname;
+	node->nameLen = strlen(newname);
+    }
 
     /* callback takes care of the deep copy */
     bsNodeWalk(dict, node, dict, newparent, bsDupCallback);
 
     node->name = oldname;
+    node->nameLen = oldlen;
 
     /* hack again - we have no way to grab the duplicate from the callback run, so we grab new parent's last child */
-    return newparent->_lastChild;
+    return bsLastChild(newparent);
 
 }
 
@@ -2808,21 +7588,22 @@ BsNode* bsCopyNode(BsDict* dict, BsNode* node, BsNode* newparent, const char* ne
 BsNode* bsMoveNode(BsDict* dict, BsNode* node, BsNode* newparent, const char* newname) {
 
     size_t sl = 0;
+    char nbuf[INT_STRSIZE + 1];
 
     if(newname != NULL) {
         sl = strlen(newname);
     }
 
     /* will not move root node and will not attach to NULL parent and will not set empty name */
-    if(newparent == NULL || node->parent == NULL) {
+    if(newparent == NULL || bsParent(node) == NULL) {
 	return NULL;
     }
 
     /* if parent is the same, this is a rename */
-    if(node->parent == newparent) {
+    if(bsParent(node) == newparent) {
 
 	/* only rename if new name differs */
-	if(newname != NULL && strncmp(newname, node->name, min(node->nameLen, sl))) {
+	if(newname != NULL && strncmp(newname, bsNameOf(node, nbuf), min(node->nameLen, sl))) {
 	    bsRenameNode(dict, node, newname);
 	}
 
@@ -2830,31 +7611,36 @@ BsNode* bsMoveNode(BsDict* dict, BsNode* node, BsNode* newparent, const char* ne
 
     }
 
-    /* shift about */
-    LL_REMOVE_DYNAMIC(node->parent, node);
-    if(node->parent->childCount > 0) {
-	node->parent->childCount--;
+    /* shift about - the index may need the old parent to let go of the node */
+    BsNode *oldparent = bsParent(node);
+    dict->indexOps->del(dict, node);
+    bsMembersDelete(dict, node);
+    BS_REMOVE_CHILD(oldparent, node);
+    if(oldparent->childCount > 0) {
+	oldparent->childCount--;
     }
-    LL_APPEND_DYNAMIC(newparent, node);
-    node->parent = newparent;
+    BS_APPEND_CHILD(newparent, node);
+    BS_SET_PARENT(node, newparent);
     newparent->childCount++;
+    bsMembersPut(dict, node);
 
     /* change name if necessary */
-    if(newname != NULL && strncmp(newname, node->name, min(node->nameLen, sl))) {
-	BsToken tok = { (char*)newname, sl, false };
-	free(node->name);
-	node->name = getTokenData(&tok);
-	node->nameLen = sl;
+    if(newname != NULL && strncmp(newname, bsNameOf(node, nbuf), min(node->nameLen, sl))) {
+	bsSetNodeName(dict, node, newname, sl);
     }
 
     /* rehash */
-    uint32_t newhash = BS_MIX_HASH(xxHash32(node->name, node->nameLen), node->parent->hash, node->nameLen);
+    uint32_t newhash = BS_MIX_HASH(bsNameHash(node), bsParent(node)->hash, node->nameLen);
 
     /* no need to rehash in the rare case that hash did not change */
     if(newhash != node->hash) {
 	bsNodeWalk(dict, node, NULL, NULL, bsRehashCallback);
+    } else {
+	dict->indexOps->put(dict, node);
     }
 
+    bsAuxBuild(dict, newparent);
+
     return node;
 
 }
@@ -2868,8 +7654,12 @@ BsDict* bsDuplicate(BsDict *source, const char* newname, const uint32_t newflags
 	return NULL;
     }
 
-    /* magic */
-    bsNodeWalk(source, source->root, dest, dest->root, bsDupCallback);
+    BsNode *n;
+
+    /* magic - dest has a root already, copy what is under the source's */
+    BS_FOREACH_CHILD(source->root, n) {
+	bsNodeWalk(source, n, dest, dest->root, bsDupCallback);
+    }
 
     return dest;
 
@@ -38,10 +38,12 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "linked_list.h"
+#include "strpool.h"
 #include "rbt/rbt.h"
 
 /* BsNode / BsDict is a simple hierarchical data parser,
@@ -142,7 +144,8 @@ enum {
     BS_PERROR_LEVEL,		/* unbalanced brackes */
     BS_PERROR_BLOCK,		/* unexpected structure element */
     BS_PERROR_NULL,		/* uninitialised / NULL dictionary */
-    BS_PERROR_QUOTED,		/* unterminated quoted string */
+    BS_PERROR_QUOTED,		/* unterminated or invalid quoted string */
+    BS_PERROR_FILE,		/* input file could not be read */
     BS_PERROR			/* generic / internal / other error */
 };
 
@@ -163,8 +166,30 @@ typedef struct {
     char* data;
     size_t len;
     unsigned int quoted;
+    unsigned int borrowed;	/* set when token data was handed out without copying (BS_ZEROCOPY) */
+    unsigned int inlined;	/* set when token data is short enough to be stored inside the node */
 } BsToken;
 
+/* maximum length of a character list used for vectorised scanning without byte shuffles (SSE2) */
+#define BS_CHARSET_LIST 24
+
+/*
+ * A set of characters (a run of which can be skipped in one go) prepared for vectorised
+ * scanning. Built from chflags[] when the parser state is initialised.
+ */
+typedef struct {
+    uint8_t lo[16];			/* low nibble bucket masks (AVX2) */
+    uint8_t hi[16];			/* high nibble bucket masks (AVX2) */
+    uint8_t min;			/* lowest member */
+    uint8_t max;			/* highest member */
+    uint8_t list[BS_CHARSET_LIST];	/* members - or non-members between min and max if 'stops' (SSE2) */
+    uint8_t listLen;
+    bool stops;				/* list holds non-members */
+    bool nibbles;			/* lo / hi are usable, and so is AVX2 */
+    bool listed;			/* list is usable */
+    bool member[256];			/* the set, for the scalar path */
+} BsCharSet;
+
 /* parser state container */
 typedef struct {
 
@@ -173,17 +198,24 @@ typedef struct {
     int prev;			/* previous character */
     int c;			/* current character */
     char *end;			/* buffer end marker */
-
-    char *linestart;		/* start position of current line */
-    char *slinestart;		/* start position of line when entered state */
+    char *start;		/* buffer start */
+    char *mark;			/* position when entered state */
 
     BsToken tokenCache[BS_MAX_TOKENS]; /* token cache */
+    BsCharSet tokenChars;	/* token characters */
+    BsCharSet spaceChars;	/* whitespace, not counting newlines */
+    BsCharSet quotedChars[4];	/* what a string quoted with BS_QUOTE_CHAR .. BS_QUOTE3_CHAR can contain without special handling */
+
+    char *scratch;		/* buffer for unescaping quoted strings, reused for the whole parse */
+    size_t scratchSize;		/* scratch buffer size */
+    size_t scratchBase;		/* scratch space held by earlier strings of the statement (inPlace only) */
+    bool inPlace;		/* leave quoted strings in the buffer or the scratch buffer, do not copy them */
 
+    /* only the position is tracked while scanning - these are worked out when an error is reported */
+    char *linestart;		/* start position of current line */
     size_t linepos;		/* position in line */
     size_t lineno;		/* line number */
-
-    size_t slinepos;		/* line position when entered state */
-    size_t slineno;		/* line number when entered state */
+    size_t lineBase;		/* lines already consumed before start, when streaming */
 
     /* scanner state */
     unsigned int scanState;
@@ -206,24 +238,71 @@ typedef struct {
 typedef struct BsDict BsDict;
 
 typedef struct BsNode BsNode;
+
+/* index backend, see barser_index.h */
+typedef struct BsIndexOps BsIndexOps;
+
+/* compiled query, see bsCompileQuery() */
+typedef struct BsQuery BsQuery;
+
+/* compiled pattern query, see bsCompilePattern() */
+typedef struct BsPattern BsPattern;
+
+/*
+ * Compact nodes (build with -DBS_COMPACT_NODES): node links are 32-bit handles into
+ * the dictionary's node store instead of pointers, lengths are 32-bit, and there is
+ * no _first back-pointer. This cuts the node from 128 to 88 bytes on 64-bit systems.
+ * Links are followed with bsParent(), bsFirstChild() etc., which work in both modes.
+ * A handle is (slab number << 16 | position in slab) + 1, 0 being NULL.
+ */
+#ifdef BS_COMPACT_NODES
+typedef uint32_t BsNodeRef;
+typedef uint32_t BsLen;
+#else
+typedef BsNode* BsNodeRef;
+typedef size_t BsLen;
+#endif /* BS_COMPACT_NODES */
+
+/*
+ * Names and values shorter than this are stored inside the node itself rather than
+ * on the heap. The space is shared: name first, value right after it if it still fits.
+ */
+#ifndef BS_INLINE_SIZE
+#define BS_INLINE_SIZE 16
+#endif /* BS_INLINE_SIZE */
+
 struct BsNode {
 
     char *name;				/* node name */
     char *value;			/* node value */
 
+#ifdef BS_COMPACT_NODES
+    BsNodeRef _parent;			/* parent of our node, 0 for root */
+    BsNodeRef _firstChild;		/* first child */
+    BsNodeRef _lastChild;		/* last child */
+    BsNodeRef _next;			/* next sibling */
+    BsNodeRef _prev;			/* previous sibling */
+    BsNodeRef _indexNext;		/* singly linked list to hold index chains */
+#else
     BsNode *parent;			/* parent of our node, NULL for root */
 
     LL_HOLDER(BsNode);			/* linked list root */
     LL_MEMBER(BsNode);			/* but also a linked list member */
 
     BsNode* _indexNext;			/* singly linked list to hold index chains */
+#endif /* BS_COMPACT_NODES */
 
-    size_t nameLen;			/* name length */
-    size_t valueLen;			/* value length */
+    BsLen nameLen;			/* name length */
+    BsLen valueLen;			/* value length */
     uint32_t hash;			/* sum of hashes from root to this guy */
+    uint32_t ordinal;			/* array member number, see BS_ORDINAL_NAME */
     unsigned int childCount;		/* fat bastard on benefits and dodgy DLA */
     unsigned int type;			/* node type enum */
     unsigned int flags;			/* flags - quoted name, quoted value, etc. */
+#ifdef BS_COMPACT_NODES
+    uint16_t _slot;			/* position in node store slab - leads to the slab and the dictionary */
+#endif /* BS_COMPACT_NODES */
+    char _inline[BS_INLINE_SIZE];	/* inline storage for short names and values */
 
 #ifdef COLL_DEBUG
     int collcount;			/* temporary, for collision monitoring */
@@ -247,29 +326,190 @@ struct BsNode {
 #define BS_REMOVEDCHLD   (1<<9)		/* descendant of a removed node */
 #define BS_ADDEDCHLD     (1<<10)	/* descendant of an added node */
 #define BS_GENERATEDCHLD (1<<11)	/* descendant of a generated node */
+/* storage flags */
+#define BS_UNUSED	 (1<<12)	/* node store slot was released and is awaiting reuse */
+#define BS_SHARED_NAME	 (1<<13)	/* node name is held in the dictionary's string pool */
+#define BS_SHARED_VALUE	 (1<<14)	/* node value is held in the dictionary's string pool */
+#define BS_BORROWED_NAME (1<<15)	/* node name points into the caller's source buffer */
+#define BS_BORROWED_VALUE (1<<16)	/* node value points into the caller's source buffer */
+#define BS_ORDINAL_NAME	 (1<<17)	/* node is named by its ordinal - name may be NULL until bsGetNodeName() */
+#define BS_INLINE_NAME	 (1<<18)	/* node name is stored in the node's inline buffer */
+#define BS_INLINE_VALUE	 (1<<19)	/* node value is stored in the node's inline buffer */
+#define BS_CHILDMAP	 (1<<20)	/* node has a child map in its (unindexed) dictionary */
+#define BS_MEMBERS	 (1<<21)	/* array node has a member vector in its dictionary */
+
+/* flags describing how a node is stored - these are never copied between nodes */
+#define BS_STORAGE_FLAGS (BS_UNUSED | BS_SHARED_NAME | BS_SHARED_VALUE | BS_BORROWED_NAME | BS_BORROWED_VALUE | BS_ORDINAL_NAME | \
+			  BS_INLINE_NAME | BS_INLINE_VALUE | BS_CHILDMAP | BS_MEMBERS)
 
 #define BS_INHERITED_SHIFT 4		/* distance between parent and inherited flags */
 
 /* set of flags inherited from parent - these are shifted to *CHLD for descendants */
 #define BS_INHERITED_FLAGS (BS_INACTIVE | BS_REMOVED | BS_ADDED | BS_GENERATED)
 
+/*
+ * node store slab. Nodes are handed out from slabs in allocation order,
+ * so a freshly parsed dictionary sits in memory in document order.
+ */
+typedef struct {
+    BsDict *dict;		/* owner */
+    size_t index;		/* position in the dictionary's slab table */
+    size_t size;		/* slab capacity (nodes) */
+    size_t used;		/* nodes handed out so far */
+    BsNode nodes[];		/* the nodes themselves */
+} BsNodeSlab;
+
+/* dictionary memory usage in bytes, see bsMemoryStats() */
+typedef struct {
+    size_t nodes;		/* node store: slabs and slab table */
+    size_t names;		/* node names held on the heap */
+    size_t values;		/* node values held on the heap */
+    size_t strings;		/* string pool (BS_INTERN) */
+    size_t index;		/* index tree nodes */
+    size_t slack;		/* node store space not holding live nodes - included in nodes */
+    size_t collisions;		/* nodes sharing an index entry - chains run through the nodes, so cost nothing extra */
+    size_t total;		/* all of the above */
+} BsMemStats;
+
 /* the dictionary */
 struct BsDict {
     BsNode *root;		/* root node */
     char *name;			/* well, a name */
     void *index;		/* abstract index */
+    const BsIndexOps *indexOps;	/* index backend in use - bsIndexNone while BS_NOINDEX is set (a no-op backend while indexing is deferred) */
+    const BsIndexOps *indexEngine; /* index backend to index with once indexing is on */
+    BsNodeSlab **slabs;		/* node store - slab table */
+    size_t slabcount;		/* number of slabs in use */
+    size_t slabmax;		/* slab table capacity */
+    BsNode *freenodes;		/* released nodes available for reuse, chained via _indexNext */
+    StrPool *strings;		/* string pool for node names and values (BS_INTERN only) */
+    struct BsSource *sources;	/* files parsed in place by bsParseFile() that nodes may still point into */
+    struct BsNodeAux *aux;	/* child maps and member vectors of nodes with many children, by node */
+    size_t auxcount;		/* number of nodes holding any */
+    size_t auxsize;		/* registry capacity */
 #ifdef COLL_DEBUG
     int collcount;		/* collision count */
     int maxcoll;		/* maximum collisions to same entry */
 #endif /* COLL_DEBUG */
     size_t nodecount;		/* total node count. */
+    size_t nodecap;		/* node store capacity (nodes) */
+    BsMemStats mem;		/* memory usage, kept up to date as nodes and strings come and go */
     uint32_t flags;		/* dictionary flags */
 };
 
+/*
+ * streaming parser, see bsParseBegin(). Input is appended to buf and parsed up to the
+ * last complete statement; the rest is kept for the next chunk, so buf only ever holds
+ * one partial statement (and the line it starts on) plus one chunk.
+ */
+typedef struct {
+    BsDict *dict;		/* dictionary being parsed into */
+    BsNode *head;		/* node we are appending to */
+    BsNode **stack;		/* node stack carried between chunks */
+    size_t depth;		/* node stack height */
+    size_t stackSize;		/* node stack capacity */
+    BsState state;		/* parser state carried between chunks */
+    char *buf;			/* carry-over buffer: unparsed input */
+    size_t len;			/* bytes held in buf */
+    size_t offset;		/* where parsing resumes in buf */
+    size_t size;		/* buf capacity */
+    uint32_t dictFlags;		/* dictionary flags to restore when done */
+    struct BsSelect *select;	/* subtrees to keep, see bsParseSelect(), NULL to keep everything */
+} BsParser;
+
+/* node links - use these rather than the fields, which are handles in compact mode */
+#ifdef BS_COMPACT_NODES
+
+/* resolve a handle, using the node it was read from to find the node store */
+static inline BsNode* bsNodeDeref(const BsNode *from, const BsNodeRef ref) {
+
+    if(ref == 0) {
+	return NULL;
+    }
+
+    const BsNodeSlab *slab = (const BsNodeSlab*)((const char*)(from - from->_slot) - offsetof(BsNodeSlab, nodes));
+
+    return &slab->dict->slabs[(ref - 1) >> 16]->nodes[(ref - 1) & 0xffff];
+
+}
+
+/* get the handle of a node */
+static inline BsNodeRef bsNodeRef(const BsNode *node) {
+
+    if(node == NULL) {
+	return 0;
+    }
+
+    const BsNodeSlab *slab = (const BsNodeSlab*)((const char*)(node - node->_slot) - offsetof(BsNodeSlab, nodes));
+
+    return ((slab->index << 16) | node->_slot) + 1;
+
+}
+
+static inline BsNode* bsParent(const BsNode *node)	{ return bsNodeDeref(node, node->_parent); }
+static inline BsNode* bsFirstChild(const BsNode *node)	{ return bsNodeDeref(node, node->_firstChild); }
+static inline BsNode* bsLastChild(const BsNode *node)	{ return bsNodeDeref(node, node->_lastChild); }
+static inline BsNode* bsNextSibling(const BsNode *node)	{ return bsNodeDeref(node, node->_next); }
+static inline BsNode* bsPrevSibling(const BsNode *node)	{ return bsNodeDeref(node, node->_prev); }
+static inline BsNode* bsIndexNext(const BsNode *node)	{ return bsNodeDeref(node, node->_indexNext); }
+
+/* setters - for library internals and index backends */
+#define BS_SET_PARENT(node, n)		((node)->_parent = bsNodeRef(n))
+#define BS_SET_FIRSTCHILD(node, n)	((node)->_firstChild = bsNodeRef(n))
+#define BS_SET_LASTCHILD(node, n)	((node)->_lastChild = bsNodeRef(n))
+#define BS_SET_NEXT(node, n)		((node)->_next = bsNodeRef(n))
+#define BS_SET_PREV(node, n)		((node)->_prev = bsNodeRef(n))
+#define BS_SET_INDEXNEXT(node, n)	((node)->_indexNext = bsNodeRef(n))
+
+#else
+
+static inline BsNode* bsParent(const BsNode *node)	{ return node->parent; }
+static inline BsNode* bsFirstChild(const BsNode *node)	{ return node->_firstChild; }
+static inline BsNode* bsLastChild(const BsNode *node)	{ return node->_lastChild; }
+static inline BsNode* bsNextSibling(const BsNode *node)	{ return node->_next; }
+static inline BsNode* bsPrevSibling(const BsNode *node)	{ return node->_prev; }
+static inline BsNode* bsIndexNext(const BsNode *node)	{ return node->_indexNext; }
+
+#define BS_SET_PARENT(node, n)		((node)->parent = (n))
+#define BS_SET_FIRSTCHILD(node, n)	((node)->_firstChild = (n))
+#define BS_SET_LASTCHILD(node, n)	((node)->_lastChild = (n))
+#define BS_SET_NEXT(node, n)		((node)->_next = (n))
+#define BS_SET_PREV(node, n)		((node)->_prev = (n))
+#define BS_SET_INDEXNEXT(node, n)	((node)->_indexNext = (n))
+
+#endif /* BS_COMPACT_NODES */
+
+/* iterate over children of a node */
+#define BS_FOREACH_CHILD(node, var) \
+    for(var = bsFirstChild(node); var != NULL; var = bsNextSibling(var))
+
+/* iterate over children of a node, last to first */
+#define BS_FOREACH_CHILD_REVERSE(node, var) \
+    for(var = bsLastChild(node); var != NULL; var = bsPrevSibling(var))
+
 /* dictionary flags */
 #define BS_NONE		0		/* also a universal zero constant */
 #define BS_NOINDEX	(1<<0)		/* this dictionary instance does not index nodes */
 #define BS_READONLY	(1<<1)		/* this dictionary becomes read-only once parsed */
+#define BS_INTERN	(1<<2)		/* node names and values are deduplicated in a shared string pool */
+/*
+ * unquoted names and values point straight into the parsed buffer, which must outlive
+ * the dictionary. Such strings are NOT NUL-terminated: use nameLen / valueLen.
+ * Ignored if BS_INTERN is set.
+ */
+#define BS_ZEROCOPY	(1<<3)
+/*
+ * do not index nodes as they are parsed: index them all in one go when parsing is done,
+ * see bsIndex(), which is much faster. Ignored if BS_NOINDEX is set.
+ */
+#define BS_BULKINDEX	(1<<4)
+/* index with the open addressing hash table instead of the red-black tree */
+#define BS_INDEX_HASH	(1<<5)
+
+/* index backends: red-black tree, open addressing hash table, and no index (naive search) */
+extern const BsIndexOps bsIndexRbt;
+extern const BsIndexOps bsIndexHash;
+extern const BsIndexOps bsIndexNone;
 
 /*
  * callback type. parameters: dict, node, user, feedback, cont
@@ -292,16 +532,33 @@ size_t getFileBuf(char **buf, const char *fileName);
 
 /* create and initialise a dictionary */
 BsDict *bsCreate(const char *name, const uint32_t flags);
+/*
+ * create and initialise a dictionary indexed with the given backend, or the one @flags choose
+ * if NULL. With BS_NOINDEX (or &bsIndexNone), the backend is used once bsIndex() is called.
+ */
+BsDict *bsCreateWithIndex(const char *name, const uint32_t flags, const BsIndexOps *ops);
 
 /* create new node in dictionary, attached to parent, of type type with name name and (optionally) value value */
 BsNode* bsCreateNode(BsDict *dict, BsNode *parent, const unsigned int type, const char* name, const char* value);
 
+/*
+ * get node name. Array members are named by number and do not store the name until
+ * it is asked for here - always use this instead of node->name for those.
+ */
+const char* bsGetNodeName(BsDict *dict, BsNode *node);
+
 /* clean up and free dictionary */
 void bsFree(BsDict *dict);
 /* empty the dictionary */
 void bsEmpty(BsDict *dict);
-/* free a single node */
+/*
+ * free a single node's contents - node storage itself belongs to the dictionary.
+ * Pooled strings are only dereferenced, the pool releases them when the dictionary is freed.
+ * Borrowed strings (BS_ZEROCOPY) are left alone.
+ */
 void bsFreeNode(BsNode *node);
+/* get a breakdown of memory used by dictionary */
+BsMemStats bsMemoryStats(BsDict *dict);
 
 /* duplicate a dictionary, give new name to resulting dictionary */
 BsDict* bsDuplicate(BsDict *source, const char* newname, const uint32_t newflags);
@@ -314,6 +571,43 @@ BsNode* bsMoveNode(BsDict* dict, BsNode* node, BsNode* newparent, const char* ne
 
 /* parse contents of a char buffer */
 BsState bsParse(BsDict *dict, char *buf, size_t len);
+/* parse contents of a char buffer holding JSON, with a strict grammar */
+BsState bsParseJson(BsDict *dict, char *buf, const size_t len);
+/* parse contents of a char buffer using multiple threads (BS_THREADS builds), split between top-level statements */
+BsState bsParseParallel(BsDict *dict, char *buf, const size_t len, const int nthreads);
+/*
+ * bsParseEvents() callbacks, any of which may be NULL. Names and values are not NUL-terminated
+ * and only valid during the call: they point into the input, or into a scratch buffer if they
+ * had escapes to undo. Setting *stop ends the parse.
+ */
+typedef struct {
+    /* a branch, instance or array (@type) starts, @name is NULL if it has none */
+    void (*begin)(void *user, const int type, const char *name, const size_t namelen, const uint32_t flags, bool *stop);
+    /* the innermost open branch, instance or array (@type) ends */
+    void (*end)(void *user, const int type, bool *stop);
+    /* a leaf, @value is NULL if it has none */
+    void (*leaf)(void *user, const char *name, const size_t namelen, const char *value, const size_t valuelen, const uint32_t flags, bool *stop);
+    /* an array member */
+    void (*item)(void *user, const char *value, const size_t len, bool *stop);
+} BsEventHandlers;
+
+/* bsParseFile() flags */
+#define BS_FILE_JSON	(1<<0)		/* parse with bsParseJson() */
+#define BS_FILE_COPY	(1<<1)		/* read the file into memory, do not map it */
+/* parse contents of a file, mapped into memory where possible */
+BsState bsParseFile(BsDict *dict, const char *path, const uint32_t flags);
+/* parse contents of a char buffer, keeping only the subtrees under the given paths */
+BsState bsParseSelect(BsDict *dict, char *buf, const size_t len, const char **paths, const size_t count);
+/* parse contents of a char buffer without building a dictionary, reporting nodes to callbacks */
+BsState bsParseEvents(char *buf, const size_t len, const BsEventHandlers *handlers, void *user);
+/* start parsing input that arrives in chunks */
+BsParser* bsParseBegin(BsDict *dict);
+/* parse the next chunk of input, anything after the last complete statement waits for the next one */
+BsState bsParseFeed(BsParser *parser, const char *chunk, const size_t len);
+/* parse what is left of the input, return final state */
+BsState bsParseEnd(BsParser *parser);
+/* free a streaming parser - the state it returned refers to its buffer until then */
+void bsParserFree(BsParser *parser);
 
 /* index all unindexed nodes and enable indexing */
 void bsIndex(BsDict* dict);
@@ -323,12 +617,16 @@ void bsReindex(BsDict *dict);
 
 /* display parser error */
 void bsPrintError(BsState *state);
+/* get line and column (both counted from 1) of @pos in source buffer @buf, e.g. of a zero-copy node's name */
+void bsSourcePos(const char *buf, const char *pos, size_t *line, size_t *column);
 
 /* output dictionary contents to file */
 void bsDump(FILE* fl, BsDict *dict);
 /* recursively output node contents to a file, return number of bytes written */
 int bsDumpNode(FILE* fl, BsNode *node);
 
+/* lookups only read the dictionary: they are safe to run concurrently, as long as nothing changes it meanwhile */
+
 /* retrieve entry from dictionary root based on path */
 BsNode* bsGet(BsDict *dict, const char* qry);
 /* retrieve entry from dictionary node based on path */
@@ -339,11 +637,39 @@ BsNode* bsGetChild(BsDict* dict, BsNode *parent, const char* name);
 LList* bsGetChildren(LList* out, BsDict* dict, BsNode *parent, const char* name);
 /* iteratively grab parent's n-th child (starting from 0!) */
 BsNode* bsNthChild(BsDict* dict, BsNode *parent, const unsigned int childno);
+/* append all descendants of node matching path to a list, array slices (from:to) allowed. Returns out or a new LList* */
+LList* bsNodeGetAll(LList* out, BsDict* dict, BsNode *node, const char* qry);
+/* append all entries matching path from dictionary root to a list, array slices (from:to) allowed */
+LList* bsGetAll(LList* out, BsDict* dict, const char* qry);
+/* compile a query once for repeated use with bsQueryGet() and bsQueryGetAll(), in any dictionary */
+BsQuery* bsCompileQuery(const char *qry);
+/* free a compiled query */
+void bsFreeQuery(BsQuery *query);
+/* retrieve entry by compiled query, relative to node, or dictionary root if NULL */
+BsNode* bsQueryGet(BsDict* dict, BsNode *node, const BsQuery *query);
+/* retrieve entries for @count paths from dictionary root in one go into @out (NULL where not found), return @out */
+BsNode** bsGetMany(BsDict *dict, const char **paths, const size_t count, BsNode **out);
+/* retrieve entries for @count compiled queries relative to node (root if NULL) in one go into @out, return @out */
+BsNode** bsQueryGetMany(BsDict *dict, BsNode *node, BsQuery **queries, const size_t count, BsNode **out);
+/* append all entries matching compiled query, relative to node or root if NULL, to a list - slices allowed */
+LList* bsQueryGetAll(LList* out, BsDict* dict, BsNode *node, const BsQuery *query);
+/* append all descendants of node matching a pattern (wildcards: * any string, ? any char, ** any depth) to a list */
+LList* bsNodeFind(LList *out, BsDict *dict, BsNode *node, const char *pattern);
+/* append all entries matching a pattern from dictionary root to a list */
+LList* bsFind(LList *out, BsDict *dict, const char *pattern);
+/* compile a pattern once for repeated use with bsPatternFind(), in any dictionary */
+BsPattern* bsCompilePattern(const char *pattern);
+/* free a compiled pattern */
+void bsFreePattern(BsPattern *pattern);
+/* append all entries matching compiled pattern, relative to node or root if NULL, to a list */
+LList* bsPatternFind(LList *out, BsDict *dict, BsNode *node, const BsPattern *pattern);
 
 /* run a callback recursively on node, return node where callback stopped the walk */
 BsNode* bsNodeWalk(BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback);
 /* run a callback recursively on dictionary, return node where callback stopped the walk */
 BsNode* bsWalk(BsDict *dict, void* user, BsCallback callback);
+/* run a callback on every node in storage order (no tree walk, feedback is always NULL), return node where callback stopped */
+BsNode* bsForEachNode(BsDict *dict, void* user, BsCallback callback);
 /* run a callback recursively on node, passing a BsToken with node's full path as feedback */
 BsNode* bsNodePWalk(BsDict *dict, BsNode *node, void* user, void *feedback, BsCallback callback, bool escape);
 /* same as bsWalk, but every callback is passed a BsToken as feedback, with node's full path */
@@ -387,6 +713,8 @@ size_t bsGetEscapedPath(BsNode *node, char* out, const size_t outlen);
 size_t bsUnescapeStr(char *str);
 /* place escaped string in @out, return required size (also if @out is 0) including NUL-termination */
 size_t bsEscapeStr(const char *str, char *out);
+/* same as bsEscapeStr, but for a string of known length @len, not necessarily NUL-terminated */
+size_t bsEscapeStrn(const char *str, const size_t len, char *out);
 /* get an escaped duplicate of string src */
 char* bsGetEscapedStr(const char* src);
 
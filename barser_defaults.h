@@ -63,6 +63,9 @@
 #define BS_MODIFIER_CHAR        ':'	/* node modifier suffix */
 
 #define BS_PATH_SEP             '/'	/* path separator for queries */
+#define BS_SLICE_SEP            ':'	/* array slice bounds separator for queries */
+#define BS_PATTERN_ANY          '*'	/* pattern queries: any string, a segment of two: any depth */
+#define BS_PATTERN_ONE          '?'	/* pattern queries: any single character */
 
 /* maximum line width displayed when showing an error */
 #define BS_ERRORDUMP_LINEWIDTH 80
@@ -70,6 +73,21 @@
 /* indent size - if space is chosen, can be say 4 or 8 */
 #define BS_INDENT_WIDTH 4
 
+/* an unindexed dictionary looks children up by name in a hash map once a node has this many */
+#define BS_CHILDMAP_MIN 32
+
+/* arrays with this many members get a member vector for positional access once one is needed */
+#define BS_MEMBERS_MIN 16
+
+/* queries shorter than this are resolved by bsNodeGet() without allocating anything */
+#define BS_QUERY_STACKSIZE 512
+
+/* bsGetMany(): how many lookups ahead index memory is prefetched */
+#define BS_PREFETCH_DISTANCE 8
+
+/* bsGetMany(): how many paths are compiled and looked up at a time */
+#define BS_BATCH_SIZE 4096
+
 /* initial allocation size for a quoted string */
 #define BS_QUOTED_STARTSIZE 50
 
@@ -36,15 +36,65 @@
 #ifndef BARSER_INDEX_H_
 #define BARSER_INDEX_H_
 
-/* create index */
-extern void* bsIndexCreate();
-/* free index */
-extern void bsIndexFree(void* index);
-/* retrieve node from index */
-extern void* bsIndexGet(void *index, const uint32_t hash);
-/* insert node into index */
-extern void bsIndexPut(BsDict *dict, const BsNode* node);
-/* delete node from index */
-extern void bsIndexDelete(void *index, const BsNode* node);
+/* hint the CPU to start loading memory at @addr - it will be needed shortly */
+#if defined(__GNUC__) || defined(__clang__)
+#define BS_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define BS_PREFETCH(addr)
+#endif
+
+/* an unescaped query path segment, see BsIndexOps.path */
+typedef struct {
+    const char *name;		/* segment name, not NUL-terminated */
+    size_t len;			/* name length */
+    uint32_t hash;		/* name hash */
+    uint32_t ord;		/* name as an ordinal, if isnum */
+    bool isnum;			/* name is a canonical decimal number */
+} BsPathSeg;
+
+/* a node to be indexed, see BsIndexOps.build */
+typedef struct {
+    uint32_t hash;		/* node hash */
+    BsNode *node;
+} BsIndexEntry;
+
+/*
+ * index backend. Backends keeping nodes in hash chains (through _indexNext) only
+ * need to implement storage and use BS_INDEX_CHAINED for the lookups.
+ */
+struct BsIndexOps {
+    const char *name;		/* backend name */
+    /* create index */
+    void* (*create)();
+    /* free index - nodes are not freed here, they belong to the dictionary's node store */
+    void (*free)(void* index);
+    /* retrieve the list of nodes with given hash from index */
+    void* (*get)(void *index, const uint32_t hash);
+    /* optional: start loading whatever get() will look at first for @hash, see bsQueryGetMany() */
+    void (*prefetch)(void *index, const uint32_t hash);
+    /* insert node into index */
+    void (*put)(BsDict *dict, BsNode* node);
+    /* insert nodes into index in bulk - @entries are sorted by hash, nodes sharing one in creation order */
+    void (*build)(BsDict *dict, BsIndexEntry *entries, const size_t count);
+    /* delete node from index */
+    void (*del)(BsDict *dict, BsNode* node);
+    /* find a child of @parent by name, @hash being the hash it would have */
+    BsNode* (*child)(BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+    /* append all children of @parent with given name to @out */
+    void (*children)(LList *out, BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+    /* find a node by path under @node, split into @count segments, @hash being the hash it would have */
+    BsNode* (*path)(BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count, const uint32_t hash);
+};
+
+/* lookups through the hash chains returned by BsIndexOps.get */
+BsNode* bsIndexedChild(BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+void bsIndexedChildren(LList *out, BsDict *dict, BsNode *parent, const char *name, const size_t len,
+			const uint32_t hash, const bool isnum, const uint32_t ord);
+BsNode* bsIndexedPath(BsDict *dict, BsNode *node, const BsPathSeg *segs, const size_t count, const uint32_t hash);
+
+#define BS_INDEX_CHAINED .child = bsIndexedChild, .children = bsIndexedChildren, .path = bsIndexedPath
 
 #endif /* BARSER_INDEX_H_ */
@@ -0,0 +1,466 @@
+/* BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Wojciech Owczarek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file   barser_index_hash.c
+ * @date   Fri Oct16 10:12:40 2026
+ *
+ * @brief  An open addressing (Robin Hood) hash table index implementation for barser
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xalloc.h"
+#include "barser.h"
+#include "barser_index.h"
+
+/*
+ * The table holds one slot per distinct hash, the nodes sharing it are chained
+ * through their _indexNext links, the same as with the rbt index. Slots are placed
+ * by the top bits of the hash, so a run sorted by hash fills the table front to back,
+ * and collisions are resolved by linear probing with Robin Hood displacement: a slot
+ * goes to whichever entry is further from home, which keeps probe sequences short
+ * and lets a lookup stop as soon as it meets an entry closer to home than it would be.
+ *
+ * Growing the table is incremental: a new table twice the size takes new entries,
+ * while each insertion or deletion moves a few entries over from the old one,
+ * so no single insertion pays for rehashing everything. Lookups check both tables
+ * until the old one is empty.
+ */
+
+#define BS_HASH_MINBITS		4	/* smallest table: 16 slots */
+#define BS_HASH_MAXLOAD		80	/* grow when this many percent of slots are taken */
+#define BS_HASH_MIGRATE		16	/* old slots to move per insertion or deletion while growing */
+
+/* a table slot */
+typedef struct {
+    uint32_t hash;		/* node hash */
+    uint32_t dist;		/* 1 + distance from home slot, 0 if the slot is empty */
+    BsNode *nodes;		/* nodes with this hash, chained via _indexNext */
+} BsHashSlot;
+
+/* a table */
+typedef struct {
+    BsHashSlot *slots;
+    uint32_t bits;		/* table holds 1 << bits slots */
+    size_t count;		/* slots taken */
+} BsHashTable;
+
+/* the index */
+typedef struct {
+    BsHashTable cur;		/* current table */
+    BsHashTable old;		/* table being emptied into cur while growing, no slots otherwise */
+    size_t cursor;		/* next old slot to move */
+} BsHashIndex;
+
+/* home slot of a hash */
+static inline size_t home(const BsHashTable *table, const uint32_t hash) {
+
+    return (size_t)(((uint64_t)hash << table->bits) >> 32);
+
+}
+
+/* number of slots */
+static inline size_t slotcount(const BsHashTable *table) {
+
+    return (size_t)1 << table->bits;
+
+}
+
+/* find the slot holding @hash, NULL if there is none */
+static inline BsHashSlot* find(const BsHashTable *table, const uint32_t hash) {
+
+    if(table->slots == NULL) {
+	return NULL;
+    }
+
+    const size_t mask = slotcount(table) - 1;
+    size_t i = home(table, hash);
+
+    /* an entry closer to home than we would be means we are not there */
+    for(uint32_t dist = 1; table->slots[i].dist >= dist; dist++) {
+	if(table->slots[i].hash == hash) {
+	    return &table->slots[i];
+	}
+	i = (i + 1) & mask;
+    }
+
+    return NULL;
+
+}
+
+/* place an entry known not to be in the table */
+static inline void place(BsHashTable *table, uint32_t hash, BsNode *nodes) {
+
+    const size_t mask = slotcount(table) - 1;
+    size_t i = home(table, hash);
+    BsHashSlot entry = { .hash = hash, .dist = 1, .nodes = nodes };
+    BsHashSlot tmp;
+
+    while(table->slots[i].dist != 0) {
+	/* take from the rich: whoever is closer to home moves on */
+	if(table->slots[i].dist < entry.dist) {
+	    tmp = table->slots[i];
+	    table->slots[i] = entry;
+	    entry = tmp;
+	}
+	i = (i + 1) & mask;
+	entry.dist++;
+    }
+
+    table->slots[i] = entry;
+    table->count++;
+
+}
+
+/* empty a slot, moving the entries after it one step back towards home */
+static inline void removeslot(BsHashTable *table, BsHashSlot *slot) {
+
+    const size_t mask = slotcount(table) - 1;
+    size_t i = slot - table->slots;
+    size_t j = (i + 1) & mask;
+
+    while(table->slots[j].dist > 1) {
+	table->slots[i] = table->slots[j];
+	table->slots[i].dist--;
+	i = j;
+	j = (j + 1) & mask;
+    }
+
+    table->slots[i].dist = 0;
+    table->slots[i].nodes = NULL;
+    table->count--;
+
+}
+
+/* allocate table slots */
+static inline void alloctable(BsDict *dict, BsHashTable *table, const uint32_t bits) {
+
+    table->bits = bits;
+    table->count = 0;
+    xcalloc(table->slots, slotcount(table), sizeof(BsHashSlot));
+    dict->mem.index += slotcount(table) * sizeof(BsHashSlot);
+
+}
+
+/* move up to @steps entries from the old table to the current one, free the old one when empty */
+static void migrate(BsDict *dict, BsHashIndex *index, size_t steps) {
+
+    BsHashTable *old = &index->old;
+
+    if(old->slots == NULL) {
+	return;
+    }
+
+    const size_t mask = slotcount(old) - 1;
+
+    /*
+     * removing an entry can move the ones after it back, even around the end of
+     * the table, so we go round in circles until the table is empty
+     */
+    while(old->count > 0 && steps > 0) {
+	BsHashSlot *slot = &old->slots[index->cursor];
+	if(slot->dist == 0) {
+	    index->cursor = (index->cursor + 1) & mask;
+	    continue;
+	}
+	place(&index->cur, slot->hash, slot->nodes);
+	removeslot(old, slot);
+	steps--;
+    }
+
+    if(old->count == 0) {
+	dict->mem.index -= slotcount(old) * sizeof(BsHashSlot);
+	xfree(old->slots);
+	index->cursor = 0;
+    }
+
+}
+
+/* make room for @more entries: start growing the table, or grow it at once if @now */
+static void reserve(BsDict *dict, BsHashIndex *index, const size_t more, const bool now) {
+
+    uint32_t bits = index->cur.slots == NULL ? BS_HASH_MINBITS : index->cur.bits;
+
+    while(((size_t)1 << bits) * BS_HASH_MAXLOAD / 100 < index->cur.count + index->old.count + more) {
+	bits++;
+    }
+
+    if(index->cur.slots == NULL) {
+	alloctable(dict, &index->cur, bits);
+	return;
+    }
+
+    if(bits == index->cur.bits) {
+	return;
+    }
+
+    /* one resize at a time */
+    migrate(dict, index, SIZE_MAX);
+
+    index->old = index->cur;
+    index->cursor = 0;
+    alloctable(dict, &index->cur, bits);
+
+    if(now) {
+	migrate(dict, index, SIZE_MAX);
+    }
+
+}
+
+/* find the slot holding @hash in either table */
+static inline BsHashSlot* lookup(BsHashIndex *index, const uint32_t hash, BsHashTable **table) {
+
+    BsHashSlot *ret = find(&index->cur, hash);
+
+    *table = &index->cur;
+
+    if(ret == NULL && index->old.slots != NULL) {
+	ret = find(&index->old, hash);
+	*table = &index->old;
+    }
+
+    return ret;
+
+}
+
+/*
+ * index management wrappers
+ */
+
+/* create index - tables are only allocated once there is something to put in them */
+static void* bsHashCreate() {
+
+    BsHashIndex *ret;
+
+    xcalloc(ret, 1, sizeof(BsHashIndex));
+
+    return ret;
+
+}
+
+/* free index - nodes are not freed here, they belong to the dictionary's node store */
+static void bsHashFree(void* index) {
+
+    BsHashIndex *idx = index;
+
+    free(idx->cur.slots);
+    free(idx->old.slots);
+    free(idx);
+
+}
+
+/* retrieve node list from index */
+static void* bsHashGet(void *index, const uint32_t hash) {
+
+    BsHashTable *table;
+    BsHashSlot *slot = lookup(index, hash, &table);
+
+    if(slot != NULL) {
+	return slot->nodes;
+    }
+
+    return NULL;
+
+}
+
+/* start loading the home slot of @hash */
+static void bsHashPrefetch(void *index, const uint32_t hash) {
+
+    BsHashIndex *idx = index;
+
+    if(idx->cur.slots != NULL) {
+	BS_PREFETCH(&idx->cur.slots[home(&idx->cur, hash)]);
+    }
+
+    if(idx->old.slots != NULL) {
+	BS_PREFETCH(&idx->old.slots[home(&idx->old, hash)]);
+    }
+
+}
+
+/* insert node into index */
+static void bsHashPut(BsDict *dict, BsNode* node) {
+
+    BsHashIndex *index = dict->index;
+    BsHashTable *table;
+    BsHashSlot *slot;
+
+    migrate(dict, index, BS_HASH_MIGRATE);
+
+    slot = lookup(index, node->hash, &table);
+
+    if(slot == NULL) {
+	reserve(dict, index, 1, false);
+	BS_SET_INDEXNEXT(node, NULL);
+	place(&index->cur, node->hash, node);
+	node->flags |= BS_INDEXED;
+	return;
+    }
+
+#ifdef COLL_DEBUG
+    BsNode *n = slot->nodes;
+    BS_GETNP(n, p1);
+    BS_GETNP(node, p2);
+    fprintf(stderr, "*** hash collision: '%s' and '%s' share hash 0x%08x\n", p1, p2, node->hash);
+    dict->collcount++;
+    /*
+     * collision count is maintained in the first node in list,
+     * this is enough for simple hash collision tracking.
+     */
+    n->collcount++;
+    dict->maxcoll = max(dict->maxcoll, n->collcount);
+#endif /* COLL_DEBUG */
+
+    dict->mem.collisions++;
+
+    /* insert at the top of the list */
+    BS_SET_INDEXNEXT(node, slot->nodes);
+    slot->nodes = node;
+    node->flags |= BS_INDEXED;
+
+}
+
+/*
+ * insert nodes into index in bulk. The table is sized for all of them up front,
+ * and with entries sorted by hash, they are placed front to back.
+ */
+static void bsHashBuild(BsDict *dict, BsIndexEntry *entries, const size_t count) {
+
+    BsHashIndex *index = dict->index;
+    BsHashTable *table;
+    BsHashSlot *slot;
+    size_t distinct = 0;
+
+#ifdef COLL_DEBUG
+    /* collisions are reported one by one */
+    for(size_t i = 0; i < count; i++) {
+	bsHashPut(dict, entries[i].node);
+    }
+    return;
+#endif /* COLL_DEBUG */
+
+    for(size_t i = 0; i < count; i++) {
+	if(i == 0 || entries[i].hash != entries[i - 1].hash) {
+	    distinct++;
+	}
+    }
+
+    reserve(dict, index, distinct, true);
+
+    for(size_t i = 0; i < count; ) {
+
+	const uint32_t hash = entries[i].hash;
+
+	slot = lookup(index, hash, &table);
+
+	/* same as bsHashPut(): each node goes on top of the list */
+	for(; i < count && entries[i].hash == hash; i++) {
+
+	    BsNode *node = entries[i].node;
+
+	    if(slot == NULL) {
+		BS_SET_INDEXNEXT(node, NULL);
+		place(&index->cur, hash, node);
+		slot = find(&index->cur, hash);
+	    } else {
+		dict->mem.collisions++;
+		BS_SET_INDEXNEXT(node, slot->nodes);
+		slot->nodes = node;
+	    }
+
+	    node->flags |= BS_INDEXED;
+
+	}
+
+    }
+
+}
+
+/* delete node from index */
+static void bsHashDelete(BsDict *dict, BsNode* node) {
+
+    BsHashIndex *index = dict->index;
+    BsHashTable *table;
+    BsHashSlot *slot;
+    BsNode *n;
+    BsNode *prev = NULL;
+
+    migrate(dict, index, BS_HASH_MIGRATE);
+
+    slot = lookup(index, node->hash, &table);
+
+    if(slot == NULL) {
+	return;
+    }
+
+    for(n = slot->nodes; n != NULL; n = bsIndexNext(n)) {
+
+	if(n == node) {
+	    break;
+	}
+	prev = n;
+
+    }
+
+    if(n == NULL) {
+	return;
+    }
+
+    if(prev == NULL && bsIndexNext(n) == NULL) {
+	/* this slot is now empty, give it up */
+	removeslot(table, slot);
+    } else {
+	/* removing the head of a chain leaves the rest of the chain in place */
+	if(prev == NULL) {
+	    slot->nodes = bsIndexNext(n);
+	} else {
+	    BS_SET_INDEXNEXT(prev, bsIndexNext(n));
+	}
+	dict->mem.collisions--;
+    }
+
+    BS_SET_INDEXNEXT(n, NULL);
+    /* clear indexed flag */
+    n->flags &= ~BS_INDEXED;
+
+}
+
+const BsIndexOps bsIndexHash = {
+    .name	= "hash",
+    .create	= bsHashCreate,
+    .free	= bsHashFree,
+    .get	= bsHashGet,
+    .prefetch	= bsHashPrefetch,
+    .put	= bsHashPut,
+    .build	= bsHashBuild,
+    .del	= bsHashDelete,
+    BS_INDEX_CHAINED
+};
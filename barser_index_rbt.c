@@ -40,40 +40,29 @@
 #include "rbt/rbt.h"
 #include "xalloc.h"
 #include "barser.h"
+#include "barser_index.h"
 
 /*
  * index management wrappers for rbt
  */
 
 /* create index */
-void* bsIndexCreate() {
+static void* bsRbtCreate() {
 
     return rbCreate();
 
 }
 
-static void bsIndexFreeCallback(void* head) {
+/* free index - nodes are not freed here, they belong to the dictionary's node store */
+static void bsRbtFree(void* index) {
 
-    BsNode* node = head;
-    BsNode* tmp;
-    while(node != NULL) {
-	tmp = node;
-	node = node->_indexNext;
-	bsFreeNode(tmp);
-    }
-
-}
-
-/* free index */
-void bsIndexFree(void* index) {
-
-    ((RbTree*)index)->freeCallback = bsIndexFreeCallback;
+    ((RbTree*)index)->freeCallback = NULL;
     rbFree(index);
 
 }
 
 /* retrieve node list from index */
-void* bsIndexGet(void *index, const uint32_t hash) {
+static void* bsRbtGet(void *index, const uint32_t hash) {
 
     RbNode *ret = rbSearch(((RbTree*)index)->root, hash);
 
@@ -86,7 +75,7 @@ void* bsIndexGet(void *index, const uint32_t hash) {
 }
 
 /* insert node into index */
-void bsIndexPut(BsDict *dict, BsNode* node) {
+static void bsRbtPut(BsDict *dict, BsNode* node) {
 
     /* rbInsert returns new tree node on insertion, or existing node if key exists */
     RbNode* inode = rbInsert((RbTree*)(dict->index), node->hash);
@@ -114,17 +103,75 @@ void bsIndexPut(BsDict *dict, BsNode* node) {
     }
 #endif /* COLL_DEBUG */
 
+    if(inode->value == NULL) {
+	dict->mem.index += sizeof(RbNode);
+    } else {
+	dict->mem.collisions++;
+    }
+
     /* insert at the top of the list */
-    node->_indexNext = inode->value;
+    BS_SET_INDEXNEXT(node, inode->value);
     inode->value = node;
     node->flags |= BS_INDEXED;
 
 }
 
+/*
+ * insert nodes into index in bulk. Entries come sorted by hash, so each index node
+ * is looked up once for all the nodes sharing its hash, and the tree grows in key
+ * order, only ever descending its rightmost path, which stays in cache. This is still
+ * an rbInsert() per distinct hash, so O(n log n) - the tree is not built bottom-up.
+ */
+static void bsRbtBuild(BsDict *dict, BsIndexEntry *entries, const size_t count) {
+
+    RbNode *inode;
+    BsNode *node;
+
+#ifdef COLL_DEBUG
+    /* collisions are reported one by one */
+    for(size_t i = 0; i < count; i++) {
+	bsRbtPut(dict, entries[i].node);
+    }
+    return;
+#endif /* COLL_DEBUG */
+
+    for(size_t i = 0; i < count; ) {
+
+	const uint32_t hash = entries[i].hash;
+
+	inode = rbInsert((RbTree*)(dict->index), hash);
+
+	if(inode == NULL) {
+	    fprintf(stderr, "*** %s(): dictionary \"%s\", rbInsert() returned NULL, this should not happen, index is broken ***\n",
+		    __func__, dict->name);
+	    exit(EXIT_ALLOCERR);
+	}
+
+	/* same as bsRbtPut(): each node goes on top of the list */
+	for(; i < count && entries[i].hash == hash; i++) {
+
+	    node = entries[i].node;
+
+	    if(inode->value == NULL) {
+		dict->mem.index += sizeof(RbNode);
+	    } else {
+		dict->mem.collisions++;
+	    }
+
+	    BS_SET_INDEXNEXT(node, inode->value);
+	    inode->value = node;
+	    node->flags |= BS_INDEXED;
+
+	}
+
+    }
+
+}
+
 /* delete node from index */
-void bsIndexDelete(void *index, BsNode* node) {
+static void bsRbtDelete(BsDict *dict, BsNode* node) {
 
-    RbTree *tree = index;
+    RbTree *tree = dict->index;
     BsNode *n;
     BsNode *prev = NULL;
 
@@ -132,7 +179,7 @@ void bsIndexDelete(void *index, BsNode* node) {
 
     if(inode != NULL) {
 
-	for(n = inode->value; n != NULL; n = n->_indexNext) {
+	for(n = inode->value; n != NULL; n = bsIndexNext(n)) {
 
 	    if(n == node) {
 		break;
@@ -143,14 +190,21 @@ void bsIndexDelete(void *index, BsNode* node) {
 
 	if(n != NULL) {
 
-	    if(prev == NULL) {
+	    if(prev == NULL && bsIndexNext(n) == NULL) {
 		/* this index node is now empty, delete it */
 		rbDeleteNode(tree, inode);
+		dict->mem.index -= sizeof(RbNode);
 	    } else {
-		prev->_indexNext = n->_indexNext;
+		/* removing the head of a chain leaves the rest of the chain in place */
+		if(prev == NULL) {
+		    inode->value = bsIndexNext(n);
+		} else {
+		    BS_SET_INDEXNEXT(prev, bsIndexNext(n));
+		}
+		dict->mem.collisions--;
 	    }
 
-	    n->_indexNext = NULL;
+	    BS_SET_INDEXNEXT(n, NULL);
 	    /* clear indexed flag */
 	    n->flags &= ~BS_INDEXED;
 
@@ -159,3 +213,14 @@ void bsIndexDelete(void *index, BsNode* node) {
     }
 
 }
+
+const BsIndexOps bsIndexRbt = {
+    .name	= "rbt",
+    .create	= bsRbtCreate,
+    .free	= bsRbtFree,
+    .get	= bsRbtGet,
+    .put	= bsRbtPut,
+    .build	= bsRbtBuild,
+    .del	= bsRbtDelete,
+    BS_INDEX_CHAINED
+};
@@ -41,13 +41,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h> /* getopt */
+#include <sys/stat.h>
 
 #include "xalloc.h"
 
 
 #include "barser.h"
+#include "barser_index.h"
 
 #define QUERYCOUNT 20000
+#define SELECTMAX 16
 
 struct sample {
     BsNode* node;
@@ -99,21 +102,117 @@ static void* filtercb(BsDict *dict, BsNode *node, void* user, void* feedback, bo
 
 }
 
+/* count nodes walked */
+static void* countcb(BsDict *dict, BsNode *node, void* user, void* feedback, bool* stop) {
+
+    size_t *counter = user;
+
+    *counter = *counter + 1;
+
+    return NULL;
+
+}
+
+/* bsParseEvents() handlers: count what would have been built */
+static void evbegin(void *user, const int type, const char *name, const size_t namelen, const uint32_t flags, bool *stop) {
+    size_t *count = user;
+    count[0]++;
+}
+
+static void evleaf(void *user, const char *name, const size_t namelen, const char *value, const size_t valuelen, const uint32_t flags, bool *stop) {
+    size_t *count = user;
+    count[1]++;
+}
+
+static void evitem(void *user, const char *value, const size_t len, bool *stop) {
+    size_t *count = user;
+    count[2]++;
+}
+
+/* get all @paths from @dict, return how many were found and the time it took in @delta */
+static int fetchPaths(BsDict *dict, char **paths, const int count, unsigned long long *delta) {
+
+    DUR_INIT(fetch);
+    BsNode *node;
+    int found = 0;
+#ifdef COLL_DEBUG
+    bool hadit = false;
+#endif /* COLL_DEBUG */
+
+    DUR_START(fetch);
+    for(int i = 0; i < count; i++) {
+	node = bsGet(dict, paths[i]);
+	if(node != NULL) {
+	    found++;
+	}
+#ifdef COLL_DEBUG
+	else {
+	    if(!hadit) {
+		fprintf(stderr, "\n");
+	    }
+	    fprintf(stderr, "* Node not found: \"%s\"\n", paths[i]);
+	    hadit = true;
+	}
+#endif /* COLL_DEBUG */
+    }
+    DUR_END(fetch);
+
+    *delta = fetch_delta;
+    return found;
+
+}
+
+/* fetch nodes by compiled queries, return number found and time taken in @delta */
+static int fetchQueries(BsDict *dict, BsQuery **queries, const int count, unsigned long long *delta) {
+
+    DUR_INIT(fetch);
+    int found = 0;
+
+    DUR_START(fetch);
+    for(int i = 0; i < count; i++) {
+	if(bsQueryGet(dict, NULL, queries[i]) != NULL) {
+	    found++;
+	}
+    }
+    DUR_END(fetch);
+
+    *delta = fetch_delta;
+    return found;
+
+}
+
 static void usage() {
 
     fprintf(stderr, "\nbarser_test (c) 2018: Wojciech Owczarek, a flexible hierarchical configuration parser\n\n"
-	   "usage: barser_test <-f filename> [-q query] [-Q] [-N NUMBER] [-p] [-d] [-X] [-x] [-r]\n"
+	   "usage: barser_test <-f filename> [-q query] [-A query] [-P pattern] [-Q] [-B] [-N NUMBER] [-p] [-d] [-X] [-x] [-b] [-H] [-r] [-i] [-z] [-j] [-t THREADS] [-s BLOCKSIZE] [-m] [-e] [-S PATH]\n"
 	   "\n"
 	   "-f filename     Filename to read data from (use \"-\" to read from stdin)\n"
 	   "-q query        Retrieve nodes based on query and dump to stdout\n"
+	   "-A query        Retrieve all nodes matching query with bsGetAll() and dump them to stdout,\n"
+	   "                array slices allowed, such as /array/10:20\n"
+	   "-P pattern      Retrieve all nodes matching pattern with bsFind() and dump them to stdout, and time\n"
+	   "                a walk over the whole dictionary for comparison. Wildcards: * any string, ? any\n"
+	   "                character, ** any depth, such as /interfaces/*/unit/*/family/inet\n"
 	   "-Q              Test random node fetch\n"
+	   "-B              Also fetch the -Q paths in one batch with bsGetMany(), and compare\n"
 	   "-N NUMBER       Number of nodes to fetch (-Q), default: min(%d, nodecount)\n"
 	   "-p              Dump parsed data to stdout\n"
 	   "-d              Test dictionary duplication\n"
 	   "-X              Build an unindexed dictionary\n"
 	   "-x              Build an unindexed dictionary, but index it after parsing\n"
+	   "-b              Index in bulk when parsing is done (BS_BULKINDEX)\n"
+	   "-H              Index with the hash table instead of the red-black tree (BS_INDEX_HASH)\n"
 	   "-r              Build index if unindexed and reindex\n"
-	   "\n", QUERYCOUNT);
+	   "-i              Intern node names and values in a shared string pool\n"
+	   "-z              Zero-copy: reference unquoted strings in the input buffer\n"
+	   "-j              Parse as JSON with bsParseJson(), and compare with bsParse() on the same data\n"
+	   "-t THREADS      Parse with bsParseParallel() using THREADS threads, 0 for one per CPU (make threads)\n"
+	   "-s BLOCKSIZE    Stream the input through bsParseFeed() in blocks of BLOCKSIZE bytes instead of loading it\n"
+	   "-m              Parse the file in place with bsParseFile(), and compare with loading it and parsing with bsParse()\n"
+	   "-e              Also scan the data with bsParseEvents(), building nothing, and compare\n"
+	   "-S PATH         Parse with bsParseSelect(), keeping only what is under PATH, and compare with bsParse().\n"
+	   "                Can be given up to %d times\n"
+	   "\n", QUERYCOUNT, SELECTMAX);
 
 }
 
@@ -129,16 +228,31 @@ int main(int argc, char **argv) {
 
     char* filename = NULL;
     char* qry = NULL;
+    char* allqry = NULL;
+    char* pattern = NULL;
     bool duplicate = false;
     bool dump = false;
     bool randomquery = false;
+    bool batch = false;
     bool unindexed = false;
     bool postindex = false;
+    bool bulkindex = false;
+    bool hashindex = false;
     bool reindex = false;
+    bool intern = false;
+    bool zerocopy = false;
+    bool json = false;
+    int threads = 0;
+    size_t blocksize = 0;
+    bool mapfile = false;
+    bool events = false;
+    const char *selpaths[SELECTMAX];
+    size_t selcount = 0;
+    BsParser *parser = NULL;
     uint32_t querycount = QUERYCOUNT;
 
 
-	while ((c = getopt(argc, argv, "?hf:q:QN:pdXxr")) != -1) {
+	while ((c = getopt(argc, argv, "?hf:q:A:P:QBN:pdXxbHrizjt:s:meS:")) != -1) {
 
 	    switch(c) {
 		case 'f':
@@ -147,9 +261,18 @@ int main(int argc, char **argv) {
 		case 'q':
 		    qry = optarg;
 		    break;
+		case 'A':
+		    allqry = optarg;
+		    break;
+		case 'P':
+		    pattern = optarg;
+		    break;
 		case 'Q':
 		    randomquery = true;
 		    break;
+		case 'B':
+		    batch = true;
+		    break;
 		case 'N':
 		    querycount = atoi(optarg);
 		    break;
@@ -165,9 +288,46 @@ int main(int argc, char **argv) {
 		case 'x':
 		    postindex = true;
 		    break;
+		case 'b':
+		    bulkindex = true;
+		    break;
+		case 'H':
+		    hashindex = true;
+		    break;
 		case 'r':
 		    reindex = true;
 		    break;
+		case 'i':
+		    intern = true;
+		    break;
+		case 'z':
+		    zerocopy = true;
+		    break;
+		case 'j':
+		    json = true;
+		    break;
+		case 't':
+		    threads = atoi(optarg);
+		    if(threads <= 0) {
+			threads = sysconf(_SC_NPROCESSORS_ONLN);
+		    }
+		    break;
+		case 's':
+		    blocksize = atol(optarg);
+		    break;
+		case 'm':
+		    mapfile = true;
+		    break;
+		case 'e':
+		    events = true;
+		    break;
+		case 'S':
+		    if(selcount == SELECTMAX) {
+			fprintf(stderr, "\nError: too many paths given\n");
+			return -1;
+		    }
+		    selpaths[selcount++] = optarg;
+		    break;
 		case '?':
 		case 'h':
 		default:
@@ -192,29 +352,100 @@ int main(int argc, char **argv) {
 	exit(-1);
     }
 
-    fprintf(stderr, "Loading \"%s\" into memory... ", filename);
-    fflush(stderr);
+    /* every dictionary we parse into is created the same way */
+    const uint32_t flags = (unindexed ? BS_NOINDEX : BS_NONE) | (intern ? BS_INTERN : BS_NONE) |
+			(zerocopy ? BS_ZEROCOPY : BS_NONE) | (bulkindex ? BS_BULKINDEX : BS_NONE) |
+			(hashindex ? BS_INDEX_HASH : BS_NONE);
 
-    DUR_START(test);
-    len = getFileBuf(&buf, filename);
+    BsDict *dict = bsCreate("test", flags);
+    BsState state;
 
-    if(len <= 0 || buf == NULL) {
-	fprintf(stderr, "Error: could not read input file\n");
-	return -1;
-    }
-    DUR_END(test);
-    fprintf(stderr, "done.\n");
+    /* streaming: reading is part of parsing, so it is all timed as parsing */
+    if(blocksize > 0) {
+
+	FILE *fl = strncmp(filename, "-", 1) ? fopen(filename, "r") : stdin;
+	char *block;
+	size_t got;
 
-    fprintf(stderr, "Loaded %zu bytes in %s, %.03f MB/s\n",
+	if(fl == NULL) {
+	    fprintf(stderr, "Error: could not read input file\n");
+	    return -1;
+	}
+
+	fprintf(stderr, "Streaming \"%s\" in %zu byte blocks... ", filename, blocksize);
+	fflush(stderr);
+
+	xmalloc(block, blocksize);
+	len = 0;
+
+	DUR_START(test);
+	parser = bsParseBegin(dict);
+	while((got = fread(block, 1, blocksize, fl)) > 0) {
+	    len += got;
+	    state = bsParseFeed(parser, block, got);
+	    if(state.parseError) {
+		break;
+	    }
+	}
+	state = bsParseEnd(parser);
+
+	free(block);
+	if(fl != stdin) {
+	    fclose(fl);
+	}
+
+    /* no load phase: the file is read as it is parsed */
+    } else if(mapfile) {
+
+	struct stat st;
+
+	if(stat(filename, &st) < 0) {
+	    fprintf(stderr, "Error: could not read input file\n");
+	    return -1;
+	}
+
+	len = st.st_size;
+
+	fprintf(stderr, "Parsing \"%s\" in place... ", filename);
+	fflush(stderr);
+
+	DUR_START(test);
+	state = bsParseFile(dict, filename, json ? BS_FILE_JSON : BS_NONE);
+
+    } else {
+
+	fprintf(stderr, "Loading \"%s\" into memory... ", filename);
+	fflush(stderr);
+
+	DUR_START(test);
+	len = getFileBuf(&buf, filename);
+
+	if(len <= 0 || buf == NULL) {
+	    fprintf(stderr, "Error: could not read input file\n");
+	    return -1;
+	}
+	DUR_END(test);
+	fprintf(stderr, "done.\n");
+
+	fprintf(stderr, "Loaded %zu bytes in %s, %.03f MB/s\n",
 		len, DUR_HUMANTIME(test_delta), (1000000000.0 / test_delta) * (len / 1000000.0));
 
-    fprintf(stderr, "Parsing data... ");
-    fflush(stderr);
+	fprintf(stderr, "Parsing data... ");
+	fflush(stderr);
 
-    BsDict *dict = bsCreate("test", unindexed ? BS_NOINDEX : BS_NONE);
+	DUR_START(test);
+	if(selcount > 0) {
+	    state = bsParseSelect(dict, buf, len, selpaths, selcount);
+	} else if(json) {
+	    state = bsParseJson(dict, buf, len);
+	} else if(threads > 0) {
+	    state = bsParseParallel(dict, buf, len, threads);
+	} else {
+	    state = bsParse(dict, buf, len);
+	}
+
+    }
 
-    DUR_START(test);
-    BsState state = bsParse(dict, buf, len);
     if(postindex) {
 	bsIndex(dict);
     }
@@ -222,14 +453,112 @@ int main(int argc, char **argv) {
 
     fprintf(stderr, "done.\n");
     fprintf(stderr, "Parsed in %s (%s), %.03f MB/s, %zu nodes, %.0f nodes/s\n",
-		DUR_HUMANTIME(test_delta), (unindexed && postindex) ? "post-indexed" : unindexed ? "unindexed" : "indexed",
+		DUR_HUMANTIME(test_delta), (unindexed && postindex) ? "post-indexed" : unindexed ? "unindexed" : bulkindex ? "bulk-indexed" : "indexed",
 		(1000000000.0 / test_delta) * (len / 1000000.0),
 		dict->nodecount, (1000000000.0 / test_delta) * dict->nodecount);
+    if(threads > 1 && !json && blocksize == 0 && !mapfile && selcount == 0) {
+	fprintf(stderr, "Parsed using up to %d threads\n", threads);
+    }
 #ifdef COLL_DEBUG
     fprintf(stderr, "Total index collisions %d, max per node %d\n", dict->collcount, dict->maxcoll);
 #endif /* COLL_DEBUG */
     nodecount = dict->nodecount;
 
+    /* the same data without building the dictionary, for comparison */
+    if(events && !state.parseError && blocksize == 0 && !mapfile) {
+
+	BsEventHandlers handlers = { .begin = evbegin, .leaf = evleaf, .item = evitem };
+	size_t count[3] = { 0, 0, 0 };
+	double parsedelta = test_delta;
+
+	DUR_START(test);
+	bsParseEvents(buf, len, &handlers, count);
+	DUR_END(test);
+
+	fprintf(stderr, "bsParseEvents() on the same data: %s, %.03f MB/s, %zu blocks, %zu leaves, %zu array members, %.02fx faster than building the dictionary\n",
+		DUR_HUMANTIME(test_delta), (1000000000.0 / test_delta) * (len / 1000000.0),
+		count[0], count[1], count[2], parsedelta / test_delta);
+
+    }
+
+    /* the whole of the same data, for comparison */
+    if(selcount > 0 && !state.parseError && blocksize == 0 && !mapfile) {
+
+	BsDict *other = bsCreate("other", flags);
+	double selectdelta = test_delta;
+
+	DUR_START(test);
+	bsParse(other, buf, len);
+	if(postindex) {
+	    bsIndex(other);
+	}
+	DUR_END(test);
+
+	fprintf(stderr, "bsParse() on the same data: %s, %.03f MB/s, %zu nodes, bsParseSelect() speed-up %.02fx\n",
+		DUR_HUMANTIME(test_delta), (1000000000.0 / test_delta) * (len / 1000000.0),
+		other->nodecount, test_delta / selectdelta);
+
+	bsFree(other);
+
+    }
+
+    /* the same data through the general purpose parser, for comparison */
+    if(json && !state.parseError && blocksize == 0 && !mapfile && selcount == 0) {
+
+	BsDict *other = bsCreate("other", flags);
+	double jsondelta = test_delta;
+
+	DUR_START(test);
+	bsParse(other, buf, len);
+	if(postindex) {
+	    bsIndex(other);
+	}
+	DUR_END(test);
+
+	fprintf(stderr, "bsParse() on the same data: %s, %.03f MB/s, %zu nodes, bsParseJson() speed-up %.02fx\n",
+		DUR_HUMANTIME(test_delta), (1000000000.0 / test_delta) * (len / 1000000.0),
+		other->nodecount, test_delta / jsondelta);
+
+	bsFree(other);
+
+    }
+
+    /* the same file loaded into memory first, for comparison */
+    if(mapfile && !state.parseError) {
+
+	BsDict *other = bsCreate("other", flags);
+	double mapdelta = test_delta;
+	double loaddelta;
+
+	DUR_START(test);
+	len = getFileBuf(&buf, filename);
+	DUR_END(test);
+	loaddelta = test_delta;
+
+	DUR_START(test);
+	if(json) {
+	    bsParseJson(other, buf, len);
+	} else {
+	    bsParse(other, buf, len);
+	}
+	if(postindex) {
+	    bsIndex(other);
+	}
+	DUR_END(test);
+
+	fprintf(stderr, "getFileBuf() on the same file: loaded in %s\n", DUR_HUMANTIME(loaddelta));
+	fprintf(stderr, "bsParse() on the loaded data: parsed in %s, bsParseFile() speed-up %.02fx\n",
+		DUR_HUMANTIME(test_delta), (loaddelta + test_delta) / mapdelta);
+
+	bsFree(other);
+
+    }
+
+    BsMemStats mem = bsMemoryStats(dict);
+    fprintf(stderr, "Memory used: %zu bytes, %.01f bytes/node (nodes %zu, slack %zu, names %zu, values %zu, pool %zu, index %zu, %zu collisions)\n",
+		mem.total, (double)mem.total / nodecount, mem.nodes, mem.slack, mem.names, mem.values,
+		mem.strings, mem.index, mem.collisions);
+
     if(state.parseError) {
 
 	bsPrintError(&state);
@@ -301,7 +630,7 @@ int main(int argc, char **argv) {
 
 
 	if(node != NULL) {
-	    fprintf(stderr, "\nNode found, hash of path \"%s\" is: 0x%08x, node name \"%s\":\n\n", qry, node->hash, node->name);
+	    fprintf(stderr, "\nNode found, hash of path \"%s\" is: 0x%08x, node name \"%.*s\":\n\n", qry, node->hash, (int)node->nameLen, bsGetNodeName(dict, node));
 	    bsDumpNode(stdout, node);
 	    printf("\n");
 	} else {
@@ -311,6 +640,62 @@ int main(int argc, char **argv) {
 
     }
 
+    if(allqry != NULL) {
+
+	LListMember *mb;
+
+	fprintf(stderr, "Testing fetch of all nodes matching \"%s\" from dictionary...", allqry);
+	fflush(stderr);
+	DUR_START(test);
+	LList *all = bsGetAll(NULL, dict, allqry);
+	DUR_END(test);
+	fprintf(stderr, "done.\n");
+	fprintf(stderr, "Fetch took %s, %d nodes found\n\n", DUR_HUMANTIME(test_delta), all->count);
+
+	LL_FOREACH_DYNAMIC(all, mb) {
+	    bsDumpNode(stdout, mb->value);
+	    printf("\n");
+	}
+
+	if(all->count == 0) {
+	    ret = 2;
+	}
+
+	llFree(all);
+
+    }
+
+    if(pattern != NULL) {
+
+	LListMember *mb;
+	size_t walked = 0;
+
+	fprintf(stderr, "Testing fetch of all nodes matching pattern \"%s\" from dictionary...", pattern);
+	fflush(stderr);
+	DUR_START(test);
+	LList *all = bsFind(NULL, dict, pattern);
+	DUR_END(test);
+	fprintf(stderr, "done.\n");
+	fprintf(stderr, "Fetch took %s, %d nodes found\n", DUR_HUMANTIME(test_delta), all->count);
+
+	DUR_START(test);
+	bsWalk(dict, &walked, countcb);
+	DUR_END(test);
+	fprintf(stderr, "For comparison, a walk over all %zu nodes took %s\n\n", walked, DUR_HUMANTIME(test_delta));
+
+	LL_FOREACH_DYNAMIC(all, mb) {
+	    bsDumpNode(stdout, mb->value);
+	    printf("\n");
+	}
+
+	if(all->count == 0) {
+	    ret = 2;
+	}
+
+	llFree(all);
+
+    }
+
     /* random queries begin */
 
     if(randomquery) {
@@ -354,36 +739,108 @@ int main(int argc, char **argv) {
 	fprintf(stderr, "Getting %d random paths from dictionary... ", querycount);
 	fflush(stderr);
 
-#ifdef COLL_DEBUG
-	bool hadit = false;
-#endif /* COLL_DEBUG */
+	/* root samples count as found, see above */
+	const int rootfound = found;
+
+	found += fetchPaths(dict, paths, querycount, &test_delta);
+	fprintf(stderr, "done.\n");
+	fprintf(stderr, "Found %d out of %d nodes (index: %s, %zu bytes), average %s per fetch\n", found, querycount,
+		dict->indexOps->name, bsMemoryStats(dict).index, DUR_HUMANTIME(test_delta / querycount));
+
+	/* the same paths compiled once, then fetched */
+	BsQuery **queries;
+	xmalloc(queries, querycount * sizeof(BsQuery*));
+
+	fprintf(stderr, "Compiling the same paths... ");
+	fflush(stderr);
 	DUR_START(test);
-	for(int i = 0; i< querycount; i++) {
-	    node = bsGet(dict, paths[i]);
-	    if(node != NULL) {
-		found++;
+	for(int i = 0; i < querycount; i++) {
+	    queries[i] = bsCompileQuery(paths[i]);
+	}
+	DUR_END(test);
+	fprintf(stderr, "done, average %s per query.\n", DUR_HUMANTIME(test_delta / querycount));
+
+	fprintf(stderr, "Getting the same nodes by compiled query... ");
+	fflush(stderr);
+	found = rootfound + fetchQueries(dict, queries, querycount, &test_delta);
+	fprintf(stderr, "done.\n");
+	fprintf(stderr, "Found %d out of %d nodes (index: %s, compiled), average %s per fetch\n", found, querycount,
+		dict->indexOps->name, DUR_HUMANTIME(test_delta / querycount));
+
+	if(batch) {
+
+	    BsNode **nodes;
+	    xmalloc(nodes, querycount * sizeof(BsNode*));
+
+	    fprintf(stderr, "Getting the same paths in one batch... ");
+	    fflush(stderr);
+	    DUR_START(test);
+	    bsGetMany(dict, (const char**)paths, querycount, nodes);
+	    DUR_END(test);
+	    fprintf(stderr, "done.\n");
+
+	    found = rootfound;
+	    for(int i = 0; i < querycount; i++) {
+		if(nodes[i] != NULL) {
+		    found++;
+		}
 	    }
-#ifdef COLL_DEBUG
-	    else {
-		if(!hadit) {
-		    fprintf(stderr, "\n");
+
+	    fprintf(stderr, "Found %d out of %d nodes (index: %s, batch), average %s per fetch\n", found, querycount,
+		    dict->indexOps->name, DUR_HUMANTIME(test_delta / querycount));
+
+	    fprintf(stderr, "Getting the same nodes in one batch by compiled query... ");
+	    fflush(stderr);
+	    DUR_START(test);
+	    bsQueryGetMany(dict, NULL, queries, querycount, nodes);
+	    DUR_END(test);
+	    fprintf(stderr, "done.\n");
+
+	    found = rootfound;
+	    for(int i = 0; i < querycount; i++) {
+		if(nodes[i] != NULL) {
+		    found++;
 		}
-		fprintf(stderr, "* Node not found: \"%s\"\n", paths[i]);
-		hadit = true;
 	    }
-#endif /* COLL_DEBUG */
+
+	    fprintf(stderr, "Found %d out of %d nodes (index: %s, batch, compiled), average %s per fetch\n", found, querycount,
+		    dict->indexOps->name, DUR_HUMANTIME(test_delta / querycount));
+
+	    free(nodes);
+
+	}
+
+	/* the same fetches from copies of the dictionary indexed with the other backends */
+	const BsIndexOps *backends[] = { &bsIndexRbt, &bsIndexHash };
+
+	for(int i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+
+	    if(backends[i] == dict->indexOps) {
+		continue;
+	    }
+
+	    BsDict *other = bsDuplicate(dict, "other", (dict->flags & ~(BS_NOINDEX | BS_BULKINDEX | BS_INDEX_HASH)) |
+					(backends[i] == &bsIndexHash ? BS_INDEX_HASH : BS_NONE));
+
+	    fprintf(stderr, "Getting the same paths from a copy indexed with %s... ", backends[i]->name);
+	    fflush(stderr);
+	    found = rootfound + fetchPaths(other, paths, querycount, &test_delta);
+	    fprintf(stderr, "done.\n");
+	    fprintf(stderr, "Found %d out of %d nodes (index: %s, %zu bytes), average %s per fetch\n", found, querycount,
+		    other->indexOps->name, bsMemoryStats(other).index, DUR_HUMANTIME(test_delta / querycount));
+
+	    bsFree(other);
+
 	}
-	DUR_END(test);
-	fprintf(stderr, "done.\n");
-	fprintf(stderr, "Found %d out of %d nodes (%s), average %s per fetch\n", found, querycount,
-		(unindexed && !postindex) ? "unindexed" : "indexed", DUR_HUMANTIME(test_delta / querycount));
 
 	fprintf(stderr, "Freeing test data... ");
 	fflush(stderr);
 
 	for(int i = 0; i< querycount; i++) {
 	    free(paths[i]);
+	    bsFreeQuery(queries[i]);
 	}
+	free(queries);
 	free(samples);
 	free(sarr);
 	fprintf(stderr, "done.\n");
@@ -428,6 +885,7 @@ int main(int argc, char **argv) {
 
 
     free(buf);
+    bsParserFree(parser);
 
     return ret;
 
@@ -0,0 +1,180 @@
+/* BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Wojciech Owczarek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file   strpool.c
+ * @date   Sat Oct 20 14:02:11 2018
+ *
+ * @brief  A simple reference counted string interning pool. Every distinct
+ *         string is stored once, with its xxHash32 cached alongside it.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "xalloc.h"
+#include "xxh.h"
+#include "strpool.h"
+
+/* smallest bucket table we will bother with */
+#define SP_MINSIZE 64
+
+/* grow the bucket table 2x - entries carry their hashes, so nothing is rehashed */
+static void spGrow(StrPool* pool) {
+
+    size_t newsize = pool->size * 2;
+    SpEntry **buckets;
+    SpEntry *e, *next;
+
+    xcalloc(buckets, newsize, sizeof(SpEntry*));
+
+    for(size_t i = 0; i < pool->size; i++) {
+	for(e = pool->buckets[i]; e != NULL; e = next) {
+	    next = e->_next;
+	    e->_next = buckets[e->hash & (newsize - 1)];
+	    buckets[e->hash & (newsize - 1)] = e;
+	}
+    }
+
+    free(pool->buckets);
+    pool->buckets = buckets;
+    pool->size = newsize;
+
+}
+
+/* create a string pool with (at least) @size buckets */
+StrPool* spCreate(const size_t size) {
+
+    StrPool* pool;
+    size_t sz = SP_MINSIZE;
+
+    while(sz < size) {
+	sz *= 2;
+    }
+
+    xmalloc(pool, sizeof(StrPool));
+    xcalloc(pool->buckets, sz, sizeof(SpEntry*));
+    pool->size = sz;
+    pool->count = 0;
+    pool->bytes = 0;
+
+    return pool;
+
+}
+
+/* free the pool and all strings in it */
+void spFree(StrPool* pool) {
+
+    SpEntry *e, *next;
+
+    if(pool == NULL) {
+	return;
+    }
+
+    for(size_t i = 0; i < pool->size; i++) {
+	for(e = pool->buckets[i]; e != NULL; e = next) {
+	    next = e->_next;
+	    free(e);
+	}
+    }
+
+    free(pool->buckets);
+    free(pool);
+
+}
+
+/* same as spIntern, but with the xxHash32 of the string already known */
+char* spInternHashed(StrPool* pool, const char* str, const size_t len, const uint32_t hash) {
+
+    SpEntry **bucket = &pool->buckets[hash & (pool->size - 1)];
+    SpEntry *e;
+
+    for(e = *bucket; e != NULL; e = e->_next) {
+	if(e->hash == hash && e->len == len && !memcmp(e->data, str, len)) {
+	    e->refcount++;
+	    return e->data;
+	}
+    }
+
+    xmalloc(e, sizeof(SpEntry) + len + 1);
+    memcpy(e->data, str, len);
+    e->data[len] = '\0';
+    e->len = len;
+    e->hash = hash;
+    e->refcount = 1;
+    e->_next = *bucket;
+    *bucket = e;
+
+    pool->bytes += len + 1;
+
+    /* keep the load factor at or below 1 */
+    if(++pool->count > pool->size) {
+	spGrow(pool);
+    }
+
+    return e->data;
+
+}
+
+/* get a reference to pooled copy of @len bytes of @str, adding it if not pooled yet */
+char* spIntern(StrPool* pool, const char* str, const size_t len) {
+
+    return spInternHashed(pool, str, len, xxHash32(str, len));
+
+}
+
+/* get another reference to an already pooled string */
+char* spRetain(char* str) {
+
+    SP_ENTRY(str)->refcount++;
+    return str;
+
+}
+
+/* drop a reference to a pooled string, removing it from the pool once unreferenced */
+void spRelease(StrPool* pool, char* str) {
+
+    SpEntry *e = SP_ENTRY(str);
+    SpEntry **marker;
+
+    if(--e->refcount > 0) {
+	return;
+    }
+
+    for(marker = &pool->buckets[e->hash & (pool->size - 1)]; *marker != NULL; marker = &(*marker)->_next) {
+	if(*marker == e) {
+	    *marker = e->_next;
+	    pool->count--;
+	    pool->bytes -= e->len + 1;
+	    free(e);
+	    return;
+	}
+    }
+
+}
@@ -0,0 +1,81 @@
+/* BSD 2-Clause License
+ *
+ * Copyright (c) 2018, Wojciech Owczarek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * @file   strpool.h
+ * @date   Sat Oct 20 14:02:11 2018
+ *
+ * @brief  A simple reference counted string interning pool. Every distinct
+ *         string is stored once, with its xxHash32 cached alongside it.
+ *
+ */
+
+#ifndef STRPOOL_H_
+#define STRPOOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* a pooled string - the string data is what the user gets to see */
+typedef struct SpEntry SpEntry;
+struct SpEntry {
+    SpEntry *_next;		/* bucket chain */
+    size_t len;			/* string length */
+    uint32_t hash;		/* xxHash32 of the string */
+    uint32_t refcount;		/* number of references held */
+    char data[];		/* NUL-terminated string data */
+};
+
+/* the pool */
+typedef struct {
+    SpEntry **buckets;		/* bucket table, power of 2 sized */
+    size_t size;		/* number of buckets */
+    size_t count;		/* number of distinct strings held */
+    size_t bytes;		/* total size of string data held, including NUL-termination */
+} StrPool;
+
+/* get the pool entry holding a pooled string */
+#define SP_ENTRY(str) ((SpEntry*)((char*)(str) - offsetof(SpEntry, data)))
+/* get the cached hash of a pooled string */
+#define spHash(str) (SP_ENTRY(str)->hash)
+/* get the length of a pooled string */
+#define spLen(str) (SP_ENTRY(str)->len)
+
+/* create a string pool with (at least) @size buckets */
+StrPool* spCreate(const size_t size);
+/* free the pool and all strings in it */
+void spFree(StrPool* pool);
+/* get a reference to pooled copy of @len bytes of @str, adding it if not pooled yet */
+char* spIntern(StrPool* pool, const char* str, const size_t len);
+/* same as spIntern, but with the xxHash32 of the string already known */
+char* spInternHashed(StrPool* pool, const char* str, const size_t len, const uint32_t hash);
+/* get another reference to an already pooled string */
+char* spRetain(char* str);
+/* drop a reference to a pooled string, removing it from the pool once unreferenced */
+void spRelease(StrPool* pool, char* str);
+
+#endif /* STRPOOL_H_ */